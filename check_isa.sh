@@ -0,0 +1,63 @@
+#!/usr/bin/bash -eu
+
+# Usage: check_isa.sh ISA BINARY
+#
+# Fail if BINARY has any instruction that the x86-64 microarchitecture level
+# ISA (x86-64, x86-64-v2, x86-64-v3 or x86-64-v4) does not have. Each level
+# is detected by its registers, operand syntax and mnemonics in the output of
+# objdump.
+
+[ $# -eq 2 ] || { echo "Usage: $0 ISA BINARY"; exit 1; }
+
+case "$1" in
+    x86-64 )    level=1 ;;
+    x86-64-v2 ) level=2 ;;
+    x86-64-v3 ) level=3 ;;
+    x86-64-v4 ) level=4 ;;
+    * ) echo "Unknown ISA: $1"; exit 1 ;;
+esac
+
+# x86-64-v2: SSE3, SSSE3, SSE4.1, SSE4.2, POPCNT and CMPXCHG16B
+v2='^(popcnt|crc32|cmpxchg16b|pshufb|phadd|phsub|pmaddubsw|pmulhrsw|psign'
+v2+='|pabs|palignr|pblend|blendv?p|ptest|pmin(s[bd]|u[wd])|pmax(s[bd]|u[wd])'
+v2+='|pmov[sz]x|pmuldq|pmulld|packusdw|pcmp(eq|gt)q|pextr[bdq]|pinsr[bdq]'
+v2+='|extractps|insertps|round[ps][sd]|dpp[sd]|mpsadbw|phminposuw|movntdqa'
+v2+='|pcmp[ei]str[im]|addsubp|hadd|hsub|movddup|movs[hl]dup|lddqu)'
+# x86-64-v3: anything VEX-encoded (AVX, AVX2, FMA, F16C), BMI1, BMI2, LZCNT
+# and MOVBE. tzcnt is left out since GCC emits rep bsf for the baseline,
+# which objdump shows as tzcnt and older CPUs run as bsf.
+v3='%ymm|^v|^(andn|bextr|blsi|blsmsk|blsr|bzhi|mulx|pdep|pext|rorx|sarx|shlx'
+v3+='|shrx|lzcnt|movbe)[wlq]?( |$)'
+v3_vmx='^(vmcall|vmlaunch|vmresume|vmread|vmwrite|vmxon|vmxoff|vmptrld'
+v3_vmx+='|vmptrst|vmclear|vmfunc|verr|verw)( |$)'
+# x86-64-v4: AVX-512 F, BW, CD, DQ and VL
+v4='%zmm|%[xy]mm(1[6-9]|2[0-9]|3[01])|%k[0-7]|\{1to|sae\}|^k[a-z]+[bwdq] '
+v4+='|^vpternlog|^vperm([bw]|[it]2)|^vpro[lr]|^vpmadd52|^vpconflict|^vplzcnt'
+v4+='|^v(p)?compress|^v(p)?expand|^v(p)?scatter|^vrcp14|^vrsqrt14|^vscalef'
+v4+='|^vgetexp|^vgetmant|^vfixupimm|^vrange|^vreduce|^vfpclass|^valign[dq]'
+v4+='|^vdbpsadbw|^vpmullq|^vpabsq|^vp(max|min)[su]q|^vpsra(v)?q'
+v4+='|^vp(sllv|srlv|srav)w|^vp(andn?|x?or)[dq] |^vmovdq[au](8|16|32|64)'
+v4+='|^vpmovu?s?[qdw][bwd] |^vpmov(m2|[bwdq]2m)|^vptestn?m|^vpcmpu?[bwdq] '
+v4+='|^v(p)?blendm|^v(extract|insert|broadcast|shuf)[fi](32|64)x'
+v4+='|^vcvt[a-z0-9]*(u|qq)'
+
+# "mnemonic operands" of each instruction
+insns=$(${OBJDUMP:-objdump} -d --no-show-raw-insn "$2" |
+    awk -F'\t' 'NF >= 2 && $1 ~ /:$/ { print $2 }')
+
+fail=0
+# check NAME PATTERN [EXCLUDED-PATTERN]
+check(){
+    found=$(echo "$insns" | grep -E "$2" || true)
+    [ $# -lt 3 ] || found=$(echo "$found" | grep -Ev "$3" || true)
+    if [ -n "$found" ]; then
+        echo "Instructions of $1 found:"
+        echo "$found" | head -20
+        fail=1
+    fi
+}
+[ $level -ge 2 ] || check "x86-64-v2" "$v2"
+[ $level -ge 3 ] || check "x86-64-v3" "$v3" "$v3_vmx"
+[ $level -ge 4 ] || check "x86-64-v4" "$v4"
+
+[ $fail -eq 0 ] || { echo "$2 has instructions that $1 does not have"; exit 1; }
@@ -1,9 +1,11 @@
 #ifndef HOMFA_ARCHIVE_HPP
 #define HOMFA_ARCHIVE_HPP
 
+#include "async_io.hpp"
 #include "error.hpp"
 
 #include <fstream>
+#include <sstream>
 
 #include <cereal/archives/portable_binary.hpp>
 #include <cereal/cereal.hpp>
@@ -67,4 +69,13 @@ void write_to_archive(const std::string& path, const T& src)
     }
 }
 
+// Serialize src now and write it into path on the thread of io
+template <class T>
+void write_to_archive(AsyncIO& io, const std::string& path, const T& src)
+{
+    std::ostringstream oss;
+    write_to_archive(oss, src);
+    io.write_file(path, std::move(oss).str());
+}
+
 #endif
@@ -0,0 +1,529 @@
+#include "async_io.hpp"
+#include "error.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <unordered_map>
+
+#include <spdlog/spdlog.h>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define HOMFA_HAS_IO_URING
+#endif
+
+////////// IOUring
+
+#ifdef HOMFA_HAS_IO_URING
+class IOUring {
+private:
+    int fd_;
+    unsigned entries_;
+    void *sq_ptr_, *cq_ptr_;
+    size_t sq_size_, cq_size_, sqes_size_;
+    io_uring_sqe* sqes_;
+    unsigned *sq_head_, *sq_tail_, *sq_mask_, *sq_array_;
+    unsigned *cq_head_, *cq_tail_, *cq_mask_;
+    io_uring_cqe* cqes_;
+    // Tail of the submission queue including the entries not submitted yet
+    unsigned sq_local_tail_;
+
+private:
+    IOUring()
+        : fd_(-1),
+          entries_(0),
+          sq_ptr_(MAP_FAILED),
+          cq_ptr_(MAP_FAILED),
+          sq_size_(0),
+          cq_size_(0),
+          sqes_size_(0),
+          sqes_(static_cast<io_uring_sqe*>(MAP_FAILED)),
+          sq_local_tail_(0)
+    {
+    }
+
+    template <class T>
+    T* at(void* base, size_t offset)
+    {
+        return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+    }
+
+public:
+    ~IOUring()
+    {
+        if (sqes_ != MAP_FAILED)
+            munmap(sqes_, sqes_size_);
+        if (cq_ptr_ != MAP_FAILED && cq_ptr_ != sq_ptr_)
+            munmap(cq_ptr_, cq_size_);
+        if (sq_ptr_ != MAP_FAILED)
+            munmap(sq_ptr_, sq_size_);
+        if (fd_ >= 0)
+            close(fd_);
+    }
+
+    // Return nullptr if the kernel does not support io_uring, or does not
+    // read from the current file position, which pipes need
+    static std::unique_ptr<IOUring> create(unsigned entries)
+    {
+        std::unique_ptr<IOUring> ring{new IOUring};
+        io_uring_params p = {};
+        ring->fd_ = syscall(__NR_io_uring_setup, entries, &p);
+        if (ring->fd_ < 0 || !(p.features & IORING_FEAT_RW_CUR_POS))
+            return nullptr;
+        ring->entries_ = p.sq_entries;
+
+        ring->sq_size_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        ring->cq_size_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        if (p.features & IORING_FEAT_SINGLE_MMAP)
+            ring->sq_size_ = ring->cq_size_ =
+                std::max(ring->sq_size_, ring->cq_size_);
+        ring->sq_ptr_ = mmap(nullptr, ring->sq_size_, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, ring->fd_,
+                             IORING_OFF_SQ_RING);
+        if (ring->sq_ptr_ == MAP_FAILED)
+            return nullptr;
+        if (p.features & IORING_FEAT_SINGLE_MMAP)
+            ring->cq_ptr_ = ring->sq_ptr_;
+        else
+            ring->cq_ptr_ = mmap(nullptr, ring->cq_size_,
+                                 PROT_READ | PROT_WRITE,
+                                 MAP_SHARED | MAP_POPULATE, ring->fd_,
+                                 IORING_OFF_CQ_RING);
+        if (ring->cq_ptr_ == MAP_FAILED)
+            return nullptr;
+        ring->sqes_size_ = p.sq_entries * sizeof(io_uring_sqe);
+        ring->sqes_ = static_cast<io_uring_sqe*>(
+            mmap(nullptr, ring->sqes_size_, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, ring->fd_, IORING_OFF_SQES));
+        if (ring->sqes_ == MAP_FAILED)
+            return nullptr;
+
+        ring->sq_head_ = ring->at<unsigned>(ring->sq_ptr_, p.sq_off.head);
+        ring->sq_tail_ = ring->at<unsigned>(ring->sq_ptr_, p.sq_off.tail);
+        ring->sq_mask_ = ring->at<unsigned>(ring->sq_ptr_, p.sq_off.ring_mask);
+        ring->sq_array_ = ring->at<unsigned>(ring->sq_ptr_, p.sq_off.array);
+        ring->cq_head_ = ring->at<unsigned>(ring->cq_ptr_, p.cq_off.head);
+        ring->cq_tail_ = ring->at<unsigned>(ring->cq_ptr_, p.cq_off.tail);
+        ring->cq_mask_ = ring->at<unsigned>(ring->cq_ptr_, p.cq_off.ring_mask);
+        ring->cqes_ = ring->at<io_uring_cqe>(ring->cq_ptr_, p.cq_off.cqes);
+        ring->sq_local_tail_ = *ring->sq_tail_;
+        return ring;
+    }
+
+    unsigned entries() const
+    {
+        return entries_;
+    }
+
+    // Return a cleared entry to fill, or nullptr if the queue is full
+    io_uring_sqe* get_sqe()
+    {
+        const unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+        if (sq_local_tail_ - head >= entries_)
+            return nullptr;
+        const unsigned index = sq_local_tail_ & *sq_mask_;
+        io_uring_sqe* sqe = &sqes_[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+        sq_array_[index] = index;
+        sq_local_tail_++;
+        return sqe;
+    }
+
+    // Submit the filled entries and wait for at least min_complete
+    // completions
+    void submit_and_wait(unsigned min_complete)
+    {
+        __atomic_store_n(sq_tail_, sq_local_tail_, __ATOMIC_RELEASE);
+        while (true) {
+            // The kernel consumes the entries in io_uring_enter, so the ones
+            // after the head are not submitted yet
+            const unsigned to_submit =
+                sq_local_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+            int res = syscall(__NR_io_uring_enter, fd_, to_submit,
+                              min_complete,
+                              min_complete != 0 ? IORING_ENTER_GETEVENTS : 0,
+                              nullptr, 0);
+            if (res >= 0)
+                return;
+            if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+                error_die("io_uring_enter failed: {}", std::strerror(errno));
+        }
+    }
+
+    // Call func(user_data, res) for each completion
+    template <class Func>
+    void each_completion(Func func)
+    {
+        unsigned head = *cq_head_;
+        const unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            const io_uring_cqe& cqe = cqes_[head & *cq_mask_];
+            func(cqe.user_data, cqe.res);
+        }
+        __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    }
+};
+#else
+class IOUring {
+public:
+    static std::unique_ptr<IOUring> create(unsigned)
+    {
+        return nullptr;
+    }
+};
+#endif
+
+////////// AsyncIO
+
+namespace {
+constexpr unsigned IO_URING_ENTRIES = 64;
+// user_data of the completions that are not of requests
+constexpr uint64_t EVENT_TAG = 0, CANCEL_TAG = 1;
+// Bytes in a read or write of io_uring, whose length is 32-bit
+constexpr size_t MAX_IO_SIZE = 1u << 30;
+
+std::string name_of_file(const std::string& path, int fd)
+{
+    return path.empty() ? fmt::format("file descriptor {}", fd) : path;
+}
+}  // namespace
+
+AsyncIO::AsyncIO()
+    : ring_(IOUring::create(IO_URING_ENTRIES)),
+      event_fd_(eventfd(0, EFD_CLOEXEC)),
+      mtx_(),
+      cv_writes_done_(),
+      queue_(),
+      num_pending_writes_(0),
+      stop_(false),
+      thread_()
+{
+    if (event_fd_ < 0)
+        error_die("Could not create eventfd: {}", std::strerror(errno));
+    if (!ring_)
+        spdlog::debug("io_uring is not available. Use system calls instead");
+    thread_ = std::thread{[this] {
+        if (ring_)
+            run_io_uring();
+        else
+            run_syscalls();
+    }};
+}
+
+AsyncIO::~AsyncIO()
+{
+    flush();
+    {
+        std::lock_guard lk{mtx_};
+        stop_ = true;
+    }
+    notify();
+    thread_.join();
+    close(event_fd_);
+}
+
+void AsyncIO::push(std::unique_ptr<Request> req)
+{
+    {
+        std::lock_guard lk{mtx_};
+        assert(!stop_);
+        if (req->op != Request::OP::READ)
+            num_pending_writes_++;
+        queue_.push_back(std::move(req));
+    }
+    notify();
+}
+
+void AsyncIO::notify()
+{
+    const uint64_t one = 1;
+    while (::write(event_fd_, &one, sizeof(one)) < 0 && errno == EINTR)
+        ;
+}
+
+std::vector<std::unique_ptr<AsyncIO::Request>> AsyncIO::take_queue(
+    bool& stop)
+{
+    std::lock_guard lk{mtx_};
+    std::vector<std::unique_ptr<Request>> ret;
+    for (auto&& req : queue_)
+        ret.push_back(std::move(req));
+    queue_.clear();
+    stop = stop_;
+    return ret;
+}
+
+void AsyncIO::open_for_write(Request& req)
+{
+    if (req.path.empty())
+        return;
+    req.fd = open(req.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                  0644);
+    if (req.fd < 0)
+        error_die("Unable to open {}: {}", req.path, std::strerror(errno));
+}
+
+void AsyncIO::finish_write(Request& req)
+{
+    if (!req.path.empty() && close(req.fd) < 0)
+        error_die("Unable to write into {}: {}", req.path,
+                  std::strerror(errno));
+    std::lock_guard lk{mtx_};
+    num_pending_writes_--;
+    cv_writes_done_.notify_all();
+}
+
+#ifdef HOMFA_HAS_IO_URING
+void AsyncIO::run_io_uring()
+{
+    IOUring& ring = *ring_;
+    // Requests submitted to the ring, and those waiting for space in it
+    std::unordered_map<Request*, std::unique_ptr<Request>> in_flight;
+    std::deque<std::unique_ptr<Request>> backlog;
+    uint64_t event_buf;
+    bool stop = false, cancelled = false;
+
+    // Keep a read of the eventfd in flight, whose completion wakes the
+    // thread up for new requests
+    auto arm_event = [&] {
+        io_uring_sqe* sqe = ring.get_sqe();
+        assert(sqe);
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = event_fd_;
+        sqe->addr = reinterpret_cast<uint64_t>(&event_buf);
+        sqe->len = sizeof(event_buf);
+        sqe->off = -1;
+        sqe->user_data = EVENT_TAG;
+    };
+    arm_event();
+
+    while (true) {
+        for (auto&& req : take_queue(stop)) {
+            if (req->op == Request::OP::WRITE)
+                open_for_write(*req);
+            backlog.push_back(std::move(req));
+        }
+
+        // Leave space for the eventfd and a cancellation
+        while (!backlog.empty() && in_flight.size() + 2 < ring.entries()) {
+            // Submit a sync after the writes before it are done. The
+            // requests after the sync wait for it to keep the order.
+            const Request& front = *backlog.front();
+            if (front.op == Request::OP::SYNC &&
+                std::any_of(in_flight.begin(), in_flight.end(),
+                            [&](auto&& p) {
+                                return p.first->op == Request::OP::WRITE &&
+                                       p.first->fd == front.fd;
+                            }))
+                break;
+
+            std::unique_ptr<Request> req = std::move(backlog.front());
+            backlog.pop_front();
+            io_uring_sqe* sqe = ring.get_sqe();
+            assert(sqe);
+            sqe->fd = req->fd;
+            switch (req->op) {
+            case Request::OP::READ:
+                sqe->opcode = IORING_OP_READ;
+                sqe->addr = reinterpret_cast<uint64_t>(req->buf);
+                sqe->len = std::min(req->size, MAX_IO_SIZE);
+                sqe->off = -1;
+                break;
+            case Request::OP::WRITE:
+                sqe->opcode = IORING_OP_WRITE;
+                sqe->addr = reinterpret_cast<uint64_t>(req->data.data() +
+                                                       req->done);
+                sqe->len = std::min(req->data.size() - req->done, MAX_IO_SIZE);
+                sqe->off = req->offset + req->done;
+                break;
+            case Request::OP::SYNC:
+                sqe->opcode = IORING_OP_FSYNC;
+                break;
+            }
+            sqe->user_data = reinterpret_cast<uint64_t>(req.get());
+            in_flight.emplace(req.get(), std::move(req));
+        }
+
+        if (stop && !cancelled) {
+            // Only reads can be left since the destructor waits for writes
+            for (auto&& [ptr, req] : in_flight) {
+                assert(req->op == Request::OP::READ);
+                io_uring_sqe* sqe = ring.get_sqe();
+                assert(sqe);
+                sqe->opcode = IORING_OP_ASYNC_CANCEL;
+                sqe->addr = reinterpret_cast<uint64_t>(ptr);
+                sqe->user_data = CANCEL_TAG;
+            }
+            cancelled = true;
+        }
+        if (stop && in_flight.empty() && backlog.empty())
+            break;
+
+        ring.submit_and_wait(1);
+
+        bool rearm = false;
+        ring.each_completion([&](uint64_t user_data, int res) {
+            if (user_data == EVENT_TAG) {
+                rearm = true;
+                return;
+            }
+            if (user_data == CANCEL_TAG)
+                return;
+            auto it = in_flight.find(reinterpret_cast<Request*>(user_data));
+            assert(it != in_flight.end());
+            std::unique_ptr<Request> req = std::move(it->second);
+            in_flight.erase(it);
+
+            if (req->op == Request::OP::READ) {
+                req->promise.set_value(res);
+                return;
+            }
+            if (res < 0)
+                error_die("Unable to write into {}: {}",
+                          name_of_file(req->path, req->fd),
+                          std::strerror(-res));
+            req->done += res;
+            if (req->op == Request::OP::WRITE && req->done < req->data.size())
+                backlog.push_front(std::move(req));
+            else
+                finish_write(*req);
+        });
+        if (rearm)
+            arm_event();
+    }
+}
+#else
+void AsyncIO::run_io_uring()
+{
+    assert(false);
+}
+#endif
+
+void AsyncIO::run_syscalls()
+{
+    std::vector<std::unique_ptr<Request>> reads;
+    bool stop = false;
+    while (true) {
+        for (auto&& req : take_queue(stop)) {
+            if (req->op == Request::OP::READ) {
+                reads.push_back(std::move(req));
+                continue;
+            }
+            open_for_write(*req);
+            while (req->done < req->data.size()) {
+                ssize_t res = pwrite(req->fd, req->data.data() + req->done,
+                                     req->data.size() - req->done,
+                                     req->offset + req->done);
+                if (res < 0 && errno != EINTR)
+                    error_die("Unable to write into {}: {}",
+                              name_of_file(req->path, req->fd),
+                              std::strerror(errno));
+                req->done += std::max<ssize_t>(res, 0);
+            }
+            if (req->op == Request::OP::SYNC && fsync(req->fd) < 0)
+                error_die("Unable to sync {}: {}",
+                          name_of_file(req->path, req->fd),
+                          std::strerror(errno));
+            finish_write(*req);
+        }
+        if (stop) {
+            for (auto&& req : reads)
+                req->promise.set_value(-ECANCELED);
+            break;
+        }
+
+        // Wait for new requests or input to read
+        std::vector<pollfd> fds{{event_fd_, POLLIN, 0}};
+        for (auto&& req : reads)
+            fds.push_back({req->fd, POLLIN, 0});
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            error_die("poll failed: {}", std::strerror(errno));
+        }
+        if (fds.at(0).revents != 0) {
+            uint64_t buf;
+            while (::read(event_fd_, &buf, sizeof(buf)) < 0 && errno == EINTR)
+                ;
+        }
+        std::vector<std::unique_ptr<Request>> waiting;
+        for (size_t i = 0; i < reads.size(); i++) {
+            std::unique_ptr<Request>& req = reads.at(i);
+            if (fds.at(i + 1).revents == 0) {
+                waiting.push_back(std::move(req));
+                continue;
+            }
+            ssize_t res = ::read(req->fd, req->buf, req->size);
+            req->promise.set_value(res < 0 ? -errno : res);
+        }
+        reads = std::move(waiting);
+    }
+}
+
+std::future<ssize_t> AsyncIO::read(int fd, char* buf, size_t size)
+{
+    auto req = std::make_unique<Request>();
+    req->op = Request::OP::READ;
+    req->fd = fd;
+    req->buf = buf;
+    req->size = size;
+    req->offset = 0;
+    req->done = 0;
+    std::future<ssize_t> ret = req->promise.get_future();
+    push(std::move(req));
+    return ret;
+}
+
+void AsyncIO::write_file(std::string path, std::string data)
+{
+    auto req = std::make_unique<Request>();
+    req->op = Request::OP::WRITE;
+    req->fd = -1;
+    req->buf = nullptr;
+    req->size = 0;
+    req->path = std::move(path);
+    req->data = std::move(data);
+    req->offset = 0;
+    req->done = 0;
+    push(std::move(req));
+}
+
+void AsyncIO::write_at(int fd, uint64_t offset, std::string data)
+{
+    auto req = std::make_unique<Request>();
+    req->op = Request::OP::WRITE;
+    req->fd = fd;
+    req->buf = nullptr;
+    req->size = 0;
+    req->data = std::move(data);
+    req->offset = offset;
+    req->done = 0;
+    push(std::move(req));
+}
+
+void AsyncIO::sync(int fd)
+{
+    auto req = std::make_unique<Request>();
+    req->op = Request::OP::SYNC;
+    req->fd = fd;
+    req->buf = nullptr;
+    req->size = 0;
+    req->offset = 0;
+    req->done = 0;
+    push(std::move(req));
+}
+
+void AsyncIO::flush()
+{
+    std::unique_lock lk{mtx_};
+    cv_writes_done_.wait(lk, [&] { return num_pending_writes_ == 0; });
+}
@@ -0,0 +1,91 @@
+#ifndef HOMFA_ASYNC_IO_HPP
+#define HOMFA_ASYNC_IO_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/types.h>
+
+// Ring of io_uring driven by raw system calls. Defined in async_io.cpp.
+class IOUring;
+
+// File I/O done on a dedicated thread so that the caller never blocks on
+// storage. The requests queued while the thread is busy are submitted to
+// io_uring at once. On kernels without io_uring (or without the features
+// used here, which came in Linux 5.6), the thread does them by plain system
+// calls instead.
+class AsyncIO {
+private:
+    struct Request {
+        enum class OP { READ, WRITE, SYNC } op;
+        int fd;
+        // READ: buf of size bytes, and the result of read(2)
+        char* buf;
+        size_t size;
+        std::promise<ssize_t> promise;
+        // WRITE: data is written into fd from offset, of which done bytes are
+        // already written. fd is opened from path unless path is empty.
+        std::string path, data;
+        uint64_t offset;
+        size_t done;
+    };
+
+    std::unique_ptr<IOUring> ring_;
+    // Written to wake the thread up when a request is queued
+    int event_fd_;
+
+    std::mutex mtx_;
+    std::condition_variable cv_writes_done_;
+    std::deque<std::unique_ptr<Request>> queue_;
+    size_t num_pending_writes_;
+    bool stop_;
+
+    std::thread thread_;
+
+private:
+    void push(std::unique_ptr<Request> req);
+    void notify();
+    // Take the queued requests. stop is set if the destructor has been called.
+    std::vector<std::unique_ptr<Request>> take_queue(bool& stop);
+    void open_for_write(Request& req);
+    // Called when a write or sync is done
+    void finish_write(Request& req);
+    void run_io_uring();
+    void run_syscalls();
+
+public:
+    AsyncIO();
+    // Wait for the writes, and cancel the reads still waiting for input
+    ~AsyncIO();
+    AsyncIO(const AsyncIO&) = delete;
+    AsyncIO& operator=(const AsyncIO&) = delete;
+
+    bool uses_io_uring() const
+    {
+        return ring_ != nullptr;
+    }
+
+    // Read at most size bytes from the current position of fd into buf, as
+    // read(2) does. The result is -ECANCELED if the read is still waiting
+    // when this is destroyed. buf must stay valid until then.
+    std::future<ssize_t> read(int fd, char* buf, size_t size);
+    // Create or truncate the file at path and write data into it. Failures
+    // are fatal.
+    void write_file(std::string path, std::string data);
+    // Write data into fd from offset. fd must stay open until flush()
+    // returns. Failures are fatal.
+    void write_at(int fd, uint64_t offset, std::string data);
+    // fsync(2) fd after the writes into it requested so far are done
+    void sync(int fd);
+    // Wait until all the writes and syncs requested so far are done
+    void flush();
+};
+
+#endif
@@ -1,18 +1,38 @@
 #include "backstream_dfa_runner.hpp"
 #include "error.hpp"
 
+#include <cmath>
 #include <execution>
+#include <numeric>
 
 #include <spdlog/spdlog.h>
 
 BackstreamDFARunner::BackstreamDFARunner(Graph graph, size_t boot_interval,
                                          std::optional<size_t> input_size,
+                                         size_t num_phases,
                                          std::shared_ptr<EvalKey> eval_key,
                                          bool sanitize_result)
+    : BackstreamDFARunner(graph, {graph.final_states()}, boot_interval,
+                          std::move(input_size), num_phases,
+                          std::move(eval_key), nullptr, sanitize_result)
+{
+}
+
+BackstreamDFARunner::BackstreamDFARunner(
+    Graph graph, const Graph::ComponentFinalStates& final_sts,
+    size_t boot_interval, std::optional<size_t> input_size,
+    size_t num_phases, std::shared_ptr<EvalKey> eval_key,
+    std::shared_ptr<TFHEpp::TLWE2TRLWEIKSKey<TFHEpp::lvl11param>>
+        tlwel1_trlwel1_iks_key,
+    bool sanitize_result)
     : graph_(std::move(graph)),
+      num_props_(final_sts.size()),
       weight_(graph_.size()),
       eval_key_(std::move(eval_key)),
+      tlwel1_trlwel1_iks_key_(std::move(tlwel1_trlwel1_iks_key)),
       input_size_(std::move(input_size)),
+      num_phases_(num_phases),
+      states_at_phase_(),
       boot_interval_(boot_interval),
       num_processed_inputs_(0),
       trlwelvl1_trivial_0_(trivial_TRLWELvl1_zero()),
@@ -24,24 +44,126 @@ BackstreamDFARunner::BackstreamDFARunner(Graph graph, size_t boot_interval,
 
     if (sanitize_result_)
         error_die("Sanitization of results is not implemented");
+    if (num_props_ == 0 ||
+        (num_props_ > 1 && num_props_ > max_num_props(boot_interval_)))
+        error_die("The number of properties must be in [1, {}]",
+                  max_num_props(boot_interval_));
+    if (num_props_ > 1 && !tlwel1_trlwel1_iks_key_)
+        error_die("Packed weights need the key for TLWE-to-TRLWE IKS");
+
+    if (num_phases_ == 0 || (input_size_ && num_phases_ != 1))
+        error_die("Invalid number of phases: {}", num_phases_);
 
     if (input_size_)
         graph_.reserve_states_at_depth(*input_size_);
+    else
+        states_at_phase_ = graph_.states_at_phase(num_phases_);
+
+    if (num_props_ == 1) {
+        for (Graph::State st = 0; st < graph_.size(); st++)
+            weight_.at(st) = graph_.is_final_state(st) ? trlwelvl1_trivial_1_
+                                                       : trlwelvl1_trivial_0_;
+    }
+    else {
+        for (Graph::State st = 0; st < graph_.size(); st++)
+            weight_.at(st) = trlwelvl1_trivial_0_;
+        for (size_t i = 0; i < num_props_; i++)
+            for (Graph::State st : final_sts.at(i))
+                weight_.at(st)[1][i] = (1u << 31);  // 1/2
+        workspace_packed_.resize(num_props_);
+    }
+}
+
+namespace {
+// Variances of the errors on the torus, bounded as in the noise analysis of
+// TFHE by Chillotti et al. (J. Cryptology 33, 2020) for binary keys
+
+// External product with a TRGSW of lvl1param
+double var_external_product()
+{
+    const int precision = Lvl1::Bgbit * Lvl1::l;
+    const double n = Lvl1::n, half_bg = Lvl1::Bg / 2,
+                 eps = std::ldexp(1.0, -precision - 1);
+    return 2 * Lvl1::l * n * half_bg * half_bg * Lvl1::α * Lvl1::α +
+           (1 + n) * eps * eps;
+}
+
+// Key switching of P from TLWE of P::domainP, either to TLWE or to TRLWE
+template <class P>
+double var_key_switching()
+{
+    const int precision = P::basebit * P::t;
+    const double n = P::domainP::n, eps = std::ldexp(1.0, -precision - 1);
+    return n * P::t * P::α * P::α + n * eps * eps;
+}
+
+// Rounding of TLWELvl0 to the modulus 2N in blind rotation
+double var_modulus_switching()
+{
+    const double n2 = 2 * Lvl1::n;
+    return (Lvl0::n + 1) / (12 * n2 * n2);
+}
+}  // namespace
 
-    for (Graph::State st = 0; st < graph_.size(); st++)
-        weight_.at(st) = graph_.is_final_state(st) ? trlwelvl1_trivial_1_
-                                                   : trlwelvl1_trivial_0_;
+size_t BackstreamDFARunner::max_num_props(size_t boot_interval)
+{
+    // Each coefficient of a packed weight has the error of blind rotation
+    // and that of the key switching of every property. Before it is
+    // bootstrapped again, boot_interval CMUXes, the key switching to
+    // TLWELvl0 and the modulus switching add theirs. The message is 0 or
+    // 1/2, so the total must stay below 1/4 by 7.2 standard deviations,
+    // i.e., with a failure probability below 2^{-40} per coefficient.
+    const double bound = 0.25 / 7.2;
+    const double var_fixed =
+        Lvl0::n * var_external_product() +
+        boot_interval * var_external_product() +
+        var_key_switching<TFHEpp::lvl10param>() + var_modulus_switching();
+    const double var_per_prop = var_key_switching<TFHEpp::lvl11param>();
+    if (bound * bound <= var_fixed)
+        return 0;
+    return std::min<double>(
+        Lvl1::n, std::floor((bound * bound - var_fixed) / var_per_prop));
 }
 
 TLWELvl1 BackstreamDFARunner::result() const
 {
+    return result(0);
+}
+
+TLWELvl1 BackstreamDFARunner::result(size_t prop) const
+{
+    assert(prop < num_props_);
+    assert(num_processed_inputs_ % num_phases_ == 0);
     TLWELvl1 ret;
     TFHEpp::SampleExtractIndex<Lvl1>(ret, weight_.at(graph_.initial_state()),
-                                     0);
+                                     prop);
     return ret;
 }
 
+TRLWELvl1 BackstreamDFARunner::packed_result() const
+{
+    return weight_.at(graph_.initial_state());
+}
+
 void BackstreamDFARunner::eval(const TRGSWLvl1FFT& input)
+{
+    eval_impl(input);
+}
+
+void BackstreamDFARunner::eval(const TRGSWLvl1FFTFloat& input)
+{
+    eval_impl(input);
+}
+
+void BackstreamDFARunner::measure_noise(NoiseStat& stat,
+                                        const SecretKey& skey) const
+{
+    for (const TRLWELvl1& w : weight_)
+        stat.add(w, skey, num_props_);
+}
+
+template <class TRGSW>
+void BackstreamDFARunner::eval_impl(const TRGSW& input)
 {
     std::vector<TRLWELvl1>& out = workspace_;
     out.resize(graph_.size());
@@ -53,18 +175,20 @@ void BackstreamDFARunner::eval(const TRGSWLvl1FFT& input)
         states.emplace(graph_.states_at_depth(j - 1));
     }
     else {
-        states.emplace(graph_.all_states());
+        // Results are read only after every num_phases_ inputs, so the
+        // weights after the s-th input are needed only for the states at
+        // depth -s modulo num_phases_.
+        size_t s = (num_processed_inputs_ + 1) % num_phases_;
+        states.emplace(states_at_phase_.at((num_phases_ - s) % num_phases_));
     }
 
     timer_.timeit(TimeRecorder::TARGET::CMUX, states->size(), [&] {
-        std::for_each(std::execution::par, states->begin(), states->end(),
-                      [&](Graph::State q) {
-                          Graph::State q0 = graph_.next_state(q, false),
-                                       q1 = graph_.next_state(q, true);
-                          const TRLWELvl1 &w0 = weight_.at(q0),
-                                          &w1 = weight_.at(q1);
-                          TFHEpp::CMUXFFT<Lvl1>(out.at(q), input, w1, w0);
-                      });
+        CMUXFFTLvl1_batch(input, states->size(), [&](size_t i) {
+            Graph::State q = states->at(i), q0 = graph_.next_state(q, false),
+                         q1 = graph_.next_state(q, true);
+            return std::make_tuple(&out.at(q), &weight_.at(q1),
+                                   &weight_.at(q0));
+        });
     });
     {
         using std::swap;
@@ -82,11 +206,55 @@ void BackstreamDFARunner::bootstrap_weight(
     const std::vector<Graph::State>& targets)
 {
     assert(eval_key_);
-    timer_.timeit(TimeRecorder::TARGET::BOOTSTRAPPING, targets.size(), [&] {
-        std::for_each(std::execution::par, targets.begin(), targets.end(),
-                      [&](Graph::State q) {
-                          TRLWELvl1& w = weight_.at(q);
-                          do_SEI_IKS_GBTLWE2TRLWE_2(w, *eval_key_);
+
+    if (num_props_ > 1) {
+        timer_.timeit(TimeRecorder::TARGET::BOOTSTRAPPING,
+                      targets.size() * num_props_, [&] {
+                          for (Graph::State q : targets)
+                              bootstrap_packed_weight(weight_.at(q));
                       });
+        return;
+    }
+
+    timer_.timeit(TimeRecorder::TARGET::BOOTSTRAPPING, targets.size(), [&] {
+        do_SEI_IKS_GBTLWE2TRLWE_2_batch(
+            *eval_key_, targets.size(),
+            [&](size_t i) { return &weight_.at(targets.at(i)); });
     });
 }
+
+// Bootstrap each coefficient of w separately and pack them into w again
+void BackstreamDFARunner::bootstrap_packed_weight(TRLWELvl1& w)
+{
+    assert(eval_key_ && tlwel1_trlwel1_iks_key_);
+
+    std::vector<size_t> props(num_props_);
+    std::iota(props.begin(), props.end(), 0);
+    std::vector<TLWELvl0> tlwel0s(num_props_);
+    std::for_each(std::execution::par, props.begin(), props.end(),
+                  [&](size_t i) {
+                      TLWELvl1 tlwel1;
+                      TFHEpp::SampleExtractIndex<Lvl1>(tlwel1, w, i);
+                      TFHEpp::IdentityKeySwitch<TFHEpp::lvl10param>(
+                          tlwel0s.at(i), tlwel1,
+                          eval_key_->getiksk<TFHEpp::lvl10param>());
+                  });
+    std::vector<TRLWELvl1> trlwel1s(num_props_);
+    BS_TLWE_0_1o2_to_TRLWE_0_1o2_batch(*eval_key_, num_props_, [&](size_t i) {
+        return std::make_tuple(&trlwel1s.at(i), &tlwel0s.at(i));
+    });
+    std::for_each(std::execution::par, props.begin(), props.end(),
+                  [&](size_t i) {
+                      TLWELvl1 tlwel1;
+                      TRLWELvl1 trlwel1;
+                      TFHEpp::SampleExtractIndex<Lvl1>(tlwel1,
+                                                       trlwel1s.at(i), 0);
+                      TFHEpp::TLWE2TRLWEIKS<TFHEpp::lvl11param>(
+                          trlwel1, tlwel1, *tlwel1_trlwel1_iks_key_);
+                      TRLWELvl1_mult_X_k(workspace_packed_.at(i), trlwel1, i);
+                  });
+
+    w = trivial_TRLWELvl1_zero();
+    for (const TRLWELvl1& c : workspace_packed_)
+        TRLWELvl1_add(w, c);
+}
@@ -7,12 +7,20 @@
 
 #include <optional>
 
+// The i-th coefficient of each weight holds the verdict for the i-th set of
+// final states, so that up to max_num_props() properties sharing the same
+// transitions are evaluated by one CMUX per state.
 class BackstreamDFARunner {
 private:
     Graph graph_;
+    size_t num_props_;
     std::vector<TRLWELvl1> weight_;
     std::shared_ptr<EvalKey> eval_key_;
+    std::shared_ptr<TFHEpp::TLWE2TRLWEIKSKey<TFHEpp::lvl11param>>
+        tlwel1_trlwel1_iks_key_;
     std::optional<size_t> input_size_;
+    size_t num_phases_;
+    std::vector<std::vector<Graph::State>> states_at_phase_;
     const size_t boot_interval_;
     size_t num_processed_inputs_;
     const TRLWELvl1 trlwelvl1_trivial_0_, trlwelvl1_trivial_1_;
@@ -20,14 +28,37 @@ private:
 
     // Workspace for eval
     std::vector<TRLWELvl1> workspace_;
+    // Workspace for bootstrap_weight
+    std::vector<TRLWELvl1> workspace_packed_;
 
     TimeRecorder timer_;
 
 public:
+    // If input_size is not given, only the layer of graph for the current
+    // phase is evaluated, and results are valid after every num_phases
+    // inputs (see Graph::states_at_phase).
     BackstreamDFARunner(Graph graph, size_t boot_interval,
-                        std::optional<size_t> input_size,
+                        std::optional<size_t> input_size, size_t num_phases,
                         std::shared_ptr<EvalKey> eval_key,
                         bool sanitize_result);
+    // Bootstrapping packed weights needs tlwel1_trlwel1_iks_key unless
+    // final_sts has only one element, which must have at most
+    // max_num_props(boot_interval) elements.
+    BackstreamDFARunner(
+        Graph graph, const Graph::ComponentFinalStates& final_sts,
+        size_t boot_interval, std::optional<size_t> input_size,
+        size_t num_phases, std::shared_ptr<EvalKey> eval_key,
+        std::shared_ptr<TFHEpp::TLWE2TRLWEIKSKey<TFHEpp::lvl11param>>
+            tlwel1_trlwel1_iks_key,
+        bool sanitize_result);
+
+    // Largest number of properties whose packed weights are decrypted and
+    // bootstrapped correctly when bootstrapped every boot_interval inputs.
+    // Packing adds the noise of a TLWE-to-TRLWE key switching to every
+    // coefficient once per property, so this is the largest count whose
+    // total noise stays below the decryption bound of 1/4 (see the
+    // definition for the analysis). It is at most Lvl1::n.
+    static size_t max_num_props(size_t boot_interval);
 
     const Graph& graph() const
     {
@@ -39,11 +70,32 @@ public:
         return timer_;
     }
 
+    size_t num_props() const
+    {
+        return num_props_;
+    }
+
+    size_t num_phases() const
+    {
+        return num_phases_;
+    }
+
     TLWELvl1 result() const;
+    TLWELvl1 result(size_t prop) const;
+    TRLWELvl1 packed_result() const;
     void eval(const TRGSWLvl1FFT& input);
+    void eval(const TRGSWLvl1FFTFloat& input);
+
+    // Add the noise of the weights to stat. Only the first num_props()
+    // coefficients, which hold the verdicts, are measured; the others carry
+    // no message.
+    void measure_noise(NoiseStat& stat, const SecretKey& skey) const;
 
 private:
+    template <class TRGSW>
+    void eval_impl(const TRGSW& input);
     void bootstrap_weight(const std::vector<Graph::State>& targets);
+    void bootstrap_packed_weight(TRLWELvl1& w);
 };
 
 #endif
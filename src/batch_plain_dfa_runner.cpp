@@ -0,0 +1,149 @@
+#include "batch_plain_dfa_runner.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <numeric>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace {
+constexpr size_t LANES = 16;
+
+// Advance the states of all the lanes by one input bit with the widest
+// gather of the target ISA. Portable builds compile homfa once per ISA, so
+// the kernel is chosen at compile time and the baseline binary has no
+// instruction above its ISA.
+void step(int32_t* states, const uint8_t* bits, const int32_t* delta)
+{
+#if defined(__AVX512F__)
+    __m512i st = _mm512_load_si512(states);
+    __m512i in = _mm512_cvtepu8_epi32(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(bits)));
+    __m512i idx = _mm512_add_epi32(_mm512_slli_epi32(st, 1), in);
+    st = _mm512_i32gather_epi32(idx, delta, 4);
+    _mm512_store_si512(states, st);
+#elif defined(__AVX2__)
+    for (size_t h = 0; h < LANES; h += 8) {
+        __m256i st =
+            _mm256_load_si256(reinterpret_cast<__m256i*>(states + h));
+        __m256i in = _mm256_cvtepu8_epi32(
+            _mm_loadl_epi64(reinterpret_cast<const __m128i*>(bits + h)));
+        __m256i idx = _mm256_add_epi32(_mm256_slli_epi32(st, 1), in);
+        st = _mm256_i32gather_epi32(delta, idx, 4);
+        _mm256_store_si256(reinterpret_cast<__m256i*>(states + h), st);
+    }
+#else
+    for (size_t l = 0; l < LANES; l++)
+        states[l] = delta[2 * states[l] + bits[l]];
+#endif
+}
+}  // namespace
+
+BatchPlainDFARunner::BatchPlainDFARunner(const Graph& graph)
+    : delta_(2 * graph.size()),
+      final_(graph.size()),
+      init_state_(graph.initial_state())
+{
+    for (Graph::State q : graph.all_states()) {
+        delta_.at(2 * q) = graph.next_state(q, false);
+        delta_.at(2 * q + 1) = graph.next_state(q, true);
+        final_.at(q) = graph.is_final_state(q);
+    }
+}
+
+size_t BatchPlainDFARunner::num_lanes()
+{
+    return LANES;
+}
+
+std::vector<std::vector<bool>> BatchPlainDFARunner::run(
+    const std::vector<Trace>& traces, size_t output_freq) const
+{
+    assert(output_freq > 0);
+
+    std::vector<std::vector<bool>> ret(traces.size());
+
+    // Put traces of similar length into the same group so that few lanes
+    // idle at the tail of the group.
+    std::vector<size_t> order(traces.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t lhs, size_t rhs) {
+        return traces.at(lhs).size() > traces.at(rhs).size();
+    });
+
+    std::vector<const Trace*> group;
+    std::vector<std::vector<bool>*> out;
+    for (size_t i = 0; i < order.size(); i += LANES) {
+        group.clear();
+        out.clear();
+        for (size_t j = i; j < std::min(i + LANES, order.size()); j++) {
+            group.push_back(&traces.at(order.at(j)));
+            out.push_back(&ret.at(order.at(j)));
+        }
+        run_group(group, output_freq, out);
+    }
+
+    return ret;
+}
+
+std::vector<bool> BatchPlainDFARunner::run(
+    const std::vector<Trace>& traces) const
+{
+    size_t max_len = 1;
+    for (auto&& trace : traces)
+        max_len = std::max(max_len, trace.size());
+
+    std::vector<bool> ret;
+    for (auto&& verdicts : run(traces, max_len))
+        ret.push_back(verdicts.back());
+    return ret;
+}
+
+void BatchPlainDFARunner::run_group(const std::vector<const Trace*>& group,
+                                    size_t output_freq,
+                                    std::vector<std::vector<bool>*>& out) const
+{
+    assert(group.size() <= LANES && group.size() == out.size());
+
+    size_t max_len = 0;
+    for (const Trace* trace : group)
+        max_len = std::max(max_len, trace->size());
+
+    // Transpose input bits so that the bits of all lanes at the same position
+    // can be loaded at once. Lanes that have already reached their end keep
+    // reading 0, which is harmless since their verdicts are already recorded.
+    std::vector<uint8_t> bits(max_len * LANES, 0);
+    std::vector<bool> is_end(max_len + 1, false);
+    for (size_t l = 0; l < group.size(); l++) {
+        const Trace& trace = *group.at(l);
+        for (size_t t = 0; t < trace.size(); t++)
+            bits.at(t * LANES + l) = trace.at(t);
+        is_end.at(trace.size()) = true;
+        out.at(l)->clear();
+    }
+
+    alignas(64) int32_t states[LANES];
+    std::fill(std::begin(states), std::end(states), init_state_);
+
+    auto record = [&](size_t pos) {
+        for (size_t l = 0; l < group.size(); l++) {
+            size_t len = group.at(l)->size();
+            if (pos == len || (0 < pos && pos < len && pos % output_freq == 0))
+                out.at(l)->push_back(final_.at(states[l]) != 0);
+        }
+    };
+
+    if (is_end.at(0))
+        record(0);
+
+    const int32_t* delta = delta_.data();
+    for (size_t t = 0; t < max_len; t++) {
+        step(states, bits.data() + t * LANES, delta);
+
+        size_t pos = t + 1;
+        if (pos % output_freq == 0 || is_end.at(pos))
+            record(pos);
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef HOMFA_BATCH_PLAIN_DFA_RUNNER_HPP
+#define HOMFA_BATCH_PLAIN_DFA_RUNNER_HPP
+
+#include "graph.hpp"
+
+#include <cstdint>
+#include <vector>
+
+// Run a DFA over many plaintext traces at once. Traces are packed into 16
+// SIMD lanes and advanced together by gathering from a flat transition table
+// with AVX-512 or AVX2, whichever the build targets, so that large corpora of
+// short traces can be checked quickly as an oracle for the encrypted runners.
+class BatchPlainDFARunner {
+public:
+    using Trace = std::vector<bool>;
+
+private:
+    // delta_[2 * q + b] is the next state of q when input is b
+    std::vector<int32_t> delta_;
+    std::vector<uint8_t> final_;
+    Graph::State init_state_;
+
+public:
+    BatchPlainDFARunner(const Graph& graph);
+
+    static size_t num_lanes();
+
+    // Returns the verdicts of each trace. The j-th verdict of a trace is
+    // whether the DFA accepts its prefix of length (j + 1) * output_freq; the
+    // last verdict is always for the whole trace.
+    std::vector<std::vector<bool>> run(const std::vector<Trace>& traces,
+                                       size_t output_freq) const;
+    // Returns whether the DFA accepts each trace.
+    std::vector<bool> run(const std::vector<Trace>& traces) const;
+
+private:
+    void run_group(const std::vector<const Trace*>& group, size_t output_freq,
+                   std::vector<std::vector<bool>*>& out) const;
+};
+
+#endif
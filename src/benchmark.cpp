@@ -1,5 +1,6 @@
 #include "archive.hpp"
 #include "error.hpp"
+#include "ntt.hpp"
 #include "offline_dfa.hpp"
 #include "online_dfa.hpp"
 #include "timeit.hpp"
@@ -109,7 +110,7 @@ public:
                           size_t bootstrapping_freq, bool spec_reversed,
                           const BKey& bkey, bool sanitize_result)
         : runner_(Graph::from_file(spec_filename), bootstrapping_freq,
-                  spec_reversed, bkey.ekey, sanitize_result),
+                  output_freq, spec_reversed, bkey.ekey, sanitize_result),
           output_freq_(output_freq),
           num_processed_(0)
     {
@@ -442,6 +443,73 @@ void do_bbs(const std::string& spec_filename, const std::string& input_filename,
     runner.runner().timer().dumpCSV(std::cout);
 }
 
+// Time the external products of CMUX in the FFT and NTT domains, for a single
+// CMUX and for a full tile. The selector is converted into the NTT domain
+// once beforehand, as a runner would do when it reads the input.
+void do_kernels(size_t num_iters)
+{
+    print("config-method", "kernels");
+    print("config-num_iters", num_iters);
+
+    SecretKey skey;
+    const auto sel =
+        std::make_unique<TRGSWLvl1FFT>(encrypt_bit_to_TRGSWLvl1FFT(1, skey));
+    const auto selntt =
+        std::make_unique<TRGSWLvl1NTT>(TRGSWLvl1FFT_to_NTT(*sel));
+
+    std::vector<TRLWELvl1> in0(CMUX_MAX_TILE_SIZE), in1(CMUX_MAX_TILE_SIZE),
+        out(CMUX_MAX_TILE_SIZE);
+    TRLWELvl1* outs[CMUX_MAX_TILE_SIZE];
+    const TRLWELvl1 *in0s[CMUX_MAX_TILE_SIZE], *in1s[CMUX_MAX_TILE_SIZE];
+    for (size_t t = 0; t < CMUX_MAX_TILE_SIZE; t++) {
+        in0.at(t) = trivial_TRLWELvl1_zero();
+        in1.at(t) = trivial_TRLWELvl1_1over8();
+        outs[t] = &out.at(t);
+        in0s[t] = &in0.at(t);
+        in1s[t] = &in1.at(t);
+    }
+
+    // Print the time per CMUX in microseconds
+    auto print_per_cmux = [&](const std::string& key, size_t size,
+                              auto&& cmux) {
+        auto elapsed = timeit([&] {
+            for (size_t i = 0; i < num_iters; i++)
+                cmux(size, outs, in1s, in0s);
+        });
+        print(key + "-" + std::to_string(size),
+              static_cast<double>(elapsed.count()) / num_iters / size);
+    };
+    for (size_t size : {size_t{1}, CMUX_MAX_TILE_SIZE}) {
+        print_per_cmux("cmux-fft", size, [&](auto... args) {
+            CMUXFFTLvl1_tile(*sel, args...);
+        });
+        print_per_cmux("cmux-ntt", size, [&](auto... args) {
+            CMUXNTTLvl1_tile(*selntt, args...);
+        });
+    }
+
+    // A blind rotation costs about Lvl0::n CMUXes, so run fewer of them
+    EvalKey ekey{skey};
+    ekey.emplacebkfft<TFHEpp::lvl01param>(skey);
+    const PolyLvl1 testvector = TFHEpp::μpolygen<Lvl1, Lvl1::μ>();
+    const size_t num_iters_br = std::max<size_t>(1, num_iters / Lvl0::n);
+    std::vector<TLWELvl0> srcs(CMUX_MAX_TILE_SIZE,
+                               TFHEpp::tlweSymEncrypt<Lvl0>(
+                                   0, Lvl0::α, skey.key.lvl0));
+    const TLWELvl0* srcps[CMUX_MAX_TILE_SIZE];
+    for (size_t t = 0; t < CMUX_MAX_TILE_SIZE; t++)
+        srcps[t] = &srcs.at(t);
+    // Print the time per blind rotation in microseconds
+    for (size_t size : {size_t{1}, CMUX_MAX_TILE_SIZE}) {
+        auto elapsed = timeit([&] {
+            for (size_t i = 0; i < num_iters_br; i++)
+                BlindRotateLvl01_tile(ekey, testvector, size, outs, srcps);
+        });
+        print("blind-rotate-" + std::to_string(size),
+              static_cast<double>(elapsed.count()) / num_iters_br / size);
+    }
+}
+
 int main(int argc, char** argv)
 {
     CLI::App app{"Benchmark runner"};
@@ -453,10 +521,11 @@ int main(int argc, char** argv)
         REVERSED,
         QTRLWE2,
         BBS,
+        KERNELS,
     } type;
     std::string spec_filename, input_filename;
     size_t output_freq, num_ap, max_second_lut_depth, queue_size,
-        bootstrapping_freq;
+        bootstrapping_freq, num_iters = 1000;
     bool verbose = false, spec_reversed = false, sanitize_result = false;
 
     app.add_flag("--verbose", verbose, "");
@@ -557,6 +626,13 @@ int main(int argc, char** argv)
             ->check(CLI::ExistingFile);
         bbs->add_flag("--sanitize-result", sanitize_result);
     }
+    {
+        CLI::App* kernels = app.add_subcommand(
+            "kernels", "Run CMUXes and blind rotations repeatedly");
+        kernels->parse_complete_callback([&] { type = TYPE::KERNELS; });
+        kernels->add_option("--iters", num_iters)
+            ->check(CLI::PositiveNumber);
+    }
 
     CLI11_PARSE(app, argc, argv);
 
@@ -590,6 +666,10 @@ int main(int argc, char** argv)
         do_bbs(spec_filename, input_filename, output_freq, queue_size, num_ap,
                sanitize_result);
         break;
+
+    case TYPE::KERNELS:
+        do_kernels(num_iters);
+        break;
     }
 
     return 0;
@@ -1,6 +1,7 @@
 #include "graph.hpp"
 #include "error.hpp"
 
+#include <algorithm>
 #include <cassert>
 #include <fstream>
 #include <map>
@@ -15,6 +16,7 @@
 #include <spot/misc/bddlt.hh>
 #include <spot/misc/minato.hh>
 #include <spot/tl/parse.hh>
+#include <spot/tl/print.hh>
 #include <spot/twaalgos/hoa.hh>
 #include <spot/twaalgos/translate.hh>
 
@@ -327,17 +329,152 @@ Graph Graph::from_nfa(const std::set<State>& q0n, const std::set<State>& Fn,
 Graph Graph::from_ltl_formula(const std::string& formula, size_t var_size,
                               bool make_all_live_states_final)
 {
-    auto [init_sts, final_sts, delta] =
-        ltl_to_nfa_tuple(formula, var_size, make_all_live_states_final);
+    return from_ltl_formula(formula, var_size, make_all_live_states_final,
+                            LTLTranslation{});
+}
+
+Graph Graph::from_ltl_formula(const std::string& formula, size_t var_size,
+                              bool make_all_live_states_final,
+                              const LTLTranslation& translation)
+{
+    if (translation.path == LTLTranslation::PATH::DIRECT)
+        return binarize_monitor_direct(
+            ltl_to_monitor(formula, var_size, translation), var_size,
+            make_all_live_states_final);
+
+    auto [init_sts, final_sts, delta] = ltl_to_nfa_tuple(
+        formula, var_size, make_all_live_states_final, translation);
     return Graph::from_nfa(init_sts, final_sts, delta);
 }
 
+Graph Graph::from_ltl_formula_direct(const std::string& formula,
+                                     size_t var_size,
+                                     bool make_all_live_states_final)
+{
+    LTLTranslation translation;
+    translation.path = LTLTranslation::PATH::DIRECT;
+    return from_ltl_formula(formula, var_size, make_all_live_states_final,
+                            translation);
+}
+
+Graph Graph::binarize_monitor_direct(spot::twa_graph_ptr aut, size_t var_size,
+                                     bool make_all_live_states_final)
+{
+    std::vector<std::optional<int>> ap2var(var_size);
+    {
+        spot::bdd_dict_ptr dict = aut->get_dict();
+        for (size_t i = 0; i < var_size; i++) {
+            auto it =
+                dict->var_map.find(spot::formula::ap(fmt::format("p{}", i)));
+            if (it != dict->var_map.end())
+                ap2var.at(i) = it->second;
+        }
+    }
+
+    // Conditions yet to be read and the destination of each outgoing edge,
+    // sorted by destination. Edges whose condition is false are removed.
+    using Residual = std::vector<std::pair<State, bdd>>;
+    struct ResidualLess {
+        bool operator()(const Residual& lhs, const Residual& rhs) const
+        {
+            spot::bdd_less_than lt;
+            return std::lexicographical_compare(
+                lhs.begin(), lhs.end(), rhs.begin(), rhs.end(),
+                [&](const std::pair<State, bdd>& l,
+                    const std::pair<State, bdd>& r) {
+                    if (l.first != r.first)
+                        return l.first < r.first;
+                    return lt(l.second, r.second);
+                });
+        }
+    };
+    auto make_residual = [](const std::map<State, bdd>& dst2cond) {
+        Residual ret;
+        for (auto&& [dst, cond] : dst2cond)
+            if (cond != bddfalse)
+                ret.emplace_back(dst, cond);
+        return ret;
+    };
+
+    if (var_size == 0)
+        error_die("No AP is given");
+
+    const State ns = aut->num_states();
+    DFADelta delta;
+    std::set<State> final_sts;
+    for (State q = 0; q < ns; q++) {
+        delta.emplace_back(q, -1, -1);
+        final_sts.insert(q);
+    }
+
+    std::optional<State> sink;
+    std::vector<std::map<Residual, State, ResidualLess>> memo(var_size);
+    std::vector<std::tuple<State, size_t, Residual>> stack;
+    auto get_or_create_state = [&](size_t depth, Residual res) {
+        if (res.empty()) {  // No edge is available
+            if (!sink) {
+                sink = delta.size();
+                delta.emplace_back(*sink, *sink, *sink);
+            }
+            return *sink;
+        }
+        if (depth == var_size) {  // All the bits of a letter have been read
+            if (res.size() != 1)
+                error_die("The monitor is not deterministic");
+            assert(res.at(0).second == bddtrue);
+            return res.at(0).first;
+        }
+
+        auto [it, inserted] = memo.at(depth).emplace(res, delta.size());
+        if (inserted) {
+            delta.emplace_back(it->second, -1, -1);
+            if (make_all_live_states_final)
+                final_sts.insert(it->second);
+            stack.emplace_back(it->second, depth, std::move(res));
+        }
+        return it->second;
+    };
+
+    for (State q = 0; q < ns; q++) {
+        std::map<State, bdd> dst2cond;
+        for (auto& t : aut->out(q)) {
+            auto [it, inserted] = dst2cond.emplace(t.dst, t.cond);
+            if (!inserted)
+                it->second = it->second | t.cond;
+        }
+        stack.emplace_back(q, 0, make_residual(dst2cond));
+    }
+    while (!stack.empty()) {
+        auto [q, depth, res] = std::move(stack.back());
+        stack.pop_back();
+
+        std::map<State, bdd> dst2cond0, dst2cond1;
+        for (auto&& [dst, cond] : res) {
+            if (!ap2var.at(depth)) {
+                dst2cond0.emplace(dst, cond);
+                dst2cond1.emplace(dst, cond);
+                continue;
+            }
+            int var = *ap2var.at(depth);
+            dst2cond0.emplace(dst, bdd_restrict(cond, bdd_nithvar(var)));
+            dst2cond1.emplace(dst, bdd_restrict(cond, bdd_ithvar(var)));
+        }
+        State q0 = get_or_create_state(depth + 1, make_residual(dst2cond0)),
+              q1 = get_or_create_state(depth + 1, make_residual(dst2cond1));
+        std::get<1>(delta.at(q)) = q0;
+        std::get<2>(delta.at(q)) = q1;
+    }
+
+    return Graph{static_cast<State>(aut->get_init_state_number()), final_sts,
+                 delta};
+}
+
 Graph Graph::from_ltl_formula_reversed(const std::string& formula,
                                        size_t var_size,
                                        bool make_all_live_states_final)
 {
-    auto [init_sts, final_sts, delta] =
-        ltl_to_nfa_tuple(formula, var_size, make_all_live_states_final);
+    auto [init_sts, final_sts, delta] = ltl_to_nfa_tuple(
+        formula, var_size, make_all_live_states_final, LTLTranslation{});
     NFADelta delta_rev = reversed_nfa_delta(delta);
     return Graph::from_nfa(final_sts, init_sts, delta_rev);
 }
@@ -353,6 +490,11 @@ bool Graph::is_final_state(State state) const
     return final_state_vec_.at(state);
 }
 
+const std::set<Graph::State>& Graph::final_states() const
+{
+    return final_state_;
+}
+
 Graph::State Graph::next_state(State state, bool input) const
 {
     auto& t = delta_.at(state);
@@ -420,6 +562,59 @@ std::vector<Graph::State> Graph::all_states() const
     return ret;
 }
 
+std::vector<std::vector<Graph::State>> Graph::states_at_phase(
+    size_t num_phases) const
+{
+    assert(num_phases > 0);
+
+    // Traverse the pairs of a state and a phase
+    std::vector<std::vector<bool>> visited(num_phases,
+                                           std::vector<bool>(size(), false));
+    std::queue<std::pair<State, size_t>> que;
+    visited.at(0).at(initial_state()) = true;
+    que.emplace(initial_state(), 0);
+    while (!que.empty()) {
+        auto [q, phase] = que.front();
+        que.pop();
+        size_t next_phase = (phase + 1) % num_phases;
+        for (bool input : {false, true}) {
+            State dst = next_state(q, input);
+            if (visited.at(next_phase).at(dst))
+                continue;
+            visited.at(next_phase).at(dst) = true;
+            que.emplace(dst, next_phase);
+        }
+    }
+
+    std::vector<std::vector<State>> ret(num_phases);
+    for (size_t phase = 0; phase < num_phases; phase++)
+        for (State q : all_states())
+            if (visited.at(phase).at(q))
+                ret.at(phase).push_back(q);
+    return ret;
+}
+
+size_t Graph::detect_num_phases(size_t unit) const
+{
+    // More phases than this hardly occur in binarized specs
+    const size_t max_num_phases = 64;
+
+    size_t best = 1, best_total = size();
+    for (size_t p = 2; p <= std::min(unit, max_num_phases); p++) {
+        if (unit % p != 0)
+            continue;
+        size_t total = 0;
+        for (auto&& layer : states_at_phase(p))
+            total += layer.size();
+        // Compare total / p with best_total / best
+        if (total * best < best_total * p) {
+            best = p;
+            best_total = total;
+        }
+    }
+    return best;
+}
+
 std::vector<std::vector<Graph::State>> Graph::track_live_states(
     const std::vector<Graph::State>& init_live_states, size_t max_depth)
 {
@@ -455,6 +650,19 @@ Graph Graph::reversed() const
     return Graph::from_nfa(final_state_, {initial_state()}, delta);
 }
 
+Graph Graph::reversed_minimized() const
+{
+    // By Brzozowski's theorem, the subset construction of the reverse of a
+    // DFA whose states are all reachable yields the minimal DFA of the
+    // reversed language. Pruning subsets by simulation would not help here
+    // since distinct reachable states of a DFA are reached by disjoint sets of
+    // words, i.e., none of them simulates another in the reverse. What
+    // matters is to drop unreachable states, which otherwise inflate the
+    // subsets and make the result non-minimal, and to skip the quadratic
+    // table-filling on the reversed graph.
+    return removed_unreachable().reversed();
+}
+
 Graph Graph::minimized() const
 {
     return removed_unreachable().grouped_nondistinguishable();
@@ -475,7 +683,7 @@ Graph Graph::removed_unreachable() const
         que.push(next_state(q, true));
     }
 
-    std::unordered_map<State, State> old2new;
+    boost::unordered_map<State, State> old2new;
     for (State old : reachable)
         old2new.emplace(old, old2new.size());
 
@@ -498,14 +706,25 @@ Graph Graph::removed_unreachable() const
 
 Graph Graph::grouped_nondistinguishable() const
 {
-    // Table-filling algorithm
+    std::vector<int> classes(size());
+    for (State q : all_states())
+        classes.at(q) = is_final_state(q) ? 1 : 0;
+    return std::get<0>(grouped_nondistinguishable(classes));
+}
+
+std::tuple<Graph, std::vector<Graph::State>> Graph::grouped_nondistinguishable(
+    const std::vector<int>& classes) const
+{
+    assert(classes.size() == size());
+
+    // Table-filling algorithm. States in different classes are
+    // distinguishable from the beginning.
     size_t siz = size();
     std::vector<bool> table(siz * siz, false);  // FIXME: use only half
     std::queue<std::pair<State, State>> que;
     for (State qa = 0; qa < siz; qa++) {
         for (State qb = qa + 1; qb < siz; qb++) {
-            bool qa_final = is_final_state(qa), qb_final = is_final_state(qb);
-            if ((qa_final && !qb_final) || (!qa_final && qb_final)) {
+            if (classes.at(qa) != classes.at(qb)) {
                 que.emplace(qa, qb);
                 table.at(qa + qb * siz) = true;
             }
@@ -576,7 +795,11 @@ Graph Graph::grouped_nondistinguishable() const
         delta.emplace_back(q, q0, q1);
     }
 
-    return Graph{init_st.value(), final_sts, delta};
+    std::vector<State> old2new(siz);
+    for (State q : all_states())
+        old2new.at(q) = uf2st.at(uf.find(q));
+
+    return {Graph{init_st.value(), final_sts, delta}, old2new};
 }
 
 Graph Graph::negated() const
@@ -588,6 +811,112 @@ Graph Graph::negated() const
     return Graph{init_state_, new_final, delta_};
 }
 
+Graph Graph::with_final_states(const std::set<State>& final_sts) const
+{
+    return Graph{init_state_, final_sts, delta_};
+}
+
+std::tuple<Graph, Graph::ComponentFinalStates> Graph::product(
+    const std::vector<Graph>& components, bool minimized)
+{
+    assert(!components.empty());
+
+    // Construct only the states reachable from the initial state. A state of
+    // the product is identified by the tuple of the states of the components.
+    using Tuple = std::vector<State>;
+    boost::unordered_map<Tuple, State> tuple2st;
+    std::vector<Tuple> st2tuple;
+    auto get_or_create_state = [&](const Tuple& t) -> State {
+        auto [it, inserted] = tuple2st.emplace(t, st2tuple.size());
+        if (inserted)
+            st2tuple.push_back(t);
+        return it->second;
+    };
+
+    Tuple init_tuple;
+    for (auto&& graph : components)
+        init_tuple.push_back(graph.initial_state());
+    State init_st = get_or_create_state(init_tuple);
+
+    DFADelta delta;
+    for (State q = 0; q < st2tuple.size(); q++) {
+        Tuple t0, t1;
+        for (size_t i = 0; i < components.size(); i++) {
+            State qi = st2tuple.at(q).at(i);
+            t0.push_back(components.at(i).next_state(qi, false));
+            t1.push_back(components.at(i).next_state(qi, true));
+        }
+        State q0 = get_or_create_state(t0), q1 = get_or_create_state(t1);
+        delta.emplace_back(q, q0, q1);
+    }
+
+    std::set<State> final_sts;
+    ComponentFinalStates comp_final_sts(components.size());
+    for (State q = 0; q < st2tuple.size(); q++) {
+        bool all_final = true;
+        for (size_t i = 0; i < components.size(); i++) {
+            if (components.at(i).is_final_state(st2tuple.at(q).at(i)))
+                comp_final_sts.at(i).insert(q);
+            else
+                all_final = false;
+        }
+        if (all_final)
+            final_sts.insert(q);
+    }
+
+    Graph prod{init_st, final_sts, delta};
+    if (!minimized)
+        return {prod, comp_final_sts};
+
+    // Minimize the product with keeping every component's final states; two
+    // states can be merged only if they are final in the same components.
+    std::map<std::vector<bool>, int> mask2class;
+    std::vector<int> classes(prod.size());
+    for (State q : prod.all_states()) {
+        std::vector<bool> mask;
+        for (auto&& sts : comp_final_sts)
+            mask.push_back(sts.contains(q));
+        auto [it, inserted] = mask2class.emplace(mask, mask2class.size());
+        classes.at(q) = it->second;
+    }
+    auto [min_prod, old2new] = prod.grouped_nondistinguishable(classes);
+    ComponentFinalStates min_comp_final_sts(components.size());
+    for (size_t i = 0; i < components.size(); i++)
+        for (State q : comp_final_sts.at(i))
+            min_comp_final_sts.at(i).insert(old2new.at(q));
+
+    return {min_prod, min_comp_final_sts};
+}
+
+size_t Graph::count_reachable_product_states(
+    const std::vector<Graph>& components, size_t limit)
+{
+    // Same traversal as product() but without building the transitions.
+    // Stop as soon as the number of states exceeds limit.
+    using Tuple = std::vector<State>;
+    boost::unordered_set<Tuple> visited;
+    std::queue<Tuple> que;
+
+    Tuple init_tuple;
+    for (auto&& graph : components)
+        init_tuple.push_back(graph.initial_state());
+    visited.insert(init_tuple);
+    que.push(init_tuple);
+    while (!que.empty() && visited.size() <= limit) {
+        Tuple t = que.front();
+        que.pop();
+        for (bool in : {false, true}) {
+            Tuple next;
+            for (size_t i = 0; i < components.size(); i++)
+                next.push_back(components.at(i).next_state(t.at(i), in));
+            if (visited.insert(next).second)
+                que.push(next);
+        }
+    }
+
+    return visited.size();
+}
+
 void Graph::dump(std::ostream& os) const
 {
     for (Graph::State q : all_states()) {
@@ -636,7 +965,295 @@ void Graph::dump_att(std::ostream& os) const
     }
 }
 
-spot::twa_graph_ptr ltl_to_monitor(const std::string& formula, size_t var_size)
+LetterGraph::LetterGraph(size_t num_ap, State init_st,
+                         const std::vector<bool>& final_state_vec,
+                         const std::vector<State>& delta)
+    : num_ap_(num_ap),
+      delta_(delta),
+      final_state_vec_(final_state_vec),
+      init_state_(init_st)
+{
+    assert(num_ap_ > 0 && num_ap_ < 32);
+    assert(delta_.size() == final_state_vec_.size() * num_letters());
+}
+
+LetterGraph LetterGraph::from_graph(const Graph& graph, size_t num_ap,
+                                    bool reversed_bit_order)
+{
+    const size_t num_letters = 1u << num_ap;
+
+    boost::unordered_map<State, State> old2new;
+    std::vector<State> new2old;
+    auto get_or_create_state = [&](State old) {
+        auto [it, inserted] = old2new.emplace(old, new2old.size());
+        if (inserted)
+            new2old.push_back(old);
+        return it->second;
+    };
+
+    State init_st = get_or_create_state(graph.initial_state());
+    std::vector<State> delta;
+    for (State q = 0; q < new2old.size(); q++) {
+        for (size_t c = 0; c < num_letters; c++) {
+            State dst = new2old.at(q);
+            for (size_t i = 0; i < num_ap; i++) {
+                size_t bit = reversed_bit_order ? num_ap - i - 1 : i;
+                dst = graph.next_state(dst, ((c >> bit) & 1u) != 0);
+            }
+            delta.push_back(get_or_create_state(dst));
+        }
+    }
+
+    std::vector<bool> final_state_vec;
+    for (State old : new2old)
+        final_state_vec.push_back(graph.is_final_state(old));
+
+    return LetterGraph{num_ap, init_st, final_state_vec, delta};
+}
+
+size_t LetterGraph::size() const
+{
+    return final_state_vec_.size();
+}
+
+size_t LetterGraph::num_ap() const
+{
+    return num_ap_;
+}
+
+size_t LetterGraph::num_letters() const
+{
+    return 1u << num_ap_;
+}
+
+bool LetterGraph::is_final_state(State state) const
+{
+    return final_state_vec_.at(state);
+}
+
+LetterGraph::State LetterGraph::next_state(State state, size_t letter) const
+{
+    assert(letter < num_letters());
+    return delta_.at(state * num_letters() + letter);
+}
+
+LetterGraph::State LetterGraph::initial_state() const
+{
+    return init_state_;
+}
+
+std::vector<LetterGraph::State> LetterGraph::all_states() const
+{
+    std::vector<State> ret(size());
+    std::iota(ret.begin(), ret.end(), 0);
+    return ret;
+}
+
+LetterGraph LetterGraph::minimized() const
+{
+    // Moore's algorithm. Refine the partition until it does not change.
+    std::vector<State> cls(size());
+    for (State q : all_states())
+        cls.at(q) = is_final_state(q) ? 1 : 0;
+    size_t num_classes = 0;
+    while (true) {
+        std::map<std::vector<State>, State> sig2cls;
+        std::vector<State> next_cls(size());
+        for (State q : all_states()) {
+            std::vector<State> sig{cls.at(q)};
+            for (size_t c = 0; c < num_letters(); c++)
+                sig.push_back(cls.at(next_state(q, c)));
+            auto [it, inserted] = sig2cls.emplace(sig, sig2cls.size());
+            next_cls.at(q) = it->second;
+        }
+        cls = std::move(next_cls);
+        if (sig2cls.size() == num_classes)
+            break;
+        num_classes = sig2cls.size();
+    }
+
+    std::vector<bool> final_state_vec(num_classes);
+    std::vector<State> delta(num_classes * num_letters());
+    for (State q : all_states()) {
+        final_state_vec.at(cls.at(q)) = is_final_state(q);
+        for (size_t c = 0; c < num_letters(); c++)
+            delta.at(cls.at(q) * num_letters() + c) =
+                cls.at(next_state(q, c));
+    }
+
+    return LetterGraph{num_ap_, cls.at(initial_state()), final_state_vec,
+                       delta};
+}
+
+Graph LetterGraph::binarized(const std::vector<size_t>& ap_order) const
+{
+    assert(ap_order.size() == num_ap_);
+
+    // A node at level j (0 < j < num_ap) is identified by the destinations
+    // for all the values of the remaining bits. The index of the table has
+    // the bit to be read next at its LSB.
+    boost::unordered_map<std::vector<State>, State> table2node;
+    Graph::DFADelta delta;
+    for (State q : all_states())
+        delta.emplace_back(q, -1, -1);
+    auto get_or_create_node = [&](std::vector<State> table) {
+        if (table.size() == 1)
+            return table.at(0);
+        auto [it, inserted] = table2node.emplace(table, delta.size());
+        if (inserted)
+            delta.emplace_back(it->second, -1, -1);
+        return it->second;
+    };
+
+    std::vector<std::pair<State, std::vector<State>>> que;
+    for (State q : all_states()) {
+        std::vector<State> table(num_letters());
+        for (size_t r = 0; r < num_letters(); r++) {
+            size_t c = 0;
+            for (size_t i = 0; i < num_ap_; i++)
+                c |= ((r >> i) & 1u) << ap_order.at(i);
+            table.at(r) = next_state(q, c);
+        }
+        que.emplace_back(q, std::move(table));
+    }
+    while (!que.empty()) {
+        auto [q, table] = std::move(que.back());
+        que.pop_back();
+
+        std::vector<State> lo, hi;
+        for (size_t r = 0; r < table.size(); r += 2) {
+            lo.push_back(table.at(r));
+            hi.push_back(table.at(r + 1));
+        }
+        size_t num_nodes = delta.size();
+        State q0 = get_or_create_node(lo);
+        if (num_nodes != delta.size())
+            que.emplace_back(q0, std::move(lo));
+        num_nodes = delta.size();
+        State q1 = get_or_create_node(hi);
+        if (num_nodes != delta.size())
+            que.emplace_back(q1, std::move(hi));
+        std::get<1>(delta.at(q)) = q0;
+        std::get<2>(delta.at(q)) = q1;
+    }
+
+    std::set<State> final_sts;
+    for (State q : all_states())
+        if (is_final_state(q))
+            final_sts.insert(q);
+
+    return Graph{initial_state(), final_sts, delta};
+}
+
+std::tuple<Graph, std::vector<size_t>> optimize_ap_order(const Graph& graph,
+                                                         size_t num_ap)
+{
+    // Larger number of APs is searched locally
+    const size_t max_num_ap_exhaustive = 6;
+
+    LetterGraph lgr = LetterGraph::from_graph(graph, num_ap, false).minimized();
+    auto eval = [&](const std::vector<size_t>& order) {
+        return lgr.binarized(order).minimized();
+    };
+
+    // Start from graph itself, which may share states among the phases of
+    // letters and thus be smaller than any binarization of lgr.
+    std::vector<size_t> best_order(num_ap);
+    std::iota(best_order.begin(), best_order.end(), 0);
+    Graph best = graph.minimized();
+
+    if (num_ap <= max_num_ap_exhaustive) {
+        std::vector<size_t> order = best_order;
+        while (std::next_permutation(order.begin(), order.end())) {
+            Graph gr = eval(order);
+            if (gr.size() < best.size()) {
+                best = std::move(gr);
+                best_order = order;
+            }
+        }
+        return {best, best_order};
+    }
+
+    // Sifting: move each AP to the position that gives the smallest graph
+    bool improved = true;
+    while (improved) {
+        improved = false;
+        for (size_t ap = 0; ap < num_ap; ap++) {
+            std::vector<size_t> rest;
+            std::copy_if(best_order.begin(), best_order.end(),
+                         std::back_inserter(rest),
+                         [ap](size_t i) { return i != ap; });
+            for (size_t pos = 0; pos < num_ap; pos++) {
+                std::vector<size_t> order = rest;
+                order.insert(order.begin() + pos, ap);
+                if (order == best_order)
+                    continue;
+                Graph gr = eval(order);
+                if (gr.size() < best.size()) {
+                    best = std::move(gr);
+                    best_order = order;
+                    improved = true;
+                }
+            }
+        }
+    }
+    return {best, best_order};
+}
+
+std::vector<std::string> split_ltl_conjunction(const std::string& formula)
+{
+    spot::parsed_formula pf = spot::parse_infix_psl(formula);
+    assert(!pf.format_errors(std::cerr));
+    if (!pf.f.is(spot::op::And))
+        return {formula};
+
+    // Spot flattens nested conjunctions, so each child is not a conjunction.
+    std::vector<std::string> ret;
+    for (const spot::formula& child : pf.f)
+        ret.push_back(spot::str_psl(child));
+    return ret;
+}
+
+LTLTranslation LTLTranslation::parse(const std::string& src)
+{
+    std::regex re(R"(^(nfa|direct):(any|det|small):(low|medium|high)$)");
+    std::smatch match;
+    if (!std::regex_match(src, match, re))
+        error_die("Invalid translation: {}", src);
+
+    LTLTranslation ret;
+    ret.path = match[1].str() == "nfa" ? PATH::NFA : PATH::DIRECT;
+    ret.pref = match[2].str() == "any"   ? PREF::ANY
+               : match[2].str() == "det" ? PREF::DETERMINISTIC
+                                         : PREF::SMALL;
+    ret.level = match[3].str() == "low"      ? LEVEL::LOW
+                : match[3].str() == "medium" ? LEVEL::MEDIUM
+                                             : LEVEL::HIGH;
+    return ret;
+}
+
+std::string LTLTranslation::str() const
+{
+    return fmt::format("{}:{}:{}", path == PATH::NFA ? "nfa" : "direct",
+                       pref == PREF::ANY             ? "any"
+                       : pref == PREF::DETERMINISTIC ? "det"
+                                                     : "small",
+                       level == LEVEL::LOW      ? "low"
+                       : level == LEVEL::MEDIUM ? "medium"
+                                                : "high");
+}
+
+spot::twa_graph_ptr ltl_to_monitor(const std::string& formula, size_t var_size,
+                                   bool deterministic)
+{
+    LTLTranslation translation;
+    if (deterministic)
+        translation.pref = LTLTranslation::PREF::DETERMINISTIC;
+    return ltl_to_monitor(formula, var_size, translation);
+}
+
+spot::twa_graph_ptr ltl_to_monitor(const std::string& formula, size_t var_size,
+                                   const LTLTranslation& translation)
 {
     spot::parsed_formula pf = spot::parse_infix_psl(formula);
     assert(!pf.format_errors(std::cerr));
@@ -646,15 +1263,36 @@ spot::twa_graph_ptr ltl_to_monitor(const std::string& formula, size_t var_size)
         aut->register_ap(fmt::format("p{}", i));
     spot::translator trans{dict};
     trans.set_type(spot::postprocessor::Monitor);
-    trans.set_pref(spot::postprocessor::Any);
+
+    int pref = spot::postprocessor::Any;
+    if (translation.pref == LTLTranslation::PREF::DETERMINISTIC ||
+        translation.path == LTLTranslation::PATH::DIRECT)
+        pref |= spot::postprocessor::Deterministic;
+    if (translation.pref == LTLTranslation::PREF::SMALL)
+        pref |= spot::postprocessor::Small;
+    trans.set_pref(pref);
+
+    switch (translation.level) {
+    case LTLTranslation::LEVEL::LOW:
+        trans.set_level(spot::postprocessor::Low);
+        break;
+    case LTLTranslation::LEVEL::MEDIUM:
+        trans.set_level(spot::postprocessor::Medium);
+        break;
+    case LTLTranslation::LEVEL::HIGH:
+        trans.set_level(spot::postprocessor::High);
+        break;
+    }
+
     return trans.run(pf.f);
 }
 
 std::tuple<std::set<Graph::State>, std::set<Graph::State>, Graph::NFADelta>
 Graph::ltl_to_nfa_tuple(const std::string& formula, size_t var_size,
-                        bool make_all_live_states_final)
+                        bool make_all_live_states_final,
+                        const LTLTranslation& translation)
 {
-    spot::twa_graph_ptr aut = ltl_to_monitor(formula, var_size);
+    spot::twa_graph_ptr aut = ltl_to_monitor(formula, var_size, translation);
 
     std::unordered_map<int, size_t> var2idx;
     {
@@ -780,13 +1418,11 @@ Graph::ltl_to_nfa_tuple(const std::string& formula, size_t var_size,
                     size_t q0_var_idx = var2idx.at(bdd_var(b));
                     size_t cidx = cur_var_idx;
                     State cq = cur_q;
-                    spdlog::debug("{}", cidx);
                     while (cidx > q0_var_idx + 1) {
                         cidx--;
                         State q = delta.size();
                         delta.push_back({q, {cq}, {cq}});
                         cq = q;
-                        spdlog::debug("{}", cidx);
                     }
                     State next = get(q0);
                     std::get<1>(delta.at(next)).push_back(cq);
@@ -8,6 +8,24 @@
 
 #include <spot/twa/twagraph.hh>
 
+// How to translate LTL into Graph. Written as "PATH:PREF:LEVEL", e.g.,
+// "direct:small:high". PATH is nfa (via NFA and subset construction) or
+// direct (see Graph::from_ltl_formula_direct). PREF (any, det, or small) and
+// LEVEL (low, medium, or high) are passed to Spot's translator. The direct
+// path always asks Spot for a deterministic monitor.
+struct LTLTranslation {
+    enum class PATH { NFA, DIRECT };
+    enum class PREF { ANY, DETERMINISTIC, SMALL };
+    enum class LEVEL { LOW, MEDIUM, HIGH };
+
+    PATH path = PATH::NFA;
+    PREF pref = PREF::ANY;
+    LEVEL level = LEVEL::HIGH;
+
+    static LTLTranslation parse(const std::string& src);
+    std::string str() const;
+};
+
 class Graph {
 public:
     using State = int;
@@ -15,6 +33,8 @@ public:
     using DFADelta = std::vector<std::tuple<State, State, State>>;
     using NFADelta =
         std::vector<std::tuple<State, std::vector<State>, std::vector<State>>>;
+    // Final states of each component of a product automaton
+    using ComponentFinalStates = std::vector<std::set<State>>;
 
 private:
     DFADelta delta_;
@@ -38,12 +58,26 @@ public:
                           const NFADelta& delta);
     static Graph from_ltl_formula(const std::string& formula, size_t var_size,
                                   bool make_all_live_states_final);
+    static Graph from_ltl_formula(const std::string& formula, size_t var_size,
+                                  bool make_all_live_states_final,
+                                  const LTLTranslation& translation);
     static Graph from_ltl_formula_reversed(const std::string& formula,
                                            size_t var_size,
                                            bool make_all_live_states_final);
+    // Same as from_ltl_formula, but binarize the deterministic monitor
+    // directly without building an NFA. Binarization subtrees are shared
+    // among edges whose remaining conditions and destinations are the same.
+    static Graph from_ltl_formula_direct(const std::string& formula,
+                                         size_t var_size,
+                                         bool make_all_live_states_final);
+    static std::tuple<Graph, ComponentFinalStates> product(
+        const std::vector<Graph>& components, bool minimized);
+    static size_t count_reachable_product_states(
+        const std::vector<Graph>& components, size_t limit);
 
     size_t size() const;
     bool is_final_state(State state) const;
+    const std::set<State>& final_states() const;
     State next_state(State state, bool input) const;
     const std::vector<State>& prev_states(State state, bool input) const;
     State transition64(State src, uint64_t input, int length) const;
@@ -51,13 +85,24 @@ public:
     void reserve_states_at_depth(size_t depth);
     std::vector<State> states_at_depth(size_t depth) const;
     std::vector<State> all_states() const;
+    // The j-th element has the states reachable from the initial state by
+    // inputs whose length is j modulo num_phases. A spec binarized from k APs
+    // has k such phases (layers), and only one of them matters at each input.
+    std::vector<std::vector<State>> states_at_phase(size_t num_phases) const;
+    // Find the number of phases that divides unit and minimizes the average
+    // size of the layers. Returns 1 if the graph has no such structure.
+    size_t detect_num_phases(size_t unit) const;
     std::vector<std::vector<State>> track_live_states(
         const std::vector<State>& init_live_states, size_t max_depth);
     Graph reversed() const;
+    // Same language as reversed().minimized(), but never builds a non-minimal
+    // reversed graph, which can be far larger than the minimal one.
+    Graph reversed_minimized() const;
     Graph minimized() const;
     Graph removed_unreachable() const;
     Graph grouped_nondistinguishable() const;
     Graph negated() const;
+    Graph with_final_states(const std::set<State>& final_sts) const;
     void dump(std::ostream& os) const;
     void dump_dot(std::ostream& os) const;
     void dump_att(std::ostream& os) const;
@@ -65,10 +110,66 @@ public:
 private:
     static std::tuple<std::set<State>, std::set<State>, NFADelta>
     ltl_to_nfa_tuple(const std::string& formula, size_t var_size,
-                     bool make_all_live_states_final);
+                     bool make_all_live_states_final,
+                     const LTLTranslation& translation);
+    static Graph binarize_monitor_direct(spot::twa_graph_ptr aut,
+                                         size_t var_size,
+                                         bool make_all_live_states_final);
     static NFADelta reversed_nfa_delta(const NFADelta& src);
+    std::tuple<Graph, std::vector<State>> grouped_nondistinguishable(
+        const std::vector<int>& classes) const;
 };
 
+// DFA over 2^num_ap letters. Letter c consists of num_ap bits and its i-th
+// bit (c >> i) & 1 is for p_i, which is the same order as each_input_bit.
+class LetterGraph {
+public:
+    using State = Graph::State;
+
+private:
+    size_t num_ap_;
+    // delta_.at(q * 2^num_ap + c) is the next state of q when input is c
+    std::vector<State> delta_;
+    std::vector<bool> final_state_vec_;
+    State init_state_;
+
+public:
+    LetterGraph(size_t num_ap, State init_st,
+                const std::vector<bool>& final_state_vec,
+                const std::vector<State>& delta);
+
+    // Take the states of graph reachable at the boundaries of letters. If
+    // reversed_bit_order is true, graph reads the bits of a letter from
+    // p_{num_ap-1} to p_0, as reversed graphs do.
+    static LetterGraph from_graph(const Graph& graph, size_t num_ap,
+                                  bool reversed_bit_order);
+
+    size_t size() const;
+    size_t num_ap() const;
+    size_t num_letters() const;
+    bool is_final_state(State state) const;
+    State next_state(State state, size_t letter) const;
+    State initial_state() const;
+    std::vector<State> all_states() const;
+    LetterGraph minimized() const;
+    // Binarize the graph so that the i-th bit of a letter is for
+    // p_{ap_order[i]}. States of the graph keep their indices in the result.
+    Graph binarized(const std::vector<size_t>& ap_order) const;
+};
+
+// Split formula into the operands of its top-level conjunction. If formula
+// is not a conjunction, the result has only formula itself.
+std::vector<std::string> split_ltl_conjunction(const std::string& formula);
+
+// Search the order of APs with which graph, binarized from num_ap APs, has
+// the fewest states after minimization. All the orders are tried for a few
+// APs; otherwise each AP is moved to its best position until no move helps.
+// Returns the minimized graph and the order (see LetterGraph::binarized).
+std::tuple<Graph, std::vector<size_t>> optimize_ap_order(const Graph& graph,
+                                                         size_t num_ap);
+
 spot::twa_graph_ptr ltl_to_monitor(const std::string& formula, size_t var_size,
                                    bool deterministic);
+spot::twa_graph_ptr ltl_to_monitor(const std::string& formula, size_t var_size,
+                                   const LTLTranslation& translation);
 #endif
@@ -0,0 +1,53 @@
+// Launcher of HOMFA_PORTABLE builds. homfa and TFHEpp are built for each ISA
+// into homfa-<ISA> next to this program, which execs the one for the widest
+// ISA the CPU supports with the same arguments. Keep this file free of
+// anything above the baseline x86-64, since it is built without -march.
+
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include <unistd.h>
+
+namespace {
+// __builtin_cpu_supports takes only string literals
+bool cpu_supports(const std::string& isa)
+{
+    __builtin_cpu_init();
+    if (isa == "x86-64")
+        return true;
+    if (isa == "x86-64-v2")
+        return __builtin_cpu_supports("x86-64-v2");
+    if (isa == "x86-64-v3")
+        return __builtin_cpu_supports("x86-64-v3");
+    if (isa == "x86-64-v4")
+        return __builtin_cpu_supports("x86-64-v4");
+    return false;
+}
+}  // namespace
+
+int main(int, char** argv)
+{
+    namespace fs = std::filesystem;
+
+    // HOMFA_LAUNCHER_ISAS lists the ISAs from the widest, separated by commas
+    std::istringstream isas{HOMFA_LAUNCHER_ISAS};
+    std::string isa;
+    while (std::getline(isas, isa, ',')) {
+        if (!cpu_supports(isa))
+            continue;
+        fs::path path = fs::read_symlink("/proc/self/exe").parent_path() /
+                        ("homfa-" + isa);
+        execv(path.c_str(), argv);
+        std::cerr << "Failed to exec " << path << ": " << std::strerror(errno)
+                  << std::endl;
+        return 1;
+    }
+
+    std::cerr << "This CPU supports none of the ISAs homfa is built for: "
+              << HOMFA_LAUNCHER_ISAS << std::endl;
+    return 1;
+}
@@ -1,20 +1,30 @@
 #include "archive.hpp"
+#include "batch_plain_dfa_runner.hpp"
 #include "error.hpp"
 #include "offline_dfa.hpp"
 #include "online_dfa.hpp"
 #include "utility.hpp"
 
 #include <cassert>
+#include <cerrno>
+#include <chrono>
 #include <execution>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <limits>
+#include <numeric>
 #include <optional>
 #include <queue>
 #include <set>
 #include <sstream>
 #include <thread>
 
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
 #include <spdlog/fmt/fmt.h>
 #include <spdlog/spdlog.h>
 #include <CLI/CLI.hpp>
@@ -37,6 +47,7 @@ enum class TYPE {
     RUN_BLOCK,
     RUN_FLUT,
     RUN_PLAIN,
+    RUN_PLAIN_BATCH,
 
     BENCH_OFFLINE,
     BENCH_REVERSE,
@@ -46,6 +57,7 @@ enum class TYPE {
 
     LTL2SPEC,
     SPEC2SPEC,
+    SPEC2PRODUCT,
     SPEC2DOT,
     ATT2SPEC,
     SPEC2ATT,
@@ -57,11 +69,18 @@ struct Args {
 
     bool minimized = false, reversed = false, negated = false,
          make_all_live_states_final = false, is_spec_reversed = false,
-         sanitize_result = false;
+         sanitize_result = false, split_conjunction = false, packed = false,
+         per_layer = false, unrolled = false, reduced_precision = false,
+         seeded = false, packed_trlwe = false, append = false,
+         summary = false;
     std::optional<std::string> spec, skey, bkey, input, output, output_dir,
-        debug_skey, formula, online_method;
+        output_log, debug_skey, formula, online_method, ap_order;
+    std::string log_sync = "end";
     std::optional<size_t> num_vars, queue_size, bootstrapping_freq,
-        max_second_lut_depth, num_ap, output_freq;
+        max_second_lut_depth, num_ap, output_freq, num_packed,
+        records_per_chunk, time_budget;
+    std::optional<double> follow;
+    std::vector<std::string> inputs, specs, portfolio;
 };
 
 void register_general_options(CLI::App& app, Args& args)
@@ -88,6 +107,10 @@ void register_genbkey(CLI::App& app, Args& args)
         ->required()
         ->check(CLI::ExistingFile);
     genbkey->add_option("--out", args.output)->required();
+    genbkey->add_flag("--unrolled", args.unrolled,
+                      "Also generate the key for key unrolling, which halves "
+                      "the external products per bootstrapping. The key of "
+                      "lvl01param grows to about 2.5 times its size");
 }
 
 void register_enc(CLI::App& app, Args& args)
@@ -100,6 +123,29 @@ void register_enc(CLI::App& app, Args& args)
     enc->add_option("--key", args.skey)->required()->check(CLI::ExistingFile);
     enc->add_option("--in", args.input)->required()->check(CLI::ExistingFile);
     enc->add_option("--out", args.output)->required();
+    enc->add_option("--ap-order", args.ap_order,
+                    "Reorder the bits of each letter as written by ltl2spec "
+                    "--optimize-ap-order")
+        ->check(CLI::ExistingFile);
+    enc->add_flag("--seeded", args.seeded,
+                  "Generate the random part of the ciphertexts from a seed "
+                  "instead of storing it, which makes the output about 4 "
+                  "times smaller. The run commands read both formats");
+    enc->add_flag("--packed-trlwe", args.packed_trlwe,
+                  "Pack the bits into TRLWEs, which makes the output and the "
+                  "encryption thousands of times cheaper. The run commands "
+                  "turn them into TRGSWs by circuit bootstrapping, which "
+                  "takes much more time than running the DFA");
+    enc->add_flag("--append", args.append,
+                  "Append the ciphertexts to the output as new chunks, which "
+                  "the run commands can read while it is being written. The "
+                  "output must have been written by enc with the same "
+                  "format and --ap");
+    enc->add_option("--records-per-chunk", args.records_per_chunk,
+                    "# of ciphertexts (or packed TRLWEs) per chunk. A reader "
+                    "gets no input of a chunk until it is full. Defaults to "
+                    "1 if the output is a named pipe")
+        ->check(CLI::PositiveNumber);
 }
 
 void register_dec(CLI::App& app, Args& args)
@@ -108,9 +154,17 @@ void register_dec(CLI::App& app, Args& args)
     dec->parse_complete_callback([&args] { args.type = TYPE::DEC; });
     dec->add_option("--key", args.skey)->required()->check(CLI::ExistingFile);
     dec->add_option("--in", args.input)->required()->check(CLI::ExistingFile);
+    dec->add_option("--packed", args.num_packed, "# of packed results")
+        ->check(CLI::PositiveNumber);
+    dec->add_flag("--summary", args.summary,
+                  "For a result log, print the # of true results and the "
+                  "first position of false instead of each result");
 }
 
-void add_run_common_options(CLI::App* run, Args& args, bool benchmark)
+// Results are written only at the end into --out, unless periodic_output is
+// true, in which case they can also be written every --out-freq inputs
+void add_run_common_options(CLI::App* run, Args& args, bool benchmark,
+                            bool periodic_output = false)
 {
     if (benchmark) {
         run->add_option("--ap", args.num_ap)
@@ -121,11 +175,34 @@ void add_run_common_options(CLI::App* run, Args& args, bool benchmark)
         run->add_option("--bkey", args.bkey)
             ->required()
             ->check(CLI::ExistingFile);
-        run->add_option("--out", args.output)->required();
+        CLI::Option* out = run->add_option("--out", args.output);
+        if (periodic_output) {
+            run->add_option("--out-dir", args.output_dir,
+                            "Write the results into separate files in the "
+                            "directory");
+            run->add_option("--out-log", args.output_log,
+                            "Append the results to a result log, which dec "
+                            "reads");
+            run->add_option("--out-log-sync", args.log_sync,
+                            "When to fsync the result log: none, end, or "
+                            "each record")
+                ->check(CLI::IsMember({"none", "end", "each"}));
+        }
+        else {
+            out->required();
+        }
     }
 
-    run->add_option("--spec", args.spec)->required()->check(CLI::ExistingFile);
-    run->add_option("--in", args.input)->required()->check(CLI::ExistingFile);
+    // Multiple specs are run over the same input and their results are
+    // combined by homomorphic AND
+    run->add_option("--spec", args.specs)
+        ->required()
+        ->check(CLI::ExistingFile);
+    run->add_option("--in", args.input,
+                    "Ciphertext file, or - for stdin. The online algorithms "
+                    "read stdin and named pipes as the inputs arrive")
+        ->required()
+        ->check(CLI::ExistingFile | CLI::IsMember({"-"}));
     run->add_option("--debug-secret-key", args.debug_skey)
         ->check(CLI::ExistingFile);
 }
@@ -140,13 +217,15 @@ void register_offline(CLI::App& app, Args& args, bool benchmark)
     run->add_option("--bootstrapping-freq", args.bootstrapping_freq)
         ->required()
         ->check(CLI::PositiveNumber);
+    run->add_flag("--packed", args.packed,
+                  "Pack the results of specs into one TRLWE");
 }
 
 void register_reverse(CLI::App& app, Args& args, bool benchmark)
 {
     CLI::App* run = app.add_subcommand("reverse", "Run REVERSE algorithm");
     run->alias("reversed");
-    add_run_common_options(run, args, benchmark);
+    add_run_common_options(run, args, benchmark, true);
     run->parse_complete_callback([&args, benchmark] {
         args.type = benchmark ? TYPE::BENCH_REVERSE : TYPE::RUN_REVERSE;
     });
@@ -157,6 +236,20 @@ void register_reverse(CLI::App& app, Args& args, bool benchmark)
         ->required()
         ->check(CLI::PositiveNumber);
     run->add_flag("--spec-reversed", args.is_spec_reversed);
+    run->add_flag("--packed", args.packed,
+                  "Pack the results of specs into one TRLWE");
+    if (!benchmark) {
+        run->add_option("--ap", args.num_ap,
+                        "Run on the letters of the given # of APs")
+            ->check(CLI::PositiveNumber);
+        run->add_flag("--reduced-precision", args.reduced_precision,
+                      "Round input TRGSWs to float for CMUXes. Check the "
+                      "noise with --debug-secret-key");
+        run->add_option("--follow", args.follow,
+                        "Keep reading the input file as it grows, until it "
+                        "does not grow for the given seconds")
+            ->check(CLI::PositiveNumber);
+    }
 }
 
 void register_block(CLI::App& app, Args& args, bool benchmark)
@@ -174,13 +267,22 @@ void register_block(CLI::App& app, Args& args, bool benchmark)
     run->add_option("--queue-size", args.queue_size)
         ->required()
         ->check(CLI::PositiveNumber);
+    if (!benchmark) {
+        run->add_option("--ap", args.num_ap,
+                        "Run on the letters of the given # of APs")
+            ->check(CLI::PositiveNumber);
+        run->add_option("--follow", args.follow,
+                        "Keep reading the input file as it grows, until it "
+                        "does not grow for the given seconds")
+            ->check(CLI::PositiveNumber);
+    }
 }
 
 void register_flut(CLI::App& app, Args& args, bool benchmark)
 {
     CLI::App* run = app.add_subcommand("flut", "Run FLUT algorithm");
     run->alias("qtrlwe2");
-    add_run_common_options(run, args, benchmark);
+    add_run_common_options(run, args, benchmark, true);
     run->parse_complete_callback([&args, benchmark] {
         args.type = benchmark ? TYPE::BENCH_FLUT : TYPE::RUN_FLUT;
     });
@@ -196,6 +298,11 @@ void register_flut(CLI::App& app, Args& args, bool benchmark)
     run->add_option("--bootstrapping-freq", args.bootstrapping_freq)
         ->required()
         ->check(CLI::PositiveNumber);
+    if (!benchmark)
+        run->add_option("--follow", args.follow,
+                        "Keep reading the input file as it grows, until it "
+                        "does not grow for the given seconds")
+            ->check(CLI::PositiveNumber);
 }
 
 void register_plain(CLI::App& app, Args& args, bool benchmark)
@@ -211,6 +318,23 @@ void register_plain(CLI::App& app, Args& args, bool benchmark)
     run->add_option("--in", args.input)->required()->check(CLI::ExistingFile);
 }
 
+void register_plain_batch(CLI::App& app, Args& args)
+{
+    CLI::App* run = app.add_subcommand(
+        "plain-batch", "Run DFA on many plain text traces at once");
+    run->parse_complete_callback(
+        [&args] { args.type = TYPE::RUN_PLAIN_BATCH; });
+    run->add_option("--ap", args.num_ap)
+        ->required()
+        ->check(CLI::PositiveNumber);
+    run->add_option("--spec", args.spec)->required()->check(CLI::ExistingFile);
+    run->add_option("--in", args.inputs)
+        ->required()
+        ->check(CLI::ExistingFile);
+    run->add_option("--out-freq", args.output_freq)
+        ->check(CLI::PositiveNumber);
+}
+
 std::string concat_paths(const std::string& lhs, const std::string& rhs)
 {
     return std::filesystem::path{lhs} / std::filesystem::path{rhs};
@@ -229,49 +353,283 @@ void do_genkey(const std::string& output_filename)
 }
 
 void do_genbkey(const std::string& skey_filename,
-                const std::string& output_filename)
+                const std::string& output_filename, bool unrolled)
 {
     auto skey = read_from_archive<SecretKey>(skey_filename);
-    BKey bkey{skey};
+    BKey bkey{skey, unrolled};
     write_to_archive(output_filename, bkey);
 }
 
+// The file has the indices of APs in the order they are read, e.g., "1 0"
+std::vector<size_t> read_ap_order(const std::string& filename, size_t num_ap)
+{
+    std::ifstream ifs{filename};
+    if (!ifs)
+        error_die("Cannot open {}", filename);
+    std::vector<size_t> order;
+    size_t i;
+    while (ifs >> i)
+        order.push_back(i);
+
+    std::vector<size_t> id(num_ap);
+    std::iota(id.begin(), id.end(), 0);
+    if (order.size() != num_ap ||
+        !std::is_permutation(order.begin(), order.end(), id.begin()))
+        error_die("Invalid AP order for {} APs: {}", num_ap, filename);
+    return order;
+}
+
+void write_ap_order(const std::string& filename,
+                    const std::vector<size_t>& order)
+{
+    std::ofstream ofs{filename};
+    if (!ofs)
+        error_die("Cannot open {}", filename);
+    for (size_t i = 0; i < order.size(); i++)
+        ofs << (i == 0 ? "" : " ") << order.at(i);
+    ofs << "\n";
+}
+
 void do_enc(const std::string& skey_filename, const std::string& input_filename,
-            const std::string& output_filename, const size_t num_ap)
+            const std::string& output_filename, const size_t num_ap,
+            const std::optional<std::string>& ap_order_filename, bool seeded,
+            bool packed_trlwe, bool append,
+            std::optional<size_t> records_per_chunk)
 {
     auto skey = read_from_archive<SecretKey>(skey_filename);
 
-    std::ofstream ofs{output_filename};
-    assert(ofs);
-    TRGSWLvl1FFTSerializer ser{ofs};
+    // Let the reader on the other end get each input as soon as it is
+    // encrypted
+    if (!records_per_chunk && std::filesystem::is_fifo(output_filename))
+        records_per_chunk = 1;
+
+    using FORMAT = TRGSWLvl1CtxtFile::FORMAT;
+    TRGSWLvl1CtxtFileWriter writer{output_filename,
+                                   seeded         ? FORMAT::SEEDED
+                                   : packed_trlwe ? FORMAT::PACKED
+                                                  : FORMAT::FFT,
+                                   num_ap, skey, append, records_per_chunk};
+
+    auto enc = [&](bool b) { writer.save_bit(b); };
+    if (ap_order_filename)
+        each_input_bit(input_filename,
+                       read_ap_order(*ap_order_filename, num_ap), enc);
+    else
+        each_input_bit(input_filename, num_ap, enc);
+    writer.flush();
+}
 
-    each_input_bit(input_filename, num_ap, [&](bool b) {
-        ser.save(encrypt_bit_to_TRGSWLvl1FFT(b, skey));
-    });
+template <class Runner>
+size_t sum_state_size(const std::vector<Runner>& runners)
+{
+    size_t ret = 0;
+    for (auto&& runner : runners)
+        ret += runner.graph().size();
+    return ret;
+}
+
+void print_bkey_size(const BKey& bkey)
+{
+    spdlog::info("\tBootstrapping key of lvl01param:\t{} MiB{}",
+                 bkey.ekey->bklvl01_bytes() >> 20,
+                 bkey.ekey->bkfftunrolled ? " (unrolled)" : "");
+}
+
+// Feed the same input to all the runners, one for each spec
+template <class Runner, class TRGSW>
+void eval_one_all(std::vector<Runner>& runners, const TRGSW& input)
+{
+    std::for_each(std::execution::par, runners.begin(), runners.end(),
+                  [&](Runner& runner) { runner.eval_one(input); });
+}
+
+// Same as eval_one_all, but the runners refer to input without copying it.
+// input must stay valid until the runners evaluate the block it belongs to.
+template <class Runner>
+void eval_one_borrowed_all(std::vector<Runner>& runners,
+                           const TRGSWLvl1FFT& input)
+{
+    std::for_each(
+        std::execution::par, runners.begin(), runners.end(),
+        [&](Runner& runner) { runner.eval_one_borrowed(input); });
+}
+
+// Combine the results of all the runners by homomorphic AND
+template <class Runner>
+TLWELvl1 result_all(std::vector<Runner>& runners, const EvalKey& ek)
+{
+    std::vector<TLWELvl1> res(runners.size());
+    std::transform(std::execution::par, runners.begin(), runners.end(),
+                   res.begin(), [](Runner& runner) { return runner.result(); });
+    return HomANDLvl1(res, ek);
 }
 
-void do_run_offline(const std::string& spec_filename,
+bool is_streaming_input(const std::string& filename)
+{
+    return filename == "-" || std::filesystem::is_fifo(filename);
+}
+
+// Read stdin, named pipes, and files followed with --follow as the inputs
+// arrive, and map the other files
+std::unique_ptr<TRGSWLvl1InputStream> open_input_stream(
+    const std::string& filename, std::shared_ptr<const EvalKey> ekey,
+    size_t read_ahead, const std::optional<double>& follow)
+{
+    if (is_streaming_input(filename) || follow)
+        return std::make_unique<TRGSWLvl1InputStreamFromPipe>(
+            filename, std::move(ekey), read_ahead, follow);
+    return std::make_unique<TRGSWLvl1InputStreamFromCtxtFile>(
+        filename, std::move(ekey), read_ahead);
+}
+
+void log_input_size(const TRGSWLvl1InputStream& input_stream)
+{
+    if (input_stream.is_streaming())
+        spdlog::info("\tInput size:\t{}", "streaming");
+    else
+        spdlog::info("\tInput size:\t{} (hidden)", input_stream.size());
+}
+
+// Where the online algorithms write the results. Exactly one of filename,
+// dirname, and logname is given. The results after every freq inputs are
+// written into dirname as "{# of inputs}.out" or into logname as records,
+// and so is the last one. Only the last one is written into filename.
+struct OutputOptions {
+    std::optional<std::string> filename, dirname, logname;
+    size_t freq;
+    ResultLogWriter::SYNC log_sync;
+
+    bool is_periodic() const
+    {
+        return dirname || logname;
+    }
+};
+
+OutputOptions output_options_of(const Args& args)
+{
+    if ((args.output ? 1 : 0) + (args.output_dir ? 1 : 0) +
+            (args.output_log ? 1 : 0) !=
+        1)
+        error_die("Use one of --out, --out-dir, and --out-log");
+    const ResultLogWriter::SYNC log_sync =
+        args.log_sync == "none"   ? ResultLogWriter::SYNC::NONE
+        : args.log_sync == "each" ? ResultLogWriter::SYNC::EACH
+                                  : ResultLogWriter::SYNC::END;
+    return OutputOptions{args.output, args.output_dir, args.output_log,
+                         args.output_freq.value(), log_sync};
+}
+
+// Write the results as OutputOptions tells, on another thread
+class ResultWriter {
+private:
+    const OutputOptions& opts_;
+    AsyncIO io_;
+    std::optional<ResultLogWriter> log_;
+    std::optional<size_t> last_pos_;
+
+public:
+    // num_results is the # of results packed in a TRLWE, or 1 for a TLWE
+    ResultWriter(const OutputOptions& opts, ResultLogFile::FORMAT format,
+                 size_t num_results)
+        : opts_(opts), io_(), log_(), last_pos_()
+    {
+        assert((opts_.filename ? 1 : 0) + (opts_.dirname ? 1 : 0) +
+                   (opts_.logname ? 1 : 0) ==
+               1);
+        if (opts_.dirname)
+            std::filesystem::create_directory(*opts_.dirname);
+        if (opts_.logname)
+            log_.emplace(io_, *opts_.logname, format, num_results,
+                         opts_.log_sync);
+    }
+
+    bool is_periodic() const
+    {
+        return opts_.is_periodic();
+    }
+
+    void log_params() const
+    {
+        if (opts_.filename)
+            spdlog::info("\tOutput file name:\t{}", *opts_.filename);
+        if (opts_.dirname)
+            spdlog::info("\tOutput directory:\t{}", *opts_.dirname);
+        if (opts_.logname)
+            spdlog::info("\tOutput log:\t{}", *opts_.logname);
+        if (is_periodic())
+            spdlog::info("\tOutput frequency:\t{}", opts_.freq);
+    }
+
+    // Whether the result after pos inputs is written before the last one
+    bool is_due(size_t pos) const
+    {
+        return is_periodic() && pos % opts_.freq == 0;
+    }
+
+    // Whether the result after pos inputs is already written
+    bool has_written(size_t pos) const
+    {
+        return last_pos_ == pos;
+    }
+
+    // Write the result after pos inputs
+    template <class Result>
+    void write(size_t pos, const Result& res)
+    {
+        last_pos_ = pos;
+        if (log_)
+            log_->append(pos, res);
+        else if (opts_.dirname)
+            write_to_archive(
+                io_, concat_paths(*opts_.dirname, fmt::format("{}.out", pos)),
+                res);
+        else
+            write_to_archive(io_, *opts_.filename, res);
+    }
+};
+
+void do_run_offline(const std::vector<std::string>& spec_filenames,
                     const std::string& input_filename,
                     const std::string& output_filename,
                     size_t bootstrapping_freq, const std::string& bkey_filename,
-                    bool sanitize_result)
+                    bool packed, bool sanitize_result)
 {
-    ReversedTRGSWLvl1InputStreamFromCtxtFile input_stream{input_filename};
-
+    // The offline algorithm reads the input from the end
+    if (is_streaming_input(input_filename))
+        error_die("The offline algorithm needs a regular input file");
     auto bkey = read_from_archive<BKey>(bkey_filename);
-    OfflineDFARunner runner{Graph::from_file(spec_filename).minimized(),
-                            input_stream.size(), bootstrapping_freq, bkey.ekey,
-                            sanitize_result};
+    ReversedTRGSWLvl1InputStreamFromCtxtFile input_stream{input_filename,
+                                                          bkey.ekey};
+
+    std::vector<OfflineDFARunner> runners;
+    if (packed) {
+        std::vector<Graph> graphs;
+        for (auto&& spec_filename : spec_filenames)
+            graphs.push_back(Graph::from_file(spec_filename));
+        runners.emplace_back(graphs, input_stream.size(), bootstrapping_freq,
+                             bkey.ekey, bkey.tlwel1_trlwel1_ikskey,
+                             sanitize_result);
+    }
+    else {
+        for (auto&& spec_filename : spec_filenames)
+            runners.emplace_back(Graph::from_file(spec_filename).minimized(),
+                                 input_stream.size(), bootstrapping_freq,
+                                 bkey.ekey, sanitize_result);
+    }
 
     spdlog::info("Parameter:");
     spdlog::info("\tMode:\t{}", "Offline FA Runner");
+    print_bkey_size(bkey);
     spdlog::info("\tInput size:\t{}", input_stream.size());
-    spdlog::info("\tState size:\t{}", runner.graph().size());
+    spdlog::info("\t# of specs:\t{}", spec_filenames.size());
+    spdlog::info("\tPacked:\t{}", packed);
+    spdlog::info("\tState size:\t{}", sum_state_size(runners));
     spdlog::info("\tBootstrapping frequency:\t{}", bootstrapping_freq);
     {
         size_t total_cnt_cmux = 0;
-        for (size_t j = 0; j < input_stream.size(); j++)
-            total_cnt_cmux += runner.graph().states_at_depth(j).size();
+        for (auto&& runner : runners)
+            for (size_t j = 0; j < input_stream.size(); j++)
+                total_cnt_cmux += runner.graph().states_at_depth(j).size();
         spdlog::info("\tTotal #CMUX:\t{}", total_cnt_cmux);
     }
     spdlog::info("\tSanitization:\t{}", sanitize_result);
@@ -279,9 +637,12 @@ void do_run_offline(const std::string& spec_filename,
 
     size_t input_size = input_stream.size();
     for (size_t i = 0; i < input_size; i++)
-        runner.eval_one(input_stream.next());
+        eval_one_all(runners, input_stream.next());
 
-    write_to_archive(output_filename, runner.result());
+    if (packed)
+        write_to_archive(output_filename, runners.front().packed_result());
+    else
+        write_to_archive(output_filename, result_all(runners, *bkey.ekey));
 }
 
 /*
@@ -311,174 +672,529 @@ void do_run_online_dfa(const std::string &spec_filename,
 }
 */
 
-void do_run_reverse(const std::string& spec_filename,
+void do_run_reverse(const std::vector<std::string>& spec_filenames,
                     const std::string& input_filename,
-                    const std::optional<std::string>& output_filename,
-                    const std::optional<std::string>& output_dirname,
-                    size_t output_freq, size_t bootstrapping_freq,
-                    bool is_spec_reversed, const std::string& bkey_filename,
-                    bool sanitize_result)
+                    const OutputOptions& output_options,
+                    size_t bootstrapping_freq, bool is_spec_reversed,
+                    const std::string& bkey_filename, bool packed,
+                    bool reduced_precision,
+                    const std::optional<std::string>& debug_skey_filename,
+                    const std::optional<double>& follow, bool sanitize_result)
 {
-    assert((output_filename && !output_dirname) ||
-           (!output_filename && output_dirname));
+    // Packing adds noise per spec, so check it before reading the keys
+    const size_t max_num_packed =
+        BackstreamDFARunner::max_num_props(bootstrapping_freq);
+    if (packed && spec_filenames.size() > max_num_packed)
+        error_die("--packed supports at most {} specs with "
+                  "--bootstrapping-freq {}, but {} are given",
+                  max_num_packed, bootstrapping_freq, spec_filenames.size());
+
+    std::optional<SecretKey> debug_skey;
+    if (debug_skey_filename)
+        debug_skey.emplace(read_from_archive<SecretKey>(*debug_skey_filename));
 
-    TRGSWLvl1InputStreamFromCtxtFile input_stream{input_filename};
     auto bkey = read_from_archive<BKey>(bkey_filename);
-    OnlineDFARunner2 runner{Graph::from_file(spec_filename), bootstrapping_freq,
-                            is_spec_reversed, bkey.ekey, sanitize_result};
+    auto input_stream = open_input_stream(input_filename, bkey.ekey,
+                                          STREAM_READ_AHEAD, follow);
+    // Results are read only after multiples of output_unit inputs. The size
+    // of a streamed input is not known, so results may be read at any time.
+    size_t output_unit =
+        input_stream->is_streaming() ? 1
+        : output_options.is_periodic()
+            ? std::gcd(output_options.freq, input_stream->size())
+            : input_stream->size();
+    std::vector<OnlineDFARunner2> runners;
+    if (packed) {
+        std::vector<Graph> graphs;
+        for (auto&& spec_filename : spec_filenames)
+            graphs.push_back(Graph::from_file(spec_filename));
+        runners.emplace_back(graphs, bootstrapping_freq, output_unit,
+                             is_spec_reversed, bkey.ekey,
+                             bkey.tlwel1_trlwel1_ikskey, sanitize_result);
+    }
+    else {
+        for (auto&& spec_filename : spec_filenames)
+            runners.emplace_back(Graph::from_file(spec_filename),
+                                 bootstrapping_freq, output_unit,
+                                 is_spec_reversed, bkey.ekey, sanitize_result);
+    }
 
     spdlog::info("Parameter:");
     spdlog::info("\tMode:\t{}", "Online FA Runner2 (reversed)");
-    spdlog::info("\tInput size:\t{} (hidden)", input_stream.size());
-    spdlog::info("\tState size:\t{}", runner.graph().size());
-    if (output_filename)
-        spdlog::info("\tOutput file name:\t{}", *output_filename);
-    if (output_dirname) {
-        spdlog::info("\tOutput directory:\t{}", *output_dirname);
-        spdlog::info("\tOutput frequency:\t{}", output_freq);
-    }
+    print_bkey_size(bkey);
+    log_input_size(*input_stream);
+    spdlog::info("\t# of specs:\t{}", spec_filenames.size());
+    spdlog::info("\tPacked:\t{}", packed);
+    if (packed)
+        spdlog::info("\tMax # of packed specs:\t{}", max_num_packed);
+    spdlog::info("\tReduced precision:\t{}", reduced_precision);
+    spdlog::info("\tState size:\t{}", sum_state_size(runners));
+    for (size_t i = 0; i < runners.size(); i++)
+        spdlog::info("\t# of phases of spec {}:\t{}", i,
+                     runners.at(i).num_phases());
+    ResultWriter output{output_options,
+                        packed ? ResultLogFile::FORMAT::TRLWE
+                               : ResultLogFile::FORMAT::TLWE,
+                        packed ? spec_filenames.size() : 1};
+    output.log_params();
     spdlog::info("\tBootstrapping frequency:\t{}", bootstrapping_freq);
     spdlog::info("\tSanitization:\t{}", sanitize_result);
     spdlog::info("");
 
-    if (output_dirname)
-        std::filesystem::create_directory(*output_dirname);
-
-    size_t input_stream_size_hidden = input_stream.size();
-    for (size_t i = 0; input_stream.size() != 0; i++) {
+    auto write_result = [&](size_t pos) {
+        if (packed)
+            output.write(pos, runners.front().packed_result());
+        else
+            output.write(pos, result_all(runners, *bkey.ekey));
+    };
+
+    // Largest noise of the weights over all the inputs
+    double max_noise = 0;
+    // i is the number of inputs after the loop
+    size_t i = 0;
+    for (; input_stream->has_next(); i++) {
         spdlog::debug("Processing input {}", i);
-        runner.eval_one(input_stream.next());
-
-        if (output_dirname && i % output_freq == output_freq - 1) {
-            const std::string path =
-                concat_paths(*output_dirname, fmt::format("{}.out", i + 1));
-            write_to_archive(path, runner.result());
+        if (reduced_precision)
+            eval_one_all(runners,
+                         TRGSWLvl1FFT_to_float(input_stream->next()));
+        else
+            eval_one_all(runners, input_stream->next());
+
+        if (debug_skey) {
+            NoiseStat stat;
+            for (auto&& runner : runners)
+                runner.measure_noise(stat, *debug_skey);
+            spdlog::debug("Noise after input {}: stddev {:e}, max {:e}", i,
+                          stat.stddev(), stat.max_abs);
+            max_noise = std::max(max_noise, stat.max_abs);
+            // Leave a margin of a factor of 2 below the bound 1/4
+            if (stat.max_abs >= 1.0 / 8)
+                spdlog::warn("Noise after input {} is too large: {:e}", i,
+                             stat.max_abs);
         }
+
+        if (output.is_due(i + 1))
+            write_result(i + 1);
     }
 
-    if (output_filename)
-        write_to_archive(*output_filename, runner.result());
-    else {
-        const std::string path = concat_paths(
-            *output_dirname, fmt::format("{}.out", input_stream_size_hidden));
-        write_to_archive(path, runner.result());
+    if (debug_skey)
+        spdlog::info("Max noise of weights:\t{:e}", max_noise);
+
+    if (!output.has_written(i))
+        write_result(i);
+}
+
+// Same as do_run_reverse, but run on the letters of num_ap bits. Output and
+// bootstrapping frequencies are in letters.
+void do_run_reverse_letter(const std::vector<std::string>& spec_filenames,
+                           const std::string& input_filename,
+                           const OutputOptions& output_options,
+                           size_t bootstrapping_freq, bool is_spec_reversed,
+                           const std::string& bkey_filename, size_t num_ap,
+                           const std::optional<double>& follow,
+                           bool sanitize_result)
+{
+    auto bkey = read_from_archive<BKey>(bkey_filename);
+    auto input_stream = open_input_stream(input_filename, bkey.ekey,
+                                          STREAM_READ_AHEAD, follow);
+    if (input_stream->num_ap() && *input_stream->num_ap() != num_ap)
+        error_die("The input was encrypted with --ap {}",
+                  *input_stream->num_ap());
+    if (!input_stream->is_streaming() && input_stream->size() % num_ap != 0)
+        error_die("The input size must be a multiple of {}", num_ap);
+
+    std::vector<OnlineLetterDFARunner2> runners;
+    for (auto&& spec_filename : spec_filenames)
+        runners.emplace_back(Graph::from_file(spec_filename), num_ap,
+                             bootstrapping_freq, is_spec_reversed, bkey.ekey,
+                             sanitize_result);
+
+    spdlog::info("Parameter:");
+    spdlog::info("\tMode:\t{}", "Online FA Runner2 (reversed, letter)");
+    print_bkey_size(bkey);
+    log_input_size(*input_stream);
+    spdlog::info("\t# of specs:\t{}", spec_filenames.size());
+    spdlog::info("\t# of APs:\t{}", num_ap);
+    spdlog::info("\tState size:\t{}", sum_state_size(runners));
+    ResultWriter output{output_options, ResultLogFile::FORMAT::TLWE, 1};
+    output.log_params();
+    spdlog::info("\tBootstrapping frequency:\t{}", bootstrapping_freq);
+    spdlog::info("\tSanitization:\t{}", sanitize_result);
+    spdlog::info("");
+
+    // i is the number of letters after the loop
+    size_t i = 0;
+    for (; input_stream->has_next(); i++) {
+        spdlog::debug("Processing letter {}", i);
+        for (size_t j = 0; j < num_ap; j++) {
+            if (!input_stream->has_next())
+                error_die("The input size must be a multiple of {}", num_ap);
+            eval_one_all(runners, input_stream->next());
+        }
+
+        if (output.is_due(i + 1))
+            output.write(i + 1, result_all(runners, *bkey.ekey));
     }
+
+    if (!output.has_written(i))
+        output.write(i, result_all(runners, *bkey.ekey));
 }
 
-void do_run_flut(const std::string& spec_filename,
+void do_run_flut(const std::vector<std::string>& spec_filenames,
                  const std::string& input_filename,
-                 const std::optional<std::string>& output_filename,
-                 const std::optional<std::string>& output_dirname,
-                 size_t output_freq, size_t queue_size,
+                 const OutputOptions& output_options, size_t queue_size,
                  size_t bootstrapping_freq, const std::string& bkey_filename,
                  const std::optional<size_t>& max_second_lut_depth,
                  const std::optional<std::string>& debug_skey_filename,
-                 bool sanitize_result)
+                 const std::optional<double>& follow, bool sanitize_result)
 {
-    TRGSWLvl1InputStreamFromCtxtFile input_stream{input_filename};
-    Graph gr = Graph::from_file(spec_filename);
-
     auto bkey = read_from_archive<BKey>(bkey_filename);
     assert(bkey.ekey && bkey.tlwel1_trlwel1_ikskey);
 
+    // Keep a whole block in memory since the runners borrow the inputs
+    auto input_stream =
+        open_input_stream(input_filename, bkey.ekey,
+                          std::max(STREAM_READ_AHEAD, queue_size), follow);
+    assert(input_stream->read_ahead() >= queue_size);
+
     std::optional<SecretKey> debug_skey;
     if (debug_skey_filename)
         debug_skey.emplace(read_from_archive<SecretKey>(*debug_skey_filename));
 
-    OnlineDFARunner3 runner{gr,         max_second_lut_depth.value_or(8),
-                            queue_size, bootstrapping_freq,
-                            *bkey.ekey, *bkey.tlwel1_trlwel1_ikskey,
-                            debug_skey, sanitize_result};
+    std::vector<OnlineDFARunner3> runners;
+    for (auto&& spec_filename : spec_filenames)
+        runners.emplace_back(Graph::from_file(spec_filename),
+                             max_second_lut_depth.value_or(8), queue_size,
+                             bootstrapping_freq, *bkey.ekey,
+                             *bkey.tlwel1_trlwel1_ikskey, debug_skey,
+                             sanitize_result);
 
     spdlog::info("Parameter:");
     spdlog::info("\tMode:\t{}", "Online FA Runner3 (qtrlwe2)");
-    spdlog::info("\tInput size:\t{} (hidden)", input_stream.size());
-    spdlog::info("\tState size:\t{}", gr.size());
-    spdlog::info("\tQueue size:\t{}", runner.queue_size());
-    if (output_filename)
-        spdlog::info("\tOutput file name:\t{}", *output_filename);
-    if (output_dirname) {
-        spdlog::info("\tOutput directory:\t{}", *output_dirname);
-        spdlog::info("\tOutput frequency:\t{}", output_freq);
-    }
+    print_bkey_size(bkey);
+    log_input_size(*input_stream);
+    spdlog::info("\t# of specs:\t{}", runners.size());
+    spdlog::info("\tState size:\t{}", sum_state_size(runners));
+    spdlog::info("\tQueue size:\t{}", runners.front().queue_size());
+    ResultWriter output{output_options, ResultLogFile::FORMAT::TLWE, 1};
+    output.log_params();
     spdlog::info("\tBootstrapping frequency:\t{}", bootstrapping_freq);
     spdlog::info("\tSanitization:\t{}", sanitize_result);
     spdlog::info("");
 
-    if (output_dirname && output_freq % queue_size != 0)
+    if (output.is_periodic() && output_options.freq % queue_size != 0)
         spdlog::warn("Output frequency ({}) is not the same as queue size ({})",
-                     output_freq, queue_size);
-
-    if (output_dirname)
-        std::filesystem::create_directory(*output_dirname);
+                     output_options.freq, queue_size);
 
-    size_t input_stream_size_hidden = input_stream.size();
-    for (size_t i = 0; input_stream.size() != 0; i++) {
+    // i is the number of inputs after the loop
+    size_t i = 0;
+    for (; input_stream->has_next(); i++) {
         spdlog::debug("Processing input {}", i);
-        runner.eval_one(input_stream.next());
+        eval_one_borrowed_all(runners, input_stream->next());
 
-        if (output_dirname && i % output_freq == output_freq - 1) {
-            const std::string path =
-                concat_paths(*output_dirname, fmt::format("{}.out", i + 1));
-            write_to_archive(path, runner.result());
-        }
+        if (output.is_due(i + 1))
+            output.write(i + 1, result_all(runners, *bkey.ekey));
     }
 
-    if (output_filename)
-        write_to_archive(*output_filename, runner.result());
-    else {
-        const std::string path = concat_paths(
-            *output_dirname, fmt::format("{}.out", input_stream_size_hidden));
-        write_to_archive(path, runner.result());
-    }
+    if (!output.has_written(i))
+        output.write(i, result_all(runners, *bkey.ekey));
 }
 
-void do_run_block(const std::string& spec_filename,
+void do_run_block(const std::vector<std::string>& spec_filenames,
                   const std::string& input_filename,
                   const std::string& output_filename, size_t queue_size,
-                  const std::string& bkey_filename, bool sanitize_result)
+                  const std::string& bkey_filename, size_t num_ap,
+                  const std::optional<double>& follow, bool sanitize_result)
 {
-    TRGSWLvl1InputStreamFromCtxtFile input_stream{input_filename};
-    Graph gr = Graph::from_file(spec_filename);
-
     auto bkey = read_from_archive<BKey>(bkey_filename);
     assert(bkey.ekey);
 
-    OnlineDFARunner4 runner{gr, queue_size, *bkey.ekey, sanitize_result};
+    // Keep a whole block in memory since the runners borrow the inputs
+    auto input_stream = open_input_stream(
+        input_filename, bkey.ekey,
+        std::max(STREAM_READ_AHEAD, queue_size * num_ap), follow);
+    assert(input_stream->read_ahead() >= queue_size * num_ap);
+    if (input_stream->num_ap() && *input_stream->num_ap() != num_ap)
+        error_die("The input was encrypted with --ap {}",
+                  *input_stream->num_ap());
+    if (!input_stream->is_streaming() && input_stream->size() % num_ap != 0)
+        error_die("The input size must be a multiple of {}", num_ap);
+
+    std::vector<OnlineDFARunner4> runners;
+    for (auto&& spec_filename : spec_filenames)
+        runners.emplace_back(Graph::from_file(spec_filename), queue_size,
+                             num_ap, *bkey.ekey, sanitize_result);
 
     spdlog::info("Parameter:");
     spdlog::info("\tMode:\t{}", "Online FA Runner4 (block-backstream)");
-    spdlog::info("\tInput size:\t{} (hidden)", input_stream.size());
-    spdlog::info("\tState size:\t{}", gr.size());
-    spdlog::info("\tQueue size:\t{}", runner.queue_size());
+    print_bkey_size(bkey);
+    log_input_size(*input_stream);
+    spdlog::info("\t# of specs:\t{}", runners.size());
+    spdlog::info("\tState size:\t{}", sum_state_size(runners));
+    spdlog::info("\tQueue size:\t{}", runners.front().queue_size());
+    spdlog::info("\t# of APs:\t{}", num_ap);
     spdlog::info("\tSanitization:\t{}", sanitize_result);
     spdlog::info("");
 
-    for (size_t i = 0; input_stream.size() != 0; i++) {
+    size_t i = 0;
+    for (; input_stream->has_next(); i++) {
         spdlog::debug("Processing input {}", i);
-        runner.eval_one(input_stream.next());
+        eval_one_borrowed_all(runners, input_stream->next());
     }
-    TLWELvl1 res = runner.result();
+    if (i % num_ap != 0)
+        error_die("The input size must be a multiple of {}", num_ap);
+    TLWELvl1 res = result_all(runners, *bkey.ekey);
 
     write_to_archive(output_filename, res);
 }
 
-void do_dec(const std::string& skey_filename, const std::string& input_filename)
+// Print "{position} {results}" for each record, or for each result, the # of
+// records where it is true and the first position where it is false
+void do_dec_log(const SecretKey& skey, const std::string& input_filename,
+                bool summary)
+{
+    ResultLogFile log{input_filename};
+    const size_t num_results = log.num_results();
+
+    // Decrypt the records block by block so that the memory in use does not
+    // grow with the log
+    constexpr size_t BLOCK_SIZE = 1024;
+    std::vector<std::vector<bool>> res;
+    std::vector<size_t> num_true(num_results, 0);
+    std::vector<std::optional<uint64_t>> first_false(num_results);
+    for (size_t begin = 0; begin < log.size(); begin += BLOCK_SIZE) {
+        const size_t end = std::min(begin + BLOCK_SIZE, log.size());
+        res.resize(end - begin);
+        tbb::parallel_for(begin, end, [&](size_t i) {
+            if (log.format() == ResultLogFile::FORMAT::TLWE)
+                res.at(i - begin) = {
+                    decrypt_TLWELvl1_to_bit(log.tlwe(i), skey)};
+            else
+                res.at(i - begin) = decrypt_TRLWELvl1_to_bits(
+                    log.trlwe(i), num_results, skey);
+        });
+
+        for (size_t i = begin; i < end; i++) {
+            const std::vector<bool>& bits = res.at(i - begin);
+            if (!summary) {
+                std::cout << log.pos(i) << " ";
+                for (bool b : bits)
+                    std::cout << b;
+                std::cout << "\n";
+                continue;
+            }
+            for (size_t j = 0; j < num_results; j++) {
+                if (bits.at(j))
+                    num_true.at(j)++;
+                else if (!first_false.at(j))
+                    first_false.at(j) = log.pos(i);
+            }
+        }
+    }
+    if (!summary)
+        return;
+
+    spdlog::info("# of records:\t{}", log.size());
+    for (size_t j = 0; j < num_results; j++) {
+        std::cout << num_true.at(j) << "/" << log.size() << " ";
+        if (first_false.at(j))
+            std::cout << *first_false.at(j);
+        else
+            std::cout << "-";
+        std::cout << "\n";
+    }
+}
+
+void do_dec(const std::string& skey_filename, const std::string& input_filename,
+            const std::optional<size_t>& num_packed, bool summary)
 {
     auto skey = read_from_archive<SecretKey>(skey_filename);
+    if (ResultLogFile::is_result_log(input_filename)) {
+        do_dec_log(skey, input_filename, summary);
+        return;
+    }
+    if (summary)
+        error_die("--summary is only for result logs");
+    if (num_packed) {
+        auto enc_res = read_from_archive<TRLWELvl1>(input_filename);
+        for (bool res : decrypt_TRLWELvl1_to_bits(enc_res, *num_packed, skey))
+            print_result(res);
+        return;
+    }
     auto enc_res = read_from_archive<TLWELvl1>(input_filename);
     bool res = decrypt_TLWELvl1_to_bit(enc_res, skey);
     print_result(res);
 }
 
+// Run the translations concurrently in child processes, since Spot is not
+// thread-safe, and return the minimized graph with the fewest states (or
+// states per layer) among those that finished within time_budget seconds.
+Graph run_ltl2spec_portfolio(const std::string& fml, size_t num_vars,
+                             bool make_all_live_states_final,
+                             const std::vector<LTLTranslation>& translations,
+                             size_t time_budget, bool per_layer)
+{
+    struct Child {
+        LTLTranslation translation;
+        pid_t pid;
+        int fd;
+        bool eof;
+        std::string out;
+    };
+    std::vector<Child> children;
+    for (auto&& translation : translations) {
+        int fds[2];
+        if (pipe(fds) != 0)
+            error_die("pipe() failed: {}", errno);
+        pid_t pid = fork();
+        if (pid < 0)
+            error_die("fork() failed: {}", errno);
+        if (pid == 0) {  // Child
+            close(fds[0]);
+            std::stringstream ss;
+            Graph::from_ltl_formula(fml, num_vars, make_all_live_states_final,
+                                    translation)
+                .minimized()
+                .dump(ss);
+            const std::string out = ss.str();
+            for (size_t i = 0; i < out.size();) {
+                ssize_t n = write(fds[1], out.data() + i, out.size() - i);
+                if (n <= 0)
+                    _exit(1);
+                i += n;
+            }
+            _exit(0);
+        }
+        close(fds[1]);
+        children.push_back({translation, pid, fds[0], false, ""});
+    }
+
+    auto deadline =
+        std::chrono::steady_clock::now() + std::chrono::seconds(time_budget);
+    while (true) {
+        std::vector<pollfd> pfds;
+        std::vector<Child*> polled;
+        for (Child& c : children) {
+            if (c.eof)
+                continue;
+            pfds.push_back({c.fd, POLLIN, 0});
+            polled.push_back(&c);
+        }
+        auto rest = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        deadline - std::chrono::steady_clock::now())
+                        .count();
+        if (pfds.empty() || rest <= 0)
+            break;
+        if (poll(pfds.data(), pfds.size(), rest) < 0 && errno != EINTR)
+            error_die("poll() failed: {}", errno);
+        for (size_t i = 0; i < pfds.size(); i++) {
+            if (pfds.at(i).revents == 0)
+                continue;
+            Child& c = *polled.at(i);
+            char buf[4096];
+            ssize_t n = read(c.fd, buf, sizeof(buf));
+            if (n > 0)
+                c.out.append(buf, n);
+            else
+                c.eof = true;
+        }
+    }
+
+    std::optional<Graph> best;
+    size_t best_cost = 0;
+    for (Child& c : children) {
+        if (!c.eof)
+            kill(c.pid, SIGKILL);
+        close(c.fd);
+        int status;
+        waitpid(c.pid, &status, 0);
+
+        const std::string name = c.translation.str();
+        if (!c.eof) {
+            spdlog::info("{}:\ttimed out", name);
+            continue;
+        }
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            spdlog::info("{}:\tfailed", name);
+            continue;
+        }
+
+        std::istringstream iss{c.out};
+        Graph gr = Graph::from_istream(iss);
+        size_t cost = gr.size();
+        if (per_layer) {
+            // All the candidates have the same # of layers, so compare the
+            // sums instead of the averages
+            cost = 0;
+            for (auto&& layer : gr.states_at_phase(num_vars))
+                cost += layer.size();
+        }
+        spdlog::info("{}:\t{} states\t(cost {})", name, gr.size(), cost);
+        if (!best || cost < best_cost) {
+            best.emplace(std::move(gr));
+            best_cost = cost;
+        }
+    }
+
+    if (!best)
+        error_die("No translation finished within {} seconds", time_budget);
+    return *best;
+}
+
 void do_ltl2spec(const std::string& fml, size_t num_vars,
-                 bool make_all_live_states_final)
+                 bool make_all_live_states_final,
+                 const std::optional<std::string>& ap_order_filename,
+                 const std::vector<std::string>& portfolio, size_t time_budget,
+                 bool per_layer)
 {
-    Graph gr =
-        Graph::from_ltl_formula(fml, num_vars, make_all_live_states_final);
+    std::vector<LTLTranslation> translations;
+    for (auto&& src : portfolio)
+        translations.push_back(LTLTranslation::parse(src));
+
+    Graph gr = translations.empty()
+                   ? Graph::from_ltl_formula_direct(fml, num_vars,
+                                                    make_all_live_states_final)
+                   : run_ltl2spec_portfolio(fml, num_vars,
+                                            make_all_live_states_final,
+                                            translations, time_budget,
+                                            per_layer);
+    if (ap_order_filename) {
+        auto [opt, order] = optimize_ap_order(gr, num_vars);
+        spdlog::info("# of states:\t{} -> {}", gr.size(), opt.size());
+        spdlog::info("AP order:\t{}", fmt::join(order, " "));
+        write_ap_order(*ap_order_filename, order);
+        gr = std::move(opt);
+    }
     gr.dump(std::cout);
 }
 
+// Write a spec for each operand of the top-level conjunction of fml. Running
+// them over the same input and taking AND of the results needs Σ|Qi| CMUXes
+// per input instead of Π|Qi|. Note that the monitor of each operand reports
+// only its own violation, so the combined verdict may turn false later than
+// the monitor of fml, e.g., for G p0 & G !p0.
+void do_ltl2spec_split(const std::string& fml, size_t num_vars,
+                       bool make_all_live_states_final,
+                       const std::string& output_dirname)
+{
+    std::vector<std::string> conjuncts = split_ltl_conjunction(fml);
+
+    std::filesystem::create_directory(output_dirname);
+    size_t sum_size = 0;
+    for (size_t i = 0; i < conjuncts.size(); i++) {
+        Graph gr = Graph::from_ltl_formula_direct(
+            conjuncts.at(i), num_vars, make_all_live_states_final);
+        sum_size += gr.size();
+        spdlog::info("{}.spec:\t{} states\t{}", i, gr.size(), conjuncts.at(i));
+
+        std::ofstream ofs{
+            concat_paths(output_dirname, fmt::format("{}.spec", i))};
+        assert(ofs);
+        gr.dump(ofs);
+    }
+    spdlog::info("Total # of states:\t{}", sum_size);
+}
+
 void do_spec2spec(const std::optional<std::string>& spec_filename_opt,
                   bool minimized, bool reversed, bool negated)
 {
@@ -487,13 +1203,61 @@ void do_spec2spec(const std::optional<std::string>& spec_filename_opt,
                                     : Graph::from_file(spec_filename);
     if (negated)
         gr = gr.negated();
-    if (reversed)
+    if (reversed && minimized)
+        gr = gr.reversed_minimized();
+    else if (reversed)
         gr = gr.reversed();
-    if (minimized)
+    else if (minimized)
         gr = gr.minimized();
     gr.dump(std::cout);
 }
 
+void do_spec2product(const std::vector<std::string>& spec_filenames,
+                     bool minimized,
+                     const std::optional<std::string>& output_dir)
+{
+    std::vector<Graph> components;
+    size_t sum_size = 0, prod_size = 1;
+    bool prod_size_overflow = false;
+    for (auto&& spec_filename : spec_filenames) {
+        Graph gr = Graph::from_file(spec_filename);
+        if (minimized)
+            gr = gr.minimized();
+        sum_size += gr.size();
+        if (prod_size > std::numeric_limits<size_t>::max() / gr.size())
+            prod_size_overflow = true;
+        else
+            prod_size *= gr.size();
+        components.push_back(std::move(gr));
+    }
+
+    auto [prod, comp_final_sts] = Graph::product(components, minimized);
+
+    spdlog::info("Product size:");
+    spdlog::info("\tSum of # of states of components:\t{}", sum_size);
+    if (prod_size_overflow)
+        spdlog::info("\tUpper bound of # of states of product:\toverflow");
+    else
+        spdlog::info("\tUpper bound of # of states of product:\t{}",
+                     prod_size);
+    spdlog::info("\t# of states of product:\t{}", prod.size());
+    spdlog::info("");
+
+    prod.dump(std::cout);
+
+    // Write the product with the final states of each component, so that each
+    // component can be run over the same structure.
+    if (output_dir) {
+        std::filesystem::create_directory(*output_dir);
+        for (size_t i = 0; i < components.size(); i++) {
+            std::ofstream ofs{
+                concat_paths(*output_dir, fmt::format("{}.spec", i))};
+            assert(ofs);
+            prod.with_final_states(comp_final_sts.at(i)).dump(ofs);
+        }
+    }
+}
+
 void do_spec2dot(const std::optional<std::string>& spec_filename_opt)
 {
     std::string spec_filename = spec_filename_opt.value_or("-");
@@ -534,6 +1298,48 @@ void do_run_dfa_plain(const std::string& spec_filename,
     print_result(res);
 }
 
+void do_run_dfa_plain_batch(const std::string& spec_filename,
+                            const std::vector<std::string>& input_filenames,
+                            size_t num_ap, std::optional<size_t> output_freq)
+{
+    Graph gr = Graph::from_file(spec_filename);
+    BatchPlainDFARunner runner{gr};
+
+    std::vector<BatchPlainDFARunner::Trace> traces(input_filenames.size());
+    for (size_t i = 0; i < input_filenames.size(); i++)
+        each_input_bit(input_filenames.at(i), num_ap,
+                       [&](bool b) { traces.at(i).push_back(b); });
+
+    spdlog::info("Parameter:");
+    spdlog::info("\tMode:\t{}", "Batched plain DFA runner");
+    spdlog::info("\tState size:\t{}", gr.size());
+    spdlog::info("\tNumber of traces:\t{}", traces.size());
+    spdlog::info("\tNumber of SIMD lanes:\t{}",
+                 BatchPlainDFARunner::num_lanes());
+    if (output_freq)
+        spdlog::info("\tOutput frequency:\t{}", *output_freq);
+    spdlog::info("");
+
+    // Each line: trace file, verdict for the whole trace, and (if output
+    // frequency is specified) verdicts at each output position
+    if (output_freq) {
+        auto verdicts = runner.run(traces, *output_freq);
+        for (size_t i = 0; i < traces.size(); i++) {
+            std::stringstream ss;
+            for (bool res : verdicts.at(i))
+                ss << res;
+            std::cout << input_filenames.at(i) << "\t"
+                      << verdicts.at(i).back() << "\t" << ss.str() << "\n";
+        }
+    }
+    else {
+        auto verdicts = runner.run(traces);
+        for (size_t i = 0; i < traces.size(); i++)
+            std::cout << input_filenames.at(i) << "\t" << verdicts.at(i)
+                      << "\n";
+    }
+}
+
 void dumpBasicInfo(int argc, char** argv)
 {
     spdlog::info(R"(===================================)");
@@ -607,6 +1413,7 @@ int main(int argc, char** argv)
         register_block(*run, args, false);
         register_flut(*run, args, false);
         register_plain(*run, args, false);
+        register_plain_batch(*run, args);
     }
     {
         CLI::App* ltl2spec = app.add_subcommand(
@@ -614,6 +1421,25 @@ int main(int argc, char** argv)
         ltl2spec->parse_complete_callback([&] { args.type = TYPE::LTL2SPEC; });
         ltl2spec->add_flag("--make-all-live-states-final",
                            args.make_all_live_states_final);
+        ltl2spec->add_flag("--split-conjunction", args.split_conjunction);
+        ltl2spec->add_option("--out-dir", args.output_dir);
+        ltl2spec->add_option(
+            "--optimize-ap-order", args.ap_order,
+            "Reorder APs to make the spec smaller and write the order to the "
+            "file, which must be given to enc --ap-order");
+        ltl2spec
+            ->add_option("--portfolio", args.portfolio,
+                         "Try comma-separated translations (e.g. "
+                         "nfa:any:high,direct:small:low) concurrently and "
+                         "keep the smallest result")
+            ->delimiter(',')
+            ->expected(1);
+        ltl2spec
+            ->add_option("--time-budget", args.time_budget,
+                         "Time budget for --portfolio in seconds (default: 60)")
+            ->check(CLI::PositiveNumber);
+        ltl2spec->add_flag("--per-layer", args.per_layer,
+                           "Compare # of states per layer in --portfolio");
         ltl2spec->add_option("formula", args.formula)->required();
         ltl2spec->add_option("#vars", args.num_vars)->required();
     }
@@ -627,6 +1453,17 @@ int main(int argc, char** argv)
         spec2spec->add_flag("--negated", args.negated);
         spec2spec->add_option("SPEC-FILE", args.spec);
     }
+    {
+        CLI::App* spec2product = app.add_subcommand(
+            "spec2product", "Build product of specs for HomFA");
+        spec2product->parse_complete_callback(
+            [&] { args.type = TYPE::SPEC2PRODUCT; });
+        spec2product->add_flag("--minimized", args.minimized);
+        spec2product->add_option("--out-dir", args.output_dir);
+        spec2product->add_option("SPEC-FILE", args.specs)
+            ->required()
+            ->check(CLI::ExistingFile);
+    }
     {
         CLI::App* spec2dot = app.add_subcommand(
             "spec2dot", "Convert spec format for HomFA to dot script");
@@ -666,52 +1503,62 @@ int main(int argc, char** argv)
         break;
 
     case TYPE::GENBKEY:
-        do_genbkey(args.skey.value(), args.output.value());
+        do_genbkey(args.skey.value(), args.output.value(), args.unrolled);
         break;
 
     case TYPE::ENC:
+        if (args.seeded && args.packed_trlwe)
+            error_die("--seeded cannot be used with --packed-trlwe");
         do_enc(args.skey.value(), args.input.value(), args.output.value(),
-               args.num_ap.value());
+               args.num_ap.value(), args.ap_order, args.seeded,
+               args.packed_trlwe, args.append, args.records_per_chunk);
         break;
 
     case TYPE::DEC:
-        do_dec(args.skey.value(), args.input.value());
+        do_dec(args.skey.value(), args.input.value(), args.num_packed,
+               args.summary);
         break;
 
     case TYPE::RUN_OFFLINE:
-        do_run_offline(args.spec.value(), args.input.value(),
-                       args.output.value(), args.bootstrapping_freq.value(),
-                       args.bkey.value(), args.sanitize_result);
+        do_run_offline(args.specs, args.input.value(), args.output.value(),
+                       args.bootstrapping_freq.value(), args.bkey.value(),
+                       args.packed, args.sanitize_result);
         break;
 
     case TYPE::RUN_REVERSE:
-        if (!((args.output && !args.output_dir) ||
-              (!args.output && args.output_dir)))
-            error_die("Use --out or --out-dir");
-        do_run_reverse(args.spec.value(), args.input.value(), args.output,
-                       args.output_dir, args.output_freq.value(),
+        if (args.num_ap) {
+            if (args.packed)
+                error_die("--packed cannot be used with --ap");
+            if (args.reduced_precision)
+                error_die("--reduced-precision cannot be used with --ap");
+            do_run_reverse_letter(
+                args.specs, args.input.value(), output_options_of(args),
+                args.bootstrapping_freq.value(), args.is_spec_reversed,
+                args.bkey.value(), args.num_ap.value(), args.follow,
+                args.sanitize_result);
+            break;
+        }
+        do_run_reverse(args.specs, args.input.value(), output_options_of(args),
                        args.bootstrapping_freq.value(), args.is_spec_reversed,
-                       args.bkey.value(), args.sanitize_result);
+                       args.bkey.value(), args.packed,
+                       args.reduced_precision, args.debug_skey, args.follow,
+                       args.sanitize_result);
         break;
 
     case TYPE::RUN_BLOCK:
-        if (!((args.output && !args.output_dir) ||
-              (!args.output && args.output_dir)))
-            error_die("Use --out or --out-dir");
-        do_run_block(args.spec.value(), args.input.value(), args.output.value(),
+        if (!args.output)
+            error_die("Use --out");
+        do_run_block(args.specs, args.input.value(), args.output.value(),
                      args.queue_size.value(), args.bkey.value(),
+                     args.num_ap.value_or(1), args.follow,
                      args.sanitize_result);
         break;
 
     case TYPE::RUN_FLUT:
-        if (!((args.output && !args.output_dir) ||
-              (!args.output && args.output_dir)))
-            error_die("Use --out or --out-dir");
-        do_run_flut(args.spec.value(), args.input.value(), args.output,
-                    args.output_dir, args.output_freq.value(),
+        do_run_flut(args.specs, args.input.value(), output_options_of(args),
                     args.queue_size.value(), args.bootstrapping_freq.value(),
                     args.bkey.value(), args.max_second_lut_depth.value(),
-                    args.debug_skey, args.sanitize_result);
+                    args.debug_skey, args.follow, args.sanitize_result);
         break;
 
     case TYPE::RUN_PLAIN:
@@ -719,15 +1566,43 @@ int main(int argc, char** argv)
                          args.num_ap.value());
         break;
 
+    case TYPE::RUN_PLAIN_BATCH:
+        do_run_dfa_plain_batch(args.spec.value(), args.inputs,
+                               args.num_ap.value(), args.output_freq);
+        break;
+
     case TYPE::LTL2SPEC:
-        do_ltl2spec(args.formula.value(), args.num_vars.value(),
-                    args.make_all_live_states_final);
+        if (args.split_conjunction) {
+            if (!args.output_dir)
+                error_die("Use --out-dir with --split-conjunction");
+            if (args.ap_order)
+                error_die(
+                    "--optimize-ap-order cannot be used with "
+                    "--split-conjunction");
+            if (!args.portfolio.empty() || args.time_budget || args.per_layer)
+                error_die(
+                    "--portfolio, --time-budget, and --per-layer cannot be "
+                    "used with --split-conjunction");
+            do_ltl2spec_split(args.formula.value(), args.num_vars.value(),
+                              args.make_all_live_states_final,
+                              args.output_dir.value());
+        }
+        else {
+            do_ltl2spec(args.formula.value(), args.num_vars.value(),
+                        args.make_all_live_states_final, args.ap_order,
+                        args.portfolio, args.time_budget.value_or(60),
+                        args.per_layer);
+        }
         break;
 
     case TYPE::SPEC2SPEC:
         do_spec2spec(args.spec, args.minimized, args.reversed, args.negated);
         break;
 
+    case TYPE::SPEC2PRODUCT:
+        do_spec2product(args.specs, args.minimized, args.output_dir);
+        break;
+
     case TYPE::SPEC2DOT:
         do_spec2dot(args.spec);
         break;
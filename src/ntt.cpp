@@ -0,0 +1,449 @@
+#include "ntt.hpp"
+#include "tfhepp_util.hpp"
+
+#include <cassert>
+
+#ifdef __AVX512IFMA__
+#include <immintrin.h>
+#endif
+
+namespace {
+__extension__ typedef unsigned __int128 u128;
+
+constexpr size_t N = Lvl1::n;
+// Prime such that P = 1 (mod 2N). The coefficients of an external product
+// are less than 2l N (Bg / 2) 2^31 in absolute value, so they are determined
+// by their residues modulo P.
+constexpr uint64_t P = 0x3ffffffffc001;
+static_assert(P % (2 * N) == 1);
+static_assert(P > 2 * (2 * Lvl1::l * N * (Lvl1::Bg / 2) * (1ul << 31)));
+
+// Shoup's and Montgomery's multiplications below work on 52-bit words, the
+// width of AVX-512 IFMA, so that the scalar and vector code share the
+// tables and the Montgomery form of TRGSWLvl1NTT. Since 4P < 2^52, the
+// vector code reduces the values lazily below 4P.
+constexpr unsigned W = 52;
+constexpr uint64_t MASK = (1ul << W) - 1;
+static_assert(4 * P < (1ul << W));
+
+// -P^{-1} mod 2^W by Newton's method
+constexpr uint64_t neg_inv_p()
+{
+    uint64_t inv = 1;
+    for (size_t i = 0; i < 6; i++)
+        inv *= 2 - P * inv;
+    return -inv & MASK;
+}
+constexpr uint64_t P_NEG_INV = neg_inv_p();
+static_assert((P * P_NEG_INV & MASK) == MASK);
+
+uint64_t add_mod(uint64_t a, uint64_t b)
+{
+    uint64_t c = a + b;
+    return c >= P ? c - P : c;
+}
+
+uint64_t sub_mod(uint64_t a, uint64_t b)
+{
+    return a >= b ? a - b : a + P - b;
+}
+
+uint64_t mul_mod(uint64_t a, uint64_t b)
+{
+    return static_cast<uint64_t>(u128{a} * b % P);
+}
+
+uint64_t pow_mod(uint64_t a, uint64_t e)
+{
+    uint64_t ret = 1;
+    for (; e != 0; e >>= 1, a = mul_mod(a, a))
+        if (e & 1)
+            ret = mul_mod(ret, a);
+    return ret;
+}
+
+// a w mod P for a < 2^W and a constant w, where w_shoup = floor(w 2^W / P)
+uint64_t mul_shoup(uint64_t a, uint64_t w, uint64_t w_shoup)
+{
+    uint64_t q = static_cast<uint64_t>((u128{a} * w_shoup) >> W),
+             r = a * w - q * P;  // in [0, 2P)
+    return r >= P ? r - P : r;
+}
+
+uint64_t shoup(uint64_t w)
+{
+    return static_cast<uint64_t>((u128{w} << W) / P);
+}
+
+// t R^{-1} mod P for t < 6P^2, where R = 2^W
+uint64_t mont_reduce(u128 t)
+{
+    uint64_t m = static_cast<uint64_t>(t) * P_NEG_INV & MASK,
+             u = static_cast<uint64_t>((t + u128{m} * P) >> W);  // < 2.5P
+    u = u >= 2 * P ? u - 2 * P : u;
+    return u >= P ? u - P : u;
+}
+
+size_t bit_reverse(size_t k)
+{
+    size_t ret = 0;
+    for (size_t i = 0; i < Lvl1::nbit; i++)
+        ret |= ((k >> i) & 1) << (Lvl1::nbit - 1 - i);
+    return ret;
+}
+
+// The vector code runs the last three stages of ntt, where the butterflies
+// are less than 8 coefficients apart, on blocks of 16 coefficients. The
+// block is split into lanes x and y of the butterflies (lane_x) and joined
+// back (lane_join).
+constexpr size_t NUM_TAIL_STAGES = 3;
+
+size_t lane_x(size_t t, size_t k)
+{
+    return k / t * 2 * t + k % t;
+}
+
+size_t lane_join(size_t t, size_t p)
+{
+    size_t k = p / (2 * t) * t + p % t;
+    return p % (2 * t) < t ? k : k + 8;
+}
+
+struct NTTTable {
+    // Powers of the primitive 2N-th root of unity psi in bit-reversed order,
+    // i.e., psi.at(k) = psi^{bit_reverse(k)}, and those of psi^{-1}
+    std::array<uint64_t, N> psi, psi_shoup, psi_inv, psi_inv_shoup;
+    // Same as above, but for the butterflies of the tail stages (of distance
+    // t = 2^s for tail.at(s)) in the order the vector code processes them
+    std::array<std::array<uint64_t, N / 2>, NUM_TAIL_STAGES> tail, tail_shoup,
+        tail_inv, tail_inv_shoup;
+    uint64_t n_inv, n_inv_shoup, r2;
+
+    NTTTable()
+    {
+        uint64_t root = 0;
+        for (uint64_t g = 2; root == 0; g++) {
+            uint64_t cand = pow_mod(g, (P - 1) / (2 * N));
+            if (pow_mod(cand, N) == P - 1)
+                root = cand;
+        }
+        uint64_t root_inv = pow_mod(root, P - 2);
+        for (size_t k = 0; k < N; k++) {
+            psi.at(k) = pow_mod(root, bit_reverse(k));
+            psi_shoup.at(k) = shoup(psi.at(k));
+            psi_inv.at(k) = pow_mod(root_inv, bit_reverse(k));
+            psi_inv_shoup.at(k) = shoup(psi_inv.at(k));
+        }
+        for (size_t s = 0; s < NUM_TAIL_STAGES; s++) {
+            const size_t t = 1 << s, m = N / (2 * t);
+            for (size_t b = 0; b < N / 2; b++) {
+                size_t i = (b / 8 * 16 + lane_x(t, b % 8)) / (2 * t);
+                tail.at(s).at(b) = psi.at(m + i);
+                tail_shoup.at(s).at(b) = psi_shoup.at(m + i);
+                tail_inv.at(s).at(b) = psi_inv.at(m + i);
+                tail_inv_shoup.at(s).at(b) = psi_inv_shoup.at(m + i);
+            }
+        }
+        n_inv = pow_mod(N, P - 2);
+        n_inv_shoup = shoup(n_inv);
+        uint64_t r = (1ul << W) % P;
+        r2 = mul_mod(r, r);
+    }
+};
+
+const NTTTable& table()
+{
+    static const NTTTable tbl;
+    return tbl;
+}
+
+#ifdef __AVX512IFMA__
+////////// AVX-512 IFMA
+
+__m512i reduce_lazy(__m512i a, __m512i p)
+{
+    return _mm512_min_epu64(a, _mm512_sub_epi64(a, p));
+}
+
+// a w mod P in [0, 2P) for a < 2^W
+__m512i mul_shoup_lazy(__m512i a, __m512i w, __m512i w_shoup)
+{
+    const __m512i zero = _mm512_setzero_si512();
+    __m512i q = _mm512_madd52hi_epu64(zero, a, w_shoup),
+            aw = _mm512_madd52lo_epu64(zero, a, w),
+            qp = _mm512_madd52lo_epu64(zero, q, _mm512_set1_epi64(P));
+    return _mm512_and_si512(_mm512_sub_epi64(aw, qp), _mm512_set1_epi64(MASK));
+}
+
+// Cooley-Tukey butterfly for x, y < 4P
+void butterfly_ct(__m512i& x, __m512i& y, __m512i w, __m512i w_shoup)
+{
+    const __m512i p2 = _mm512_set1_epi64(2 * P);
+    __m512i u = reduce_lazy(x, p2), v = mul_shoup_lazy(y, w, w_shoup);
+    x = _mm512_add_epi64(u, v);
+    y = _mm512_add_epi64(_mm512_sub_epi64(u, v), p2);
+}
+
+// Gentleman-Sande butterfly for x, y < 2P
+void butterfly_gs(__m512i& x, __m512i& y, __m512i w, __m512i w_shoup)
+{
+    const __m512i p2 = _mm512_set1_epi64(2 * P);
+    __m512i u = x, v = y;
+    x = reduce_lazy(_mm512_add_epi64(u, v), p2);
+    y = mul_shoup_lazy(_mm512_add_epi64(_mm512_sub_epi64(u, v), p2), w,
+                       w_shoup);
+}
+
+using Butterfly = void (*)(__m512i&, __m512i&, __m512i, __m512i);
+
+template <Butterfly butterfly>
+void stage_wide(PolyLvl1NTT& a, size_t m, size_t t, const uint64_t* w,
+                const uint64_t* w_shoup)
+{
+    for (size_t i = 0; i < m; i++) {
+        const __m512i wv = _mm512_set1_epi64(w[m + i]),
+                      wsv = _mm512_set1_epi64(w_shoup[m + i]);
+        for (size_t j = 2 * i * t; j < 2 * i * t + t; j += 8) {
+            __m512i x = _mm512_loadu_si512(&a[j]),
+                    y = _mm512_loadu_si512(&a[j + t]);
+            butterfly(x, y, wv, wsv);
+            _mm512_storeu_si512(&a[j], x);
+            _mm512_storeu_si512(&a[j + t], y);
+        }
+    }
+}
+
+template <Butterfly butterfly>
+void stage_tail(PolyLvl1NTT& a, size_t s, const uint64_t* w,
+                const uint64_t* w_shoup)
+{
+    const size_t t = 1 << s;
+    alignas(64) uint64_t ix[8], iy[8], i0[8], i1[8];
+    for (size_t k = 0; k < 8; k++) {
+        ix[k] = lane_x(t, k);
+        iy[k] = lane_x(t, k) + t;
+        i0[k] = lane_join(t, k);
+        i1[k] = lane_join(t, k + 8);
+    }
+    const __m512i vix = _mm512_load_si512(ix), viy = _mm512_load_si512(iy),
+                  vi0 = _mm512_load_si512(i0), vi1 = _mm512_load_si512(i1);
+    for (size_t b = 0; b < N; b += 16) {
+        __m512i v0 = _mm512_loadu_si512(&a[b]),
+                v1 = _mm512_loadu_si512(&a[b + 8]),
+                x = _mm512_permutex2var_epi64(v0, vix, v1),
+                y = _mm512_permutex2var_epi64(v0, viy, v1);
+        butterfly(x, y, _mm512_loadu_si512(&w[b / 2]),
+                  _mm512_loadu_si512(&w_shoup[b / 2]));
+        _mm512_storeu_si512(&a[b], _mm512_permutex2var_epi64(x, vi0, y));
+        _mm512_storeu_si512(&a[b + 8], _mm512_permutex2var_epi64(x, vi1, y));
+    }
+}
+
+void ntt(PolyLvl1NTT& a)
+{
+    const NTTTable& tbl = table();
+    size_t m = 1, t = N / 2;
+    for (; t >= 8; m <<= 1, t >>= 1)
+        stage_wide<butterfly_ct>(a, m, t, tbl.psi.data(),
+                                 tbl.psi_shoup.data());
+    for (size_t s = NUM_TAIL_STAGES; s-- > 0;)
+        stage_tail<butterfly_ct>(a, s, tbl.tail.at(s).data(),
+                                 tbl.tail_shoup.at(s).data());
+    const __m512i p = _mm512_set1_epi64(P), p2 = _mm512_set1_epi64(2 * P);
+    for (size_t j = 0; j < N; j += 8) {
+        __m512i x = _mm512_loadu_si512(&a[j]);
+        _mm512_storeu_si512(&a[j], reduce_lazy(reduce_lazy(x, p2), p));
+    }
+}
+
+void intt(PolyLvl1NTT& a)
+{
+    const NTTTable& tbl = table();
+    for (size_t s = 0; s < NUM_TAIL_STAGES; s++)
+        stage_tail<butterfly_gs>(a, s, tbl.tail_inv.at(s).data(),
+                                 tbl.tail_inv_shoup.at(s).data());
+    for (size_t h = N / 16, t = 8; h >= 1; h >>= 1, t <<= 1)
+        stage_wide<butterfly_gs>(a, h, t, tbl.psi_inv.data(),
+                                 tbl.psi_inv_shoup.data());
+    const __m512i p = _mm512_set1_epi64(P),
+                  n_inv = _mm512_set1_epi64(tbl.n_inv),
+                  n_inv_shoup = _mm512_set1_epi64(tbl.n_inv_shoup);
+    for (size_t j = 0; j < N; j += 8) {
+        __m512i x = _mm512_loadu_si512(&a[j]);
+        x = mul_shoup_lazy(x, n_inv, n_inv_shoup);
+        _mm512_storeu_si512(&a[j], reduce_lazy(x, p));
+    }
+}
+
+#else
+////////// Scalar
+
+// Negacyclic NTT by Cooley-Tukey butterflies. The output is in bit-reversed
+// order.
+void ntt(PolyLvl1NTT& a)
+{
+    const NTTTable& tbl = table();
+    for (size_t m = 1, t = N / 2; m < N; m <<= 1, t >>= 1) {
+        for (size_t i = 0; i < m; i++) {
+            const uint64_t w = tbl.psi.at(m + i), ws = tbl.psi_shoup.at(m + i);
+            for (size_t j = 2 * i * t; j < 2 * i * t + t; j++) {
+                uint64_t u = a[j], v = mul_shoup(a[j + t], w, ws);
+                a[j] = add_mod(u, v);
+                a[j + t] = sub_mod(u, v);
+            }
+        }
+    }
+}
+
+// Inverse of ntt by Gentleman-Sande butterflies
+void intt(PolyLvl1NTT& a)
+{
+    const NTTTable& tbl = table();
+    for (size_t h = N / 2, t = 1; h >= 1; h >>= 1, t <<= 1) {
+        for (size_t i = 0; i < h; i++) {
+            const uint64_t w = tbl.psi_inv.at(h + i),
+                           ws = tbl.psi_inv_shoup.at(h + i);
+            for (size_t j = 2 * i * t; j < 2 * i * t + t; j++) {
+                uint64_t u = a[j], v = a[j + t];
+                a[j] = add_mod(u, v);
+                a[j + t] = mul_shoup(sub_mod(u, v), w, ws);
+            }
+        }
+    }
+    for (size_t j = 0; j < N; j++)
+        a[j] = mul_shoup(a[j], tbl.n_inv, tbl.n_inv_shoup);
+}
+#endif
+
+// Product of the coefficients of a polynomial in the NTT domain and one in
+// Montgomery form, accumulated without reduction. A product d s is split
+// into lo = d s mod 2^W and hi = floor(d s / 2^W), as IFMA computes them.
+struct PolyLvl1NTTAcc {
+    std::array<uint64_t, N> lo, hi;
+};
+
+void mult_add(PolyLvl1NTTAcc& acc, const PolyLvl1NTT& d, const PolyLvl1NTT& s)
+{
+#ifdef __AVX512IFMA__
+    for (size_t j = 0; j < N; j += 8) {
+        __m512i dv = _mm512_loadu_si512(&d[j]),
+                sv = _mm512_loadu_si512(&s[j]),
+                lo = _mm512_loadu_si512(&acc.lo[j]),
+                hi = _mm512_loadu_si512(&acc.hi[j]);
+        _mm512_storeu_si512(&acc.lo[j], _mm512_madd52lo_epu64(lo, dv, sv));
+        _mm512_storeu_si512(&acc.hi[j], _mm512_madd52hi_epu64(hi, dv, sv));
+    }
+#else
+    for (size_t j = 0; j < N; j++) {
+        u128 prod = u128{d[j]} * s[j];
+        acc.lo[j] += static_cast<uint64_t>(prod) & MASK;
+        acc.hi[j] += static_cast<uint64_t>(prod >> W);
+    }
+#endif
+}
+
+void mont_reduce(PolyLvl1NTT& out, const PolyLvl1NTTAcc& acc)
+{
+#ifdef __AVX512IFMA__
+    const __m512i zero = _mm512_setzero_si512(), p = _mm512_set1_epi64(P),
+                  p2 = _mm512_set1_epi64(2 * P),
+                  neg_inv_p = _mm512_set1_epi64(P_NEG_INV),
+                  mask = _mm512_set1_epi64(MASK);
+    for (size_t j = 0; j < N; j += 8) {
+        __m512i lo = _mm512_loadu_si512(&acc.lo[j]),
+                hi = _mm512_loadu_si512(&acc.hi[j]);
+        hi = _mm512_add_epi64(hi, _mm512_srli_epi64(lo, W));
+        lo = _mm512_and_si512(lo, mask);
+        // lo + (m P mod 2^W) is either 0 or 2^W
+        __m512i m = _mm512_madd52lo_epu64(zero, lo, neg_inv_p),
+                carry = _mm512_srli_epi64(
+                    _mm512_madd52lo_epu64(lo, m, p), W),
+                u = _mm512_add_epi64(_mm512_madd52hi_epu64(hi, m, p), carry);
+        _mm512_storeu_si512(&out[j], reduce_lazy(reduce_lazy(u, p2), p));
+    }
+#else
+    for (size_t j = 0; j < N; j++)
+        out[j] = mont_reduce((u128{acc.hi[j]} << W) + acc.lo[j]);
+#endif
+}
+
+// Regard the coefficients of src as signed
+void poly_to_ntt(PolyLvl1NTT& out, const PolyLvl1& src)
+{
+    for (size_t j = 0; j < N; j++) {
+        int32_t c = src[j];
+        out[j] = c < 0 ? P - static_cast<uint64_t>(-static_cast<int64_t>(c))
+                       : static_cast<uint64_t>(c);
+    }
+    ntt(out);
+}
+
+// Add the result to out
+void add_ntt_to_poly(PolyLvl1& out, PolyLvl1NTT& src)
+{
+    intt(src);
+    for (size_t j = 0; j < N; j++) {
+        // Take the representative in (-P/2, P/2]
+        uint64_t c = src[j];
+        out[j] += c > P / 2 ? static_cast<uint32_t>(c - P)
+                            : static_cast<uint32_t>(c);
+    }
+}
+}  // namespace
+
+TRGSWLvl1NTT TRGSWLvl1FFT_to_NTT(const TRGSWLvl1FFT& src)
+{
+    const NTTTable& tbl = table();
+    TRGSWLvl1NTT ret;
+    PolyLvl1 poly;
+    for (size_t row = 0; row < 2 * Lvl1::l; row++) {
+        for (size_t c = 0; c < 2; c++) {
+            TFHEpp::TwistFFT<Lvl1>(poly, src[row][c]);
+            PolyLvl1NTT& out = ret[row][c];
+            poly_to_ntt(out, poly);
+            for (size_t j = 0; j < N; j++)
+                out[j] = mont_reduce(u128{out[j]} * tbl.r2);
+        }
+    }
+    return ret;
+}
+
+void CMUXNTTLvl1_tile(const TRGSWLvl1NTT& sel, size_t size,
+                      TRLWELvl1* const out[], const TRLWELvl1* const in1[],
+                      const TRLWELvl1* const in0[])
+{
+    assert(size <= CMUX_MAX_TILE_SIZE);
+    constexpr size_t l = Lvl1::l;
+
+    // decntt.at(t)[row] is the NTT of the row-th decomposed polynomial of
+    // *in1[t] - *in0[t]
+    std::vector<std::array<PolyLvl1NTT, 2 * l>> decntt(size);
+    TFHEpp::DecomposedPolynomial<Lvl1> decpoly;
+    for (size_t t = 0; t < size; t++) {
+        for (size_t k = 0; k < 2; k++) {
+            PolyLvl1 diff;
+            for (size_t j = 0; j < N; j++)
+                diff[j] = (*in1[t])[k][j] - (*in0[t])[k][j];
+            TFHEpp::Decomposition<Lvl1>(decpoly, diff);
+            for (size_t i = 0; i < l; i++)
+                poly_to_ntt(decntt.at(t)[k * l + i], decpoly[i]);
+        }
+    }
+
+    // Accumulate the products without reduction, with the rows of sel in the
+    // outer loop as CMUXFFTLvl1_tile does
+    std::vector<std::array<PolyLvl1NTTAcc, 2>> acc(size);
+    for (size_t row = 0; row < 2 * l; row++)
+        for (size_t t = 0; t < size; t++)
+            for (size_t c = 0; c < 2; c++)
+                mult_add(acc.at(t)[c], decntt.at(t)[row], sel[row][c]);
+
+    PolyLvl1NTT res;
+    for (size_t t = 0; t < size; t++) {
+        for (size_t c = 0; c < 2; c++) {
+            mont_reduce(res, acc.at(t)[c]);
+            (*out[t])[c] = (*in0[t])[c];
+            add_ntt_to_poly((*out[t])[c], res);
+        }
+    }
+}
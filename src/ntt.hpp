@@ -0,0 +1,31 @@
+#ifndef HOMFA_NTT_HPP
+#define HOMFA_NTT_HPP
+
+#include <array>
+#include <cstdint>
+
+#include <tfhe++.hpp>
+
+// External product in the integer NTT domain modulo a 50-bit prime, as an
+// alternative to TFHEpp's double FFT. The products of the decomposed
+// polynomials and the TRGSW fit in the modulus, so the result is exact.
+// The runners do not use it yet; "benchmark kernels" compares the two.
+
+// Polynomial of lvl1param in the NTT domain. The coefficients are in
+// bit-reversed order.
+using PolyLvl1NTT = std::array<uint64_t, TFHEpp::lvl1param::n>;
+using TRLWELvl1NTT = std::array<PolyLvl1NTT, 2>;
+// The coefficients of TRGSWLvl1NTT are in Montgomery form so that the
+// products in the external product need only one reduction.
+using TRGSWLvl1NTT = std::array<TRLWELvl1NTT, 2 * TFHEpp::lvl1param::l>;
+
+TRGSWLvl1NTT TRGSWLvl1FFT_to_NTT(
+    const TFHEpp::TRGSWFFT<TFHEpp::lvl1param>& src);
+
+// Same as CMUXFFTLvl1_tile, but with sel in the NTT domain.
+void CMUXNTTLvl1_tile(const TRGSWLvl1NTT& sel, size_t size,
+                      TFHEpp::TRLWE<TFHEpp::lvl1param>* const out[],
+                      const TFHEpp::TRLWE<TFHEpp::lvl1param>* const in1[],
+                      const TFHEpp::TRLWE<TFHEpp::lvl1param>* const in0[]);
+
+#endif
@@ -4,20 +4,63 @@
 
 #include <spdlog/spdlog.h>
 
+namespace {
+BackstreamDFARunner make_packed_runner(
+    const std::vector<Graph>& graphs, size_t input_size, size_t boot_interval,
+    std::shared_ptr<EvalKey> eval_key,
+    std::shared_ptr<TFHEpp::TLWE2TRLWEIKSKey<TFHEpp::lvl11param>>
+        tlwel1_trlwel1_iks_key,
+    bool sanitize_result)
+{
+    auto [graph, final_sts] = Graph::product(graphs, true);
+    return BackstreamDFARunner{std::move(graph),
+                               final_sts,
+                               boot_interval,
+                               input_size,
+                               1,
+                               std::move(eval_key),
+                               std::move(tlwel1_trlwel1_iks_key),
+                               sanitize_result};
+}
+}  // namespace
+
 OfflineDFARunner::OfflineDFARunner(Graph graph, size_t input_size,
                                    size_t boot_interval,
                                    std::shared_ptr<EvalKey> eval_key,
                                    bool sanitize_result)
-    : runner_(std::move(graph), boot_interval, input_size, eval_key,
+    : runner_(std::move(graph), boot_interval, input_size, 1, eval_key,
               sanitize_result)
 {
 }
 
+OfflineDFARunner::OfflineDFARunner(
+    const std::vector<Graph>& graphs, size_t input_size, size_t boot_interval,
+    std::shared_ptr<EvalKey> eval_key,
+    std::shared_ptr<TFHEpp::TLWE2TRLWEIKSKey<TFHEpp::lvl11param>>
+        tlwel1_trlwel1_iks_key,
+    bool sanitize_result)
+    : runner_(make_packed_runner(graphs, input_size, boot_interval,
+                                 std::move(eval_key),
+                                 std::move(tlwel1_trlwel1_iks_key),
+                                 sanitize_result))
+{
+}
+
 TLWELvl1 OfflineDFARunner::result() const
 {
     return runner_.result();
 }
 
+TLWELvl1 OfflineDFARunner::result(size_t prop) const
+{
+    return runner_.result(prop);
+}
+
+TRLWELvl1 OfflineDFARunner::packed_result() const
+{
+    return runner_.packed_result();
+}
+
 void OfflineDFARunner::eval_one(const TRGSWLvl1FFT& input)
 {
     runner_.eval(input);
@@ -10,13 +10,28 @@ private:
 public:
     OfflineDFARunner(Graph graph, size_t input_size, size_t boot_interval,
                      std::shared_ptr<EvalKey> eval_key, bool sanitize_result);
+    // Evaluate the product of graphs with the verdict of each graph packed
+    // into a coefficient of weights
+    OfflineDFARunner(
+        const std::vector<Graph>& graphs, size_t input_size,
+        size_t boot_interval, std::shared_ptr<EvalKey> eval_key,
+        std::shared_ptr<TFHEpp::TLWE2TRLWEIKSKey<TFHEpp::lvl11param>>
+            tlwel1_trlwel1_iks_key,
+        bool sanitize_result);
 
     const Graph& graph() const
     {
         return runner_.graph();
     }
 
+    size_t num_props() const
+    {
+        return runner_.num_props();
+    }
+
     TLWELvl1 result() const;
+    TLWELvl1 result(size_t prop) const;
+    TRLWELvl1 packed_result() const;
     void eval_one(const TRGSWLvl1FFT& input);
 };
 
@@ -2,8 +2,10 @@
 #include "error.hpp"
 #include "timeit.hpp"
 
+#include <algorithm>
 #include <execution>
 
+#include <boost/unordered_map.hpp>
 #include <spdlog/spdlog.h>
 #include <tbb/parallel_for.h>
 
@@ -97,12 +99,66 @@ void OnlineDFARunner::bootstrap_weight()
 }
 
 /* OnlineDFARunner2 */
+namespace {
+BackstreamDFARunner make_reversed_runner(Graph graph, size_t boot_interval,
+                                         size_t output_unit,
+                                         std::shared_ptr<EvalKey> eval_key,
+                                         bool sanitize_result)
+{
+    size_t num_phases = graph.detect_num_phases(output_unit);
+    return BackstreamDFARunner{std::move(graph),    boot_interval,
+                               std::nullopt,        num_phases,
+                               std::move(eval_key), sanitize_result};
+}
+
+BackstreamDFARunner make_reversed_packed_runner(
+    const std::vector<Graph>& graphs, size_t boot_interval, size_t output_unit,
+    bool is_spec_reversed, std::shared_ptr<EvalKey> eval_key,
+    std::shared_ptr<TFHEpp::TLWE2TRLWEIKSKey<TFHEpp::lvl11param>>
+        tlwel1_trlwel1_iks_key,
+    bool sanitize_result)
+{
+    // Each graph must be reversed separately since the initial state of the
+    // reversed graph depends on the final states.
+    std::vector<Graph> reversed_graphs;
+    for (auto&& graph : graphs)
+        reversed_graphs.push_back(is_spec_reversed
+                                      ? graph
+                                      : graph.reversed_minimized());
+    auto [graph, final_sts] = Graph::product(reversed_graphs, true);
+    size_t num_phases = graph.detect_num_phases(output_unit);
+    return BackstreamDFARunner{std::move(graph),
+                               final_sts,
+                               boot_interval,
+                               std::nullopt,
+                               num_phases,
+                               std::move(eval_key),
+                               std::move(tlwel1_trlwel1_iks_key),
+                               sanitize_result};
+}
+}  // namespace
+
 OnlineDFARunner2::OnlineDFARunner2(const Graph& graph, size_t boot_interval_,
-                                   bool is_spec_reversed,
+                                   size_t output_unit, bool is_spec_reversed,
                                    std::shared_ptr<EvalKey> eval_key,
                                    bool sanitize_result)
-    : runner_(is_spec_reversed ? graph : graph.reversed().minimized(),
-              boot_interval_, std::nullopt, eval_key, sanitize_result)
+    : runner_(make_reversed_runner(
+          is_spec_reversed ? graph : graph.reversed_minimized(),
+          boot_interval_, output_unit, std::move(eval_key), sanitize_result))
+{
+}
+
+OnlineDFARunner2::OnlineDFARunner2(
+    const std::vector<Graph>& graphs, size_t boot_interval,
+    size_t output_unit, bool is_spec_reversed,
+    std::shared_ptr<EvalKey> eval_key,
+    std::shared_ptr<TFHEpp::TLWE2TRLWEIKSKey<TFHEpp::lvl11param>>
+        tlwel1_trlwel1_iks_key,
+    bool sanitize_result)
+    : runner_(make_reversed_packed_runner(
+          graphs, boot_interval, output_unit, is_spec_reversed,
+          std::move(eval_key), std::move(tlwel1_trlwel1_iks_key),
+          sanitize_result))
 {
 }
 
@@ -111,11 +167,166 @@ TLWELvl1 OnlineDFARunner2::result() const
     return runner_.result();
 }
 
+TLWELvl1 OnlineDFARunner2::result(size_t prop) const
+{
+    return runner_.result(prop);
+}
+
+TRLWELvl1 OnlineDFARunner2::packed_result() const
+{
+    return runner_.packed_result();
+}
+
 void OnlineDFARunner2::eval_one(const TRGSWLvl1FFT& input)
 {
     return runner_.eval(input);
 }
 
+void OnlineDFARunner2::eval_one(const TRGSWLvl1FFTFloat& input)
+{
+    return runner_.eval(input);
+}
+
+/* LetterCMUXTree */
+LetterCMUXTree::LetterCMUXTree(const LetterGraph& graph,
+                               std::vector<Graph::State> sources)
+    : sources_(std::move(sources)), nodes_(), roots_()
+{
+    // Leaves of the trees. Those for the same source are contiguous and
+    // ordered by letter, so each pair of adjacent nodes differs only in the
+    // bit for the current level.
+    std::vector<size_t> cur, next;
+    for (Graph::State q : sources_)
+        for (size_t c = 0; c < graph.num_letters(); c++)
+            cur.push_back(graph.next_state(q, c));
+
+    for (size_t level = 0; level < graph.num_ap(); level++) {
+        std::vector<std::pair<size_t, size_t>> nodes;
+        boost::unordered_map<std::pair<size_t, size_t>, size_t> children2node;
+        next.clear();
+        for (size_t i = 0; i < cur.size(); i += 2) {
+            std::pair<size_t, size_t> children{cur.at(i), cur.at(i + 1)};
+            auto [it, inserted] =
+                children2node.emplace(children, nodes.size());
+            if (inserted)
+                nodes.push_back(children);
+            next.push_back(it->second);
+        }
+        nodes_.push_back(std::move(nodes));
+        {
+            using std::swap;
+            swap(cur, next);
+        }
+    }
+    assert(cur.size() == sources_.size());
+    roots_ = cur;
+}
+
+size_t LetterCMUXTree::num_cmux(size_t level) const
+{
+    const auto& nodes = nodes_.at(level);
+    return std::count_if(nodes.begin(), nodes.end(),
+                         [](auto&& n) { return n.first != n.second; });
+}
+
+void LetterCMUXTree::eval_level(size_t level, const TRGSWLvl1FFT& input,
+                                const std::vector<TRLWELvl1>& weight,
+                                TimeRecorder& timer)
+{
+    const auto& nodes = nodes_.at(level);
+    const std::vector<TRLWELvl1>& in = level == 0 ? weight : values_;
+    std::vector<TRLWELvl1>& out = workspace_;
+    out.resize(nodes.size());
+    std::vector<size_t> cmux_nodes;
+    for (size_t i = 0; i < nodes.size(); i++) {
+        auto [lo, hi] = nodes.at(i);
+        if (lo == hi)
+            out.at(i) = in.at(lo);
+        else
+            cmux_nodes.push_back(i);
+    }
+    timer.timeit(TimeRecorder::TARGET::CMUX, cmux_nodes.size(), [&] {
+        CMUXFFTLvl1_batch(input, cmux_nodes.size(), [&](size_t j) {
+            size_t i = cmux_nodes.at(j);
+            auto [lo, hi] = nodes.at(i);
+            return std::make_tuple(&out.at(i), &in.at(hi), &in.at(lo));
+        });
+    });
+    {
+        using std::swap;
+        swap(values_, out);
+    }
+}
+
+void LetterCMUXTree::write_result(std::vector<TRLWELvl1>& out) const
+{
+    for (size_t i = 0; i < sources_.size(); i++)
+        out.at(sources_.at(i)) = values_.at(roots_.at(i));
+}
+
+/* OnlineLetterDFARunner2 */
+OnlineLetterDFARunner2::OnlineLetterDFARunner2(
+    const Graph& graph, size_t num_ap, size_t boot_interval,
+    bool is_spec_reversed, std::shared_ptr<EvalKey> eval_key,
+    bool sanitize_result)
+    : graph_(LetterGraph::from_graph(
+                 is_spec_reversed ? graph : graph.reversed_minimized(),
+                 num_ap, true)
+                 .minimized()),
+      tree_(graph_, graph_.all_states()),
+      weight_(graph_.size()),
+      eval_key_(std::move(eval_key)),
+      boot_interval_(boot_interval),
+      num_processed_inputs_(0),
+      sanitize_result_(sanitize_result),
+      timer_()
+{
+    assert(eval_key_);
+    assert(boot_interval_ > 0);
+
+    if (sanitize_result_)
+        error_die("Sanitization of results is not implemented");
+
+    for (Graph::State st : graph_.all_states())
+        weight_.at(st) = graph_.is_final_state(st)
+                             ? trivial_TRLWELvl1_1over2()
+                             : trivial_TRLWELvl1_zero();
+}
+
+TLWELvl1 OnlineLetterDFARunner2::result() const
+{
+    assert(num_processed_inputs_ % graph_.num_ap() == 0);
+    TLWELvl1 ret;
+    TFHEpp::SampleExtractIndex<Lvl1>(ret, weight_.at(graph_.initial_state()),
+                                     0);
+    return ret;
+}
+
+void OnlineLetterDFARunner2::eval_one(const TRGSWLvl1FFT& input)
+{
+    const size_t level = num_processed_inputs_ % graph_.num_ap();
+    tree_.eval_level(level, input, weight_, timer_);
+    num_processed_inputs_++;
+    if (level != graph_.num_ap() - 1)
+        return;
+
+    tree_.write_result(weight_);
+    size_t num_processed_letters = num_processed_inputs_ / graph_.num_ap();
+    if (num_processed_letters % boot_interval_ == 0) {
+        spdlog::debug("Bootstrapping occurred");
+        bootstrap_weight();
+    }
+}
+
+void OnlineLetterDFARunner2::bootstrap_weight()
+{
+    timer_.timeit(TimeRecorder::TARGET::BOOTSTRAPPING, weight_.size(), [&] {
+        do_SEI_IKS_GBTLWE2TRLWE_2_batch(
+            *eval_key_, weight_.size(),
+            [&](size_t i) { return &weight_.at(i); });
+    });
+}
+
 /* OnlineDFARunner3 */
 OnlineDFARunner3::OnlineDFARunner3(
     Graph graph, size_t max_second_lut_depth, size_t queue_size,
@@ -127,6 +338,7 @@ OnlineDFARunner3::OnlineDFARunner3(
       tlwel1_trlwel1_iks_key_(tlwel1_trlwel1_iks_key),
       weight_(graph_.size(), trivial_TRLWELvl1_zero()),
       queued_inputs_(0),
+      input_buf_(),
       max_second_lut_depth_(max_second_lut_depth),
       queue_size_(queue_size),
       live_states_(),
@@ -181,15 +393,25 @@ TLWELvl1 OnlineDFARunner3::result()
 
 void OnlineDFARunner3::eval_one(const TRGSWLvl1FFT& input)
 {
-    queued_inputs_.push_back(input);
+    // Copy input to the slot for its position in the block. The buffer is
+    // allocated only at the first call.
+    input_buf_.resize(queue_size_);
+    TRGSWLvl1FFT& slot = input_buf_.at(queued_inputs_.size());
+    slot = input;
+    eval_one_borrowed(slot);
+}
+
+void OnlineDFARunner3::eval_one_borrowed(const TRGSWLvl1FFT& input)
+{
+    queued_inputs_.push_back(&input);
     if (queued_inputs_.size() < queue_size_)
         return;
     eval_queued_inputs();
 }
 
 void lookup_table(std::vector<TRLWELvl1>& table,
-                  std::vector<TRGSWLvl1FFT>::const_iterator input_begin,
-                  std::vector<TRGSWLvl1FFT>::const_iterator input_end,
+                  std::vector<const TRGSWLvl1FFT*>::const_iterator input_begin,
+                  std::vector<const TRGSWLvl1FFT*>::const_iterator input_end,
                   std::vector<TRLWELvl1>& workspace)
 {
     const size_t input_size = std::distance(input_begin, input_end);
@@ -203,9 +425,9 @@ void lookup_table(std::vector<TRLWELvl1>& table,
 
     size_t i = 0;
     for (auto it = input_begin; it != input_end; ++it, ++i) {
-        tbb::parallel_for(0, 1 << (input_size - i - 1), [&](size_t j) {
-            TFHEpp::CMUXFFT<Lvl1>(tmp.at(j), *it, table.at(j * 2 + 1),
-                                  table.at(j * 2));
+        CMUXFFTLvl1_batch(**it, 1 << (input_size - i - 1), [&](size_t j) {
+            return std::make_tuple(&tmp.at(j), &table.at(j * 2 + 1),
+                                   &table.at(j * 2));
         });
         using std::swap;
         swap(tmp, table);
@@ -231,10 +453,11 @@ void lookup_table_with_timer(
     for (auto it = input_begin; it != input_end; ++it, ++i) {
         timer.timeit(
             TimeRecorder::TARGET::CMUX, 1 << (input_size - i - 1), [&] {
-                tbb::parallel_for(0, 1 << (input_size - i - 1), [&](size_t j) {
-                    TFHEpp::CMUXFFT<Lvl1>(tmp.at(j), *it, table.at(j * 2 + 1),
-                                          table.at(j * 2));
-                });
+                CMUXFFTLvl1_batch(
+                    *it, 1 << (input_size - i - 1), [&](size_t j) {
+                        return std::make_tuple(&tmp.at(j), &table.at(j * 2 + 1),
+                                               &table.at(j * 2));
+                    });
             });
         using std::swap;
         swap(tmp, table);
@@ -342,27 +565,35 @@ void OnlineDFARunner3::eval_queued_inputs()
     bool should_bootstrap = (num_eval_ % bootstrapping_freq_ == 0);
     // Split next_trlwe into |Q| TLWE, perform bootstrapping, and convert
     // them to |Q| TRLWE
-    std::for_each(std::execution::par, next_live_states.begin(),
-                  next_live_states.end(), [&](Graph::State st) {
-                      TLWELvl1 tlwe_l1;
-                      TLWELvl0 tlwe_l0;
-                      TRLWELvl1 trlwe;
-
-                      // Extract
-                      TFHEpp::SampleExtractIndex<Lvl1>(tlwe_l1, next_trlwe,
-                                                       st2idx.at(st));
-                      if (should_bootstrap) {
-                          // Bootstrap
-                          TFHEpp::IdentityKeySwitch<TFHEpp::lvl10param>(
-                              tlwe_l0, tlwe_l1, eval_key_.getiksk<TFHEpp::lvl10param>());
-                          BS_TLWE_0_1o2_to_TRLWE_0_1o2(trlwe, tlwe_l0,
-                                                       eval_key_);
-                          TFHEpp::SampleExtractIndex<Lvl1>(tlwe_l1, trlwe, 0);
-                      }
-                      // Convert
-                      TFHEpp::TLWE2TRLWEIKS<TFHEpp::lvl11param>(
-                          weight_.at(st), tlwe_l1, tlwel1_trlwel1_iks_key_);
-                  });
+    const size_t num_next = next_live_states.size();
+    std::vector<TLWELvl1> tlwe_l1s(num_next);
+    tbb::parallel_for(0ul, num_next, [&](size_t i) {
+        TFHEpp::SampleExtractIndex<Lvl1>(tlwe_l1s.at(i), next_trlwe,
+                                         st2idx.at(next_live_states.at(i)));
+    });
+    if (should_bootstrap) {
+        // Bootstrap all the TLWEs at once so that they share the loads of
+        // the bootstrapping key
+        std::vector<TLWELvl0> tlwe_l0s(num_next);
+        std::vector<TRLWELvl1> trlwes(num_next);
+        tbb::parallel_for(0ul, num_next, [&](size_t i) {
+            TFHEpp::IdentityKeySwitch<TFHEpp::lvl10param>(
+                tlwe_l0s.at(i), tlwe_l1s.at(i),
+                eval_key_.getiksk<TFHEpp::lvl10param>());
+        });
+        BS_TLWE_0_1o2_to_TRLWE_0_1o2_batch(eval_key_, num_next, [&](size_t i) {
+            return std::make_tuple(&trlwes.at(i), &tlwe_l0s.at(i));
+        });
+        tbb::parallel_for(0ul, num_next, [&](size_t i) {
+            TFHEpp::SampleExtractIndex<Lvl1>(tlwe_l1s.at(i), trlwes.at(i), 0);
+        });
+    }
+    // Convert
+    tbb::parallel_for(0ul, num_next, [&](size_t i) {
+        TFHEpp::TLWE2TRLWEIKS<TFHEpp::lvl11param>(
+            weight_.at(next_live_states.at(i)), tlwe_l1s.at(i),
+            tlwel1_trlwel1_iks_key_);
+    });
 
     // Clear the queued inputs. Note that reserved space will NOT freed, which
     // is better.
@@ -376,10 +607,18 @@ void OnlineDFARunner3::eval_queued_inputs()
 OnlineDFARunner4::OnlineDFARunner4(Graph graph, size_t queue_size,
                                    const EvalKey& eval_key,
                                    bool sanitize_result)
-    : graph_(std::move(graph)),
+    : OnlineDFARunner4(graph, queue_size, 1, eval_key, sanitize_result)
+{
+}
+
+OnlineDFARunner4::OnlineDFARunner4(const Graph& graph, size_t queue_size,
+                                   size_t num_ap, const EvalKey& eval_key,
+                                   bool sanitize_result)
+    : graph_(LetterGraph::from_graph(graph, num_ap, false).minimized()),
       eval_key_(eval_key),
       queue_size_(queue_size),
       queued_inputs_(),
+      input_buf_(),
       selector_(std::nullopt),
       live_states_({graph_.initial_state()}),
       sanitize_result_(sanitize_result),
@@ -387,6 +626,8 @@ OnlineDFARunner4::OnlineDFARunner4(Graph graph, size_t queue_size,
 {
     if (sanitize_result_)
         error_die("Sanitization of results is not implemented");
+
+    queued_inputs_.reserve(queue_size_ * graph_.num_ap());
 }
 
 TLWELvl1 OnlineDFARunner4::result()
@@ -402,19 +643,30 @@ TLWELvl1 OnlineDFARunner4::result()
 
 void OnlineDFARunner4::eval_one(const TRGSWLvl1FFT& input)
 {
-    queued_inputs_.push_back(input);
-    if (queued_inputs_.size() < queue_size_)
+    // Same as OnlineDFARunner3::eval_one()
+    input_buf_.resize(queue_size_ * graph_.num_ap());
+    TRGSWLvl1FFT& slot = input_buf_.at(queued_inputs_.size());
+    slot = input;
+    eval_one_borrowed(slot);
+}
+
+void OnlineDFARunner4::eval_one_borrowed(const TRGSWLvl1FFT& input)
+{
+    queued_inputs_.push_back(&input);
+    if (queued_inputs_.size() < queue_size_ * graph_.num_ap())
         return;
     eval_queued_inputs();
 }
 
 void OnlineDFARunner4::eval_queued_inputs()
 {
-    const size_t input_size = queued_inputs_.size();
+    const size_t num_ap = graph_.num_ap();
+    if (queued_inputs_.size() % num_ap != 0)
+        error_die("The number of inputs must be a multiple of {}", num_ap);
+    const size_t input_size = queued_inputs_.size() / num_ap;
     if (input_size == 0)
         return;
 
-    const std::vector<Graph::State> all_states = graph_.all_states();
     const std::vector<Graph::State> live_states = live_states_;
     const std::vector<std::vector<Graph::State>> live_states_at_depth = [&] {
         std::vector<std::vector<Graph::State>> at_depth;
@@ -424,10 +676,9 @@ void OnlineDFARunner4::eval_queued_inputs()
             tmp2;
         for (size_t i = 0; i < input_size; i++) {
             tmp2.clear();
-            for (Graph::State q : tmp1) {
-                tmp2.insert(graph_.next_state(q, true));
-                tmp2.insert(graph_.next_state(q, false));
-            }
+            for (Graph::State q : tmp1)
+                for (size_t c = 0; c < graph_.num_letters(); c++)
+                    tmp2.insert(graph_.next_state(q, c));
             {
                 using std::swap;
                 swap(tmp1, tmp2);
@@ -477,18 +728,11 @@ void OnlineDFARunner4::eval_queued_inputs()
 
     // Propagate weight from back to front
     for (int i = input_size - 1; i >= 0; i--) {
-        const auto& states = live_states_at_depth.at(i);
-        timer_.timeit(TimeRecorder::TARGET::CMUX, states.size(), [&] {
-            std::for_each(std::execution::par, states.begin(), states.end(),
-                          [&](Graph::State q) {
-                              Graph::State q0 = graph_.next_state(q, false),
-                                           q1 = graph_.next_state(q, true);
-                              const auto &w0 = weight.at(q0),
-                                         &w1 = weight.at(q1);
-                              TFHEpp::CMUXFFT<Lvl1>(
-                                  out.at(q), queued_inputs_.at(i), w1, w0);
-                          });
-        });
+        LetterCMUXTree tree{graph_, live_states_at_depth.at(i)};
+        for (size_t j = 0; j < num_ap; j++)
+            tree.eval_level(j, *queued_inputs_.at(i * num_ap + j), weight,
+                            timer_);
+        tree.write_result(out);
         {
             using std::swap;
             swap(out, weight);
@@ -30,9 +30,20 @@ private:
     BackstreamDFARunner runner_;
 
 public:
+    // Results are read only after multiples of output_unit inputs, which
+    // lets the runner evaluate only the live layer of binarized specs.
     OnlineDFARunner2(const Graph& graph, size_t boot_interval_,
-                     bool is_spec_reversed, std::shared_ptr<EvalKey> eval_key,
-                     bool sanitize_result);
+                     size_t output_unit, bool is_spec_reversed,
+                     std::shared_ptr<EvalKey> eval_key, bool sanitize_result);
+    // Evaluate the product of the reversed graphs with the verdict of each
+    // graph packed into a coefficient of weights
+    OnlineDFARunner2(
+        const std::vector<Graph>& graphs, size_t boot_interval,
+        size_t output_unit, bool is_spec_reversed,
+        std::shared_ptr<EvalKey> eval_key,
+        std::shared_ptr<TFHEpp::TLWE2TRLWEIKSKey<TFHEpp::lvl11param>>
+            tlwel1_trlwel1_iks_key,
+        bool sanitize_result);
 
     const Graph& graph() const
     {
@@ -44,8 +55,95 @@ public:
         return runner_.timer();
     }
 
+    size_t num_props() const
+    {
+        return runner_.num_props();
+    }
+
+    size_t num_phases() const
+    {
+        return runner_.num_phases();
+    }
+
     TLWELvl1 result() const;
+    TLWELvl1 result(size_t prop) const;
+    TRLWELvl1 packed_result() const;
     void eval_one(const TRGSWLvl1FFT& input);
+    void eval_one(const TRGSWLvl1FFTFloat& input);
+
+    void measure_noise(NoiseStat& stat, const SecretKey& skey) const
+    {
+        runner_.measure_noise(stat, skey);
+    }
+};
+
+// CMUX trees that compute weight.at(graph.next_state(q, c)) for each source
+// state q, where the letter c is given bit by bit from p_0. The i-th level
+// of the trees selects by p_i. Nodes with the same children are shared among
+// the trees, and nodes whose children are the same need no CMUX.
+class LetterCMUXTree {
+private:
+    std::vector<Graph::State> sources_;
+    // nodes_.at(i) has the children (lo, hi) of the nodes at level i + 1.
+    // They are indices of the nodes at level i; level 0 is the states.
+    std::vector<std::vector<std::pair<size_t, size_t>>> nodes_;
+    // roots_.at(i) is the node at the top level for sources_.at(i)
+    std::vector<size_t> roots_;
+    std::vector<TRLWELvl1> values_, workspace_;
+
+public:
+    LetterCMUXTree(const LetterGraph& graph, std::vector<Graph::State> sources);
+
+    size_t num_ap() const
+    {
+        return nodes_.size();
+    }
+
+    size_t num_cmux(size_t level) const;
+    // Evaluate the level-th level, where input is the encrypted p_level.
+    // weight is used only when level is 0.
+    void eval_level(size_t level, const TRGSWLvl1FFT& input,
+                    const std::vector<TRLWELvl1>& weight, TimeRecorder& timer);
+    // Write the result for each source state q to out.at(q)
+    void write_result(std::vector<TRLWELvl1>& out) const;
+};
+
+// Same as OnlineDFARunner2, but run on the graph over 2^num_ap letters. Each
+// letter is evaluated by LetterCMUXTree, so the intermediate states inside a
+// letter are not materialized.
+class OnlineLetterDFARunner2 {
+private:
+    LetterGraph graph_;
+    LetterCMUXTree tree_;
+    std::vector<TRLWELvl1> weight_;
+    std::shared_ptr<EvalKey> eval_key_;
+    size_t boot_interval_, num_processed_inputs_;
+    bool sanitize_result_;
+    TimeRecorder timer_;
+
+public:
+    // boot_interval is in letters
+    OnlineLetterDFARunner2(const Graph& graph, size_t num_ap,
+                           size_t boot_interval, bool is_spec_reversed,
+                           std::shared_ptr<EvalKey> eval_key,
+                           bool sanitize_result);
+
+    const LetterGraph& graph() const
+    {
+        return graph_;
+    }
+
+    const TimeRecorder& timer() const
+    {
+        return timer_;
+    }
+
+    // Valid only at the boundaries of letters
+    TLWELvl1 result() const;
+    void eval_one(const TRGSWLvl1FFT& input);
+
+private:
+    void bootstrap_weight();
 };
 
 class OnlineDFARunner3 {
@@ -54,7 +152,10 @@ private:
     const EvalKey& eval_key_;
     const TFHEpp::TLWE2TRLWEIKSKey<TFHEpp::lvl11param>& tlwel1_trlwel1_iks_key_;
     std::vector<TRLWELvl1> weight_;
-    std::vector<TRGSWLvl1FFT> queued_inputs_;
+    // Inputs of the current block. They point either to the caller's inputs
+    // given to eval_one_borrowed() or to the copies in input_buf_.
+    std::vector<const TRGSWLvl1FFT*> queued_inputs_;
+    std::vector<TRGSWLvl1FFT> input_buf_;
     size_t max_second_lut_depth_, queue_size_;
     std::vector<Graph::State> live_states_;
     std::vector<std::vector<Graph::State>> memo_transition_;
@@ -100,6 +201,10 @@ public:
 
     TLWELvl1 result();
     void eval_one(const TRGSWLvl1FFT& input);
+    // Same as eval_one(), but input is not copied. It must stay valid until
+    // the block it belongs to is evaluated, i.e., until the queue is full or
+    // result() is called.
+    void eval_one_borrowed(const TRGSWLvl1FFT& input);
 
 private:
     void eval_queued_inputs();
@@ -107,10 +212,12 @@ private:
 
 class OnlineDFARunner4 {
 private:
-    Graph graph_;
+    LetterGraph graph_;
     const EvalKey& eval_key_;
     size_t queue_size_;
-    std::vector<TRGSWLvl1FFT> queued_inputs_;
+    // Same as OnlineDFARunner3
+    std::vector<const TRGSWLvl1FFT*> queued_inputs_;
+    std::vector<TRGSWLvl1FFT> input_buf_;
     std::optional<TRLWELvl1> selector_;
     std::vector<Graph::State> live_states_;
     bool sanitize_result_;
@@ -124,8 +231,11 @@ private:
 public:
     OnlineDFARunner4(Graph graph, size_t queue_size, const EvalKey& eval_key,
                      bool sanitize_result);
+    // Run on the graph over 2^num_ap letters. queue_size is in letters.
+    OnlineDFARunner4(const Graph& graph, size_t queue_size, size_t num_ap,
+                     const EvalKey& eval_key, bool sanitize_result);
 
-    const Graph& graph() const
+    const LetterGraph& graph() const
     {
         return graph_;
     }
@@ -147,6 +257,8 @@ public:
 
     TLWELvl1 result();
     void eval_one(const TRGSWLvl1FFT& input);
+    // Same as OnlineDFARunner3::eval_one_borrowed()
+    void eval_one_borrowed(const TRGSWLvl1FFT& input);
 
 private:
     void eval_queued_inputs();
@@ -1,13 +1,22 @@
+#include "async_io.hpp"
+#include "batch_plain_dfa_runner.hpp"
 #include "error.hpp"
 #include "graph.hpp"
+#include "ntt.hpp"
+#include "online_dfa.hpp"
 #include "tfhepp_util.hpp"
 
 #include <cassert>
+#include <cerrno>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
 #include <queue>
 #include <random>
 #include <sstream>
 
+#include <unistd.h>
+
 #include <spdlog/spdlog.h>
 #include <spot/misc/bddlt.hh>
 #include <spot/misc/minato.hh>
@@ -155,6 +164,29 @@ void test_graph_reversed()
     }
 }
 
+void test_graph_reversed_minimized()
+{
+    std::mt19937 rgen;
+    std::bernoulli_distribution bool_dist;
+    for (auto&& spec : {"test/01.spec", "test/02.spec", "test/05.spec",
+                        "test/07.spec", "test/09.spec", "test/10.spec"}) {
+        Graph gr = Graph::from_file(spec),
+              expected = gr.reversed().minimized(),
+              rgr = gr.reversed_minimized();
+        assert(rgr.size() == expected.size());
+        for (size_t n = 0; n < 100; n++) {
+            Graph::State q = rgr.initial_state(),
+                         q_exp = expected.initial_state();
+            for (size_t i = 0; i < 50; i++) {
+                bool in = bool_dist(rgen);
+                q = rgr.next_state(q, in);
+                q_exp = expected.next_state(q_exp, in);
+                assert(rgr.is_final_state(q) == expected.is_final_state(q_exp));
+            }
+        }
+    }
+}
+
 void test_graph_minimized()
 {
     {
@@ -272,6 +304,38 @@ void test_monitor()
     }
 }
 
+void test_monitor_direct()
+{
+    std::mt19937 rgen;
+    std::bernoulli_distribution bool_dist;
+    for (auto [fml, num_ap] : {std::make_pair("!F(p0 & Xp1)", 2),
+                               std::make_pair("G(p0 -> p1 W p2)", 3),
+                               std::make_pair("G(p3 | p4 | (p0 & p1 & p2))", 5),
+                               std::make_pair("G(p3 & p4)", 5)}) {
+        Graph gr = Graph::from_ltl_formula(fml, num_ap, false),
+              dgr = Graph::from_ltl_formula_direct(fml, num_ap, false);
+        assert(dgr.minimized().size() == gr.minimized().size());
+        for (size_t n = 0; n < 100; n++) {
+            Graph::State q = gr.initial_state(), dq = dgr.initial_state();
+            for (size_t t = 0; t < 10 * num_ap; t++) {
+                bool in = bool_dist(rgen);
+                q = gr.next_state(q, in);
+                dq = dgr.next_state(dq, in);
+                if ((t + 1) % num_ap == 0)
+                    assert(gr.is_final_state(q) == dgr.is_final_state(dq));
+            }
+        }
+    }
+}
+
+void test_split_ltl_conjunction()
+{
+    assert(split_ltl_conjunction("G(p0 -> p1 W p2)") ==
+           std::vector<std::string>{"G(p0 -> p1 W p2)"});
+    assert(split_ltl_conjunction("G p0 & (G p1 & G(p1 -> X p2))").size() == 3);
+    assert(split_ltl_conjunction("G p0 | G p1").size() == 1);
+}
+
 void test_negated()
 {
     {
@@ -367,6 +431,200 @@ void test_negated()
     }
 }
 
+void test_product()
+{
+    std::vector<Graph> components;
+    for (auto&& spec : {"test/02.spec", "test/04.spec", "test/06.spec"})
+        components.push_back(Graph::from_file(spec));
+
+    std::mt19937 rgen;
+    std::bernoulli_distribution bool_dist;
+    for (bool minimized : {false, true}) {
+        auto [prod, comp_final_sts] = Graph::product(components, minimized);
+        assert(comp_final_sts.size() == components.size());
+        assert(Graph::count_reachable_product_states(components, 1000000) >=
+               prod.size());
+
+        for (size_t n = 0; n < 100; n++) {
+            Graph::State q = prod.initial_state();
+            std::vector<Graph::State> qs;
+            for (auto&& gr : components)
+                qs.push_back(gr.initial_state());
+            for (size_t t = 0; t < 30; t++) {
+                bool in = bool_dist(rgen);
+                q = prod.next_state(q, in);
+                bool all_final = true;
+                for (size_t i = 0; i < components.size(); i++) {
+                    qs.at(i) = components.at(i).next_state(qs.at(i), in);
+                    bool final = components.at(i).is_final_state(qs.at(i));
+                    assert(comp_final_sts.at(i).contains(q) == final);
+                    all_final = all_final && final;
+                }
+                assert(prod.is_final_state(q) == all_final);
+            }
+        }
+    }
+
+    {
+        std::vector<Graph> same{Graph::from_file("test/02.spec"),
+                                Graph::from_file("test/02.spec")};
+        auto [prod, comp_final_sts] = Graph::product(same, true);
+        Graph mgr = Graph::from_file("test/02.spec").minimized();
+        assert(prod.size() == mgr.size());
+        assert(comp_final_sts.at(0) == comp_final_sts.at(1));
+        assert(Graph::count_reachable_product_states(same, 1) == 2);
+    }
+}
+
+void test_states_at_phase()
+{
+    {
+        Graph gr = Graph::from_file("test/07.spec").reversed().minimized();
+        assert(gr.detect_num_phases(1) == 1);
+        assert(gr.detect_num_phases(3) == 1);
+        assert(gr.detect_num_phases(4) == 2);
+        auto layers = gr.states_at_phase(2);
+        assert(layers.at(0).size() + layers.at(1).size() == gr.size());
+    }
+
+    // Run backstream in plaintext only on the layer of each phase
+    std::mt19937 rgen;
+    std::bernoulli_distribution bool_dist;
+    for (auto&& spec : {"test/01.spec", "test/07.spec", "test/09.spec"}) {
+        Graph gr = Graph::from_file(spec), rgr = gr.reversed().minimized();
+        for (size_t unit : {1, 2, 6}) {
+            size_t num_phases = rgr.detect_num_phases(unit);
+            auto layers = rgr.states_at_phase(num_phases);
+            for (size_t n = 0; n < 100; n++) {
+                std::vector<bool> weight(rgr.size()), next(rgr.size());
+                for (Graph::State q : rgr.all_states())
+                    weight.at(q) = rgr.is_final_state(q);
+                Graph::State q = gr.initial_state();
+                for (size_t s = 1; s <= 5 * unit; s++) {
+                    bool in = bool_dist(rgen);
+                    q = gr.next_state(q, in);
+                    size_t phase = (num_phases - s % num_phases) % num_phases;
+                    for (Graph::State st : layers.at(phase))
+                        next.at(st) = weight.at(rgr.next_state(st, in));
+                    weight = next;
+                    if (s % unit == 0)
+                        assert(weight.at(rgr.initial_state()) ==
+                               gr.is_final_state(q));
+                }
+            }
+        }
+    }
+}
+
+void test_letter_graph()
+{
+    std::mt19937 rgen;
+    for (auto [spec, num_ap] : {std::make_pair("test/01.spec", 2),
+                                std::make_pair("test/10.spec", 9)}) {
+        Graph gr = Graph::from_file(spec);
+        LetterGraph lgr = LetterGraph::from_graph(gr, num_ap, false),
+                    mlgr = lgr.minimized(),
+                    rlgr = LetterGraph::from_graph(gr.reversed().minimized(),
+                                                   num_ap, true)
+                               .minimized();
+        assert(mlgr.size() <= lgr.size());
+
+        std::uniform_int_distribution<size_t> letter_dist(
+            0, lgr.num_letters() - 1);
+        for (size_t n = 0; n < 100; n++) {
+            std::vector<size_t> letters;
+            Graph::State q = gr.initial_state();
+            LetterGraph::State lq = lgr.initial_state(),
+                               mlq = mlgr.initial_state();
+            for (size_t t = 0; t < 30; t++) {
+                size_t c = letter_dist(rgen);
+                letters.push_back(c);
+                for (size_t i = 0; i < lgr.num_ap(); i++)
+                    q = gr.next_state(q, ((c >> i) & 1u) != 0);
+                lq = lgr.next_state(lq, c);
+                mlq = mlgr.next_state(mlq, c);
+                assert(lgr.is_final_state(lq) == gr.is_final_state(q));
+                assert(mlgr.is_final_state(mlq) == gr.is_final_state(q));
+            }
+
+            LetterGraph::State rq = rlgr.initial_state();
+            for (auto it = letters.rbegin(); it != letters.rend(); ++it)
+                rq = rlgr.next_state(rq, *it);
+            assert(rlgr.is_final_state(rq) == gr.is_final_state(q));
+        }
+    }
+}
+
+void test_optimize_ap_order()
+{
+    std::mt19937 rgen;
+    for (auto&& spec : {"test/01.spec", "test/07.spec", "test/09.spec"}) {
+        Graph gr = Graph::from_file(spec);
+        auto [opt, order] = optimize_ap_order(gr, 2);
+        assert(opt.size() <= gr.minimized().size());
+        assert(order.size() == 2);
+
+        std::uniform_int_distribution<size_t> letter_dist(0, 3);
+        for (size_t n = 0; n < 100; n++) {
+            Graph::State q = gr.initial_state(), oq = opt.initial_state();
+            for (size_t t = 0; t < 30; t++) {
+                size_t c = letter_dist(rgen);
+                for (size_t i = 0; i < 2; i++) {
+                    q = gr.next_state(q, ((c >> i) & 1u) != 0);
+                    oq = opt.next_state(oq, ((c >> order.at(i)) & 1u) != 0);
+                }
+                assert(gr.is_final_state(q) == opt.is_final_state(oq));
+            }
+        }
+    }
+    {
+        Graph gr = Graph::from_file("test/01.spec");
+        auto [opt, order] = optimize_ap_order(gr, 2);
+        assert(opt.size() < gr.minimized().size());
+        assert(order == std::vector<size_t>({1, 0}));
+    }
+}
+
+void test_batch_plain_dfa_runner()
+{
+    std::mt19937 rgen;
+    std::uniform_int_distribution<size_t> length_dist(0, 100);
+    std::bernoulli_distribution bool_dist;
+
+    for (auto&& spec : {"test/01.spec", "test/04.spec", "test/06.spec",
+                        "test/07.spec", "test/10.spec"}) {
+        Graph gr = Graph::from_file(spec);
+        BatchPlainDFARunner runner{gr};
+
+        std::vector<BatchPlainDFARunner::Trace> traces(37);
+        for (auto&& trace : traces) {
+            trace.resize(length_dist(rgen));
+            for (size_t i = 0; i < trace.size(); i++)
+                trace.at(i) = bool_dist(rgen);
+        }
+
+        const size_t output_freq = 7;
+        auto verdicts = runner.run(traces, output_freq);
+        auto final_verdicts = runner.run(traces);
+        assert(verdicts.size() == traces.size());
+        assert(final_verdicts.size() == traces.size());
+        for (size_t i = 0; i < traces.size(); i++) {
+            const auto& trace = traces.at(i);
+            std::vector<bool> expected;
+            Graph::State q = gr.initial_state();
+            if (trace.empty())
+                expected.push_back(gr.is_final_state(q));
+            for (size_t t = 0; t < trace.size(); t++) {
+                q = gr.next_state(q, trace.at(t));
+                if ((t + 1) % output_freq == 0 || t + 1 == trace.size())
+                    expected.push_back(gr.is_final_state(q));
+            }
+            assert(verdicts.at(i) == expected);
+            assert(final_verdicts.at(i) == expected.back());
+        }
+    }
+}
+
 void test_serializer_deserializer()
 {
     SecretKey skey;
@@ -426,15 +684,390 @@ void test_input_stream()
         assert(c == c1);
         assert(st.size() == 0);
     }
+
+    {
+        // References returned by next() stay valid while the stream lives,
+        // even after the inputs are dropped from the read-ahead window
+        TRGSWLvl1InputStreamFromCtxtFile st{test_filename, nullptr, 1};
+        const TRGSWLvl1FFT &r0 = st.next(), &r1 = st.next();
+        assert(r0 == c0);
+        assert(r1 == c1);
+    }
+
+    auto decrypt = [&](const TRGSWLvl1FFT& c) {
+        TRLWELvl1 res;
+        TFHEpp::CMUXFFT<Lvl1>(res, c, trivial_TRLWELvl1_1over2(),
+                              trivial_TRLWELvl1_zero());
+        return decrypt_TRLWELvl1_to_bits(res, 1, skey).at(0);
+    };
+
+    {
+        // Seeded ciphertexts are expanded into TRGSWs of the same bits
+        {
+            TRGSWLvl1CtxtFileWriter writer{
+                test_filename, TRGSWLvl1CtxtFile::FORMAT::SEEDED, 1, skey,
+                false};
+            writer.save_bit(false);
+            writer.save_bit(true);
+            writer.flush();
+        }
+        TRGSWLvl1InputStreamFromCtxtFile st{test_filename};
+        assert(st.size() == 2);
+        assert(!decrypt(st.next()));
+        assert(decrypt(st.next()));
+        ReversedTRGSWLvl1InputStreamFromCtxtFile rst{test_filename};
+        assert(rst.size() == 2);
+        assert(decrypt(rst.next()));
+        assert(!decrypt(rst.next()));
+    }
+
+    {
+        // Appended chunks follow the existing ones, even if the last one is
+        // not full
+        const size_t size = 6;
+        for (size_t i = 0; i < size; i++) {
+            TRGSWLvl1CtxtFileWriter writer{test_filename,
+                                           TRGSWLvl1CtxtFile::FORMAT::SEEDED,
+                                           2, skey, i != 0};
+            writer.save_bit(i % 3 == 0);
+            if (i % 2 == 0)
+                writer.save_bit(i % 5 == 0);
+            writer.flush();
+        }
+        TRGSWLvl1InputStreamFromCtxtFile st{test_filename};
+        assert(st.num_ap() == 2);
+        assert(st.size() == size + size / 2);
+        for (size_t i = 0; i < size; i++) {
+            assert(decrypt(st.next()) == (i % 3 == 0));
+            if (i % 2 == 0)
+                assert(decrypt(st.next()) == (i % 5 == 0));
+        }
+
+        // The same inputs are read as they arrive
+        TRGSWLvl1InputStreamFromPipe pst{test_filename};
+        assert(pst.num_ap() == 2);
+        for (size_t i = 0; i < size; i++) {
+            assert(pst.has_next() && decrypt(pst.next()) == (i % 3 == 0));
+            if (i % 2 == 0)
+                assert(pst.has_next() && decrypt(pst.next()) == (i % 5 == 0));
+        }
+        assert(!pst.has_next());
+    }
+}
+
+void test_async_io()
+{
+    const std::string test_filename = "_test_async_io";
+    int fds[2];
+    assert(pipe(fds) == 0);
+
+    std::future<ssize_t> pending;
+    {
+        AsyncIO io;
+        io.write_file(test_filename, "0123456789");
+        io.flush();
+        {
+            std::ifstream ifs{test_filename};
+            std::string s;
+            ifs >> s;
+            assert(s == "0123456789");
+        }
+
+        // Reads wait for the writer
+        char buf[16];
+        std::future<ssize_t> res = io.read(fds[0], buf, sizeof(buf));
+        assert(write(fds[1], "abc", 3) == 3);
+        assert(res.get() == 3 && std::string(buf, 3) == "abc");
+
+        // The read still waiting is cancelled on destruction
+        pending = io.read(fds[0], buf, sizeof(buf));
+    }
+    assert(pending.get() == -ECANCELED);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+void test_result_log()
+{
+    SecretKey skey;
+    const std::string test_filename = "_test_result_log";
+
+    {
+        AsyncIO io;
+        ResultLogWriter writer{io, test_filename, ResultLogFile::FORMAT::TLWE,
+                               1, ResultLogWriter::SYNC::EACH};
+        for (size_t i = 0; i < 10; i++)
+            writer.append(i * 3, TFHEpp::tlweSymEncrypt<Lvl1>(
+                                     i % 4 == 0 ? Lvl1::μ : -Lvl1::μ,
+                                     Lvl1::α, skey.key.lvl1));
+    }
+    {
+        assert(ResultLogFile::is_result_log(test_filename));
+        ResultLogFile log{test_filename};
+        assert(log.size() == 10);
+        assert(log.format() == ResultLogFile::FORMAT::TLWE);
+        for (size_t i = 0; i < 10; i++) {
+            assert(log.pos(i) == i * 3);
+            assert(decrypt_TLWELvl1_to_bit(log.tlwe(i), skey) == (i % 4 == 0));
+        }
+    }
+
+    {
+        // The record being written at the end is ignored
+        AsyncIO io;
+        ResultLogWriter writer{io, test_filename, ResultLogFile::FORMAT::TRLWE,
+                               3, ResultLogWriter::SYNC::END};
+        PolyLvl1 m = {};
+        m[0] = m[2] = Lvl1::μ;
+        m[1] = -Lvl1::μ;
+        writer.append(5, TFHEpp::trlweSymEncrypt<Lvl1>(m, Lvl1::α,
+                                                       skey.key.lvl1));
+        writer.append(7, TRLWELvl1{});
+    }
+    std::filesystem::resize_file(test_filename,
+                                 std::filesystem::file_size(test_filename) - 8);
+    {
+        ResultLogFile log{test_filename};
+        assert(log.size() == 1);
+        assert(log.num_results() == 3);
+        assert(log.pos(0) == 5);
+        assert(decrypt_TRLWELvl1_to_bits(log.trlwe(0), 3, skey) ==
+               (std::vector<bool>{true, false, true}));
+    }
+
+    {
+        // A hole in the middle ends the log even if records after it are
+        // complete
+        AsyncIO io;
+        ResultLogWriter writer{io, test_filename, ResultLogFile::FORMAT::TLWE,
+                               1, ResultLogWriter::SYNC::END};
+        for (size_t i = 0; i < 5; i++)
+            writer.append(i, TFHEpp::tlweSymEncrypt<Lvl1>(
+                                 Lvl1::μ, Lvl1::α, skey.key.lvl1));
+    }
+    {
+        // The middle of the file is in the third record
+        std::fstream fs{test_filename,
+                        std::ios::in | std::ios::out | std::ios::binary};
+        fs.seekp(std::filesystem::file_size(test_filename) / 2);
+        const std::array<char, 8> zeros = {};
+        fs.write(zeros.data(), zeros.size());
+    }
+    {
+        ResultLogFile log{test_filename};
+        assert(log.size() == 2);
+        assert(log.pos(1) == 1);
+    }
+}
+
+void test_cmux_batch()
+{
+    SecretKey skey;
+    std::mt19937_64 rgen;
+    // Use more CMUXes than a tile to test both full and partial tiles
+    const size_t size = 2 * CMUX_MAX_TILE_SIZE + 3;
+    std::vector<uint64_t> m0(size), m1(size);
+    std::vector<TRLWELvl1> in0(size), in1(size), out(size);
+    for (size_t i = 0; i < size; i++) {
+        m0.at(i) = rgen();
+        m1.at(i) = rgen();
+        in0.at(i) = TFHEpp::trlweSymEncrypt<Lvl1>(uint2weight(m0.at(i)),
+                                                  Lvl1::α, skey.key.lvl1);
+        in1.at(i) = TFHEpp::trlweSymEncrypt<Lvl1>(uint2weight(m1.at(i)),
+                                                  Lvl1::α, skey.key.lvl1);
+    }
+
+    for (bool b : {false, true}) {
+        TRGSWLvl1FFT sel = encrypt_bit_to_TRGSWLvl1FFT(b, skey);
+        CMUXFFTLvl1_batch(sel, size, [&](size_t i) {
+            return std::make_tuple(&out.at(i), &in1.at(i), &in0.at(i));
+        });
+        // Run the first one again with the work split across threads
+        CMUXFFTLvl1_split(sel, out.at(0), in1.at(0), in0.at(0));
+        // Run the second one again with sel in reduced precision
+        CMUXFFTLvl1_batch(TRGSWLvl1FFT_to_float(sel), 1, [&](size_t) {
+            return std::make_tuple(&out.at(1), &in1.at(1), &in0.at(1));
+        });
+        for (size_t i = 0; i < size; i++) {
+            std::vector<bool> got = decrypt_TRLWELvl1_to_bits(out.at(i), 64,
+                                                              skey);
+            uint64_t expected = b ? m1.at(i) : m0.at(i);
+            for (size_t j = 0; j < 64; j++)
+                assert(got.at(j) == ((expected >> j) & 1u));
+        }
+    }
+}
+
+void test_cmux_ntt()
+{
+    SecretKey skey;
+    std::mt19937_64 rgen;
+    const size_t size = CMUX_MAX_TILE_SIZE;
+    std::vector<uint64_t> m0(size), m1(size);
+    std::vector<TRLWELvl1> in0(size), in1(size), out(size);
+    TRLWELvl1* outs[size];
+    const TRLWELvl1 *in1s[size], *in0s[size];
+    for (size_t i = 0; i < size; i++) {
+        m0.at(i) = rgen();
+        m1.at(i) = rgen();
+        in0.at(i) = TFHEpp::trlweSymEncrypt<Lvl1>(uint2weight(m0.at(i)),
+                                                  Lvl1::α, skey.key.lvl1);
+        in1.at(i) = TFHEpp::trlweSymEncrypt<Lvl1>(uint2weight(m1.at(i)),
+                                                  Lvl1::α, skey.key.lvl1);
+        outs[i] = &out.at(i);
+        in1s[i] = &in1.at(i);
+        in0s[i] = &in0.at(i);
+    }
+
+    for (bool b : {false, true}) {
+        auto sel = std::make_unique<TRGSWLvl1NTT>(
+            TRGSWLvl1FFT_to_NTT(encrypt_bit_to_TRGSWLvl1FFT(b, skey)));
+        CMUXNTTLvl1_tile(*sel, size, outs, in1s, in0s);
+        for (size_t i = 0; i < size; i++) {
+            std::vector<bool> got = decrypt_TRLWELvl1_to_bits(out.at(i), 64,
+                                                              skey);
+            uint64_t expected = b ? m1.at(i) : m0.at(i);
+            for (size_t j = 0; j < 64; j++)
+                assert(got.at(j) == ((expected >> j) & 1u));
+        }
+    }
+}
+
+void test_bootstrap_batch()
+{
+    SecretKey skey;
+    EvalKey ekey{skey};
+    ekey.emplaceiksk<TFHEpp::lvl10param>(skey);
+    ekey.emplacebkfft<TFHEpp::lvl01param>(skey);
+
+    std::mt19937 rgen;
+    std::bernoulli_distribution bool_dist;
+    // Use more TLWEs than a tile to test both full and partial tiles
+    const size_t size = 2 * CMUX_MAX_TILE_SIZE + 3;
+    std::vector<bool> bits(size);
+    std::vector<TRLWELvl1> ws(size);
+    for (bool unrolled : {false, true}) {
+        if (unrolled)
+            ekey.emplacebkfftunrolled(skey);
+        for (size_t i = 0; i < size; i++) {
+            bits.at(i) = bool_dist(rgen);
+            ws.at(i) = TFHEpp::trlweSymEncrypt<Lvl1>(
+                uint2weight(bits.at(i)), Lvl1::α, skey.key.lvl1);
+        }
+        do_SEI_IKS_GBTLWE2TRLWE_2_batch(ekey, size,
+                                        [&](size_t i) { return &ws.at(i); });
+        // Bootstrap the first one again without batching
+        do_SEI_IKS_GBTLWE2TRLWE_2(ws.at(0), ekey);
+        for (size_t i = 0; i < size; i++)
+            assert(decrypt_TRLWELvl1_to_bits(ws.at(i), 1, skey).at(0) ==
+                   bits.at(i));
+    }
+}
+
+void test_blind_rotate_tile()
+{
+    SecretKey skey;
+    EvalKey ekey{skey};
+    ekey.emplacebkfft<TFHEpp::lvl01param>(skey);
+
+    std::mt19937 rgen;
+    std::uniform_int_distribution<uint32_t> dist;
+    const PolyLvl1 testvector = TFHEpp::μpolygen<Lvl1, Lvl1::μ>();
+    // A full tile and a partial one
+    for (size_t size : {CMUX_MAX_TILE_SIZE, size_t{3}}) {
+        for (bool unrolled : {false, true}) {
+            if (unrolled && !ekey.bkfftunrolled)
+                ekey.emplacebkfftunrolled(skey);
+            std::vector<TLWELvl0> srcs(size);
+            std::vector<TRLWELvl1> outs(size);
+            TRLWELvl1* out[CMUX_MAX_TILE_SIZE];
+            const TLWELvl0* src[CMUX_MAX_TILE_SIZE];
+            for (size_t t = 0; t < size; t++) {
+                srcs.at(t) = TFHEpp::tlweSymEncrypt<Lvl0>(dist(rgen), Lvl0::α,
+                                                          skey.key.lvl0);
+                out[t] = &outs.at(t);
+                src[t] = &srcs.at(t);
+            }
+            BlindRotateLvl01_tile(ekey, testvector, size, out, src);
+
+            // Each coefficient is ±μ plus noise, whose sign tells the
+            // rotation
+            for (size_t t = 0; t < size; t++) {
+                TRLWELvl1 expected;
+                TFHEpp::BlindRotate<TFHEpp::lvl01param>(
+                    expected, srcs.at(t),
+                    ekey.getbkfft<TFHEpp::lvl01param>(), testvector);
+                PolyLvl1 got_phase = phase_of_TRLWELvl1(outs.at(t), skey),
+                         expected_phase = phase_of_TRLWELvl1(expected, skey);
+                for (size_t i = 0; i < Lvl1::n; i++)
+                    assert((static_cast<int32_t>(got_phase[i]) < 0) ==
+                           (static_cast<int32_t>(expected_phase[i]) < 0));
+            }
+        }
+    }
+}
+
+void test_packed_at_limit()
+{
+    SecretKey skey;
+    auto ekey = std::make_shared<EvalKey>(skey);
+    ekey->emplaceiksk<TFHEpp::lvl10param>(skey);
+    ekey->emplacebkfft<TFHEpp::lvl01param>(skey);
+    auto iks_key =
+        std::make_shared<TFHEpp::TLWE2TRLWEIKSKey<TFHEpp::lvl11param>>();
+    TFHEpp::tlwe2trlweikskgen<TFHEpp::lvl11param>(*iks_key, skey);
+
+    // Pack as many specs as the noise allows, half of which are negated so
+    // that the packed verdicts differ
+    const size_t boot_interval = 2,
+                 num_props = BackstreamDFARunner::max_num_props(boot_interval);
+    assert(num_props > 1);
+    Graph gr = Graph::from_file("test/02.spec"), neg_gr = gr.negated();
+    std::vector<Graph> graphs;
+    for (size_t i = 0; i < num_props; i++)
+        graphs.push_back(i % 2 == 0 ? gr : neg_gr);
+
+    // Bootstrap twice before reading the results
+    const std::vector<bool> input = {true, false, true, true, false};
+    OnlineDFARunner2 runner{graphs, boot_interval, input.size(), false,
+                            ekey,   iks_key,       false};
+    assert(runner.num_props() == num_props);
+    for (bool b : input)
+        runner.eval_one(encrypt_bit_to_TRGSWLvl1FFT(b, skey));
+
+    std::vector<bool> got =
+        decrypt_TRLWELvl1_to_bits(runner.packed_result(), num_props, skey);
+    for (size_t i = 0; i < num_props; i++) {
+        const Graph& g = graphs.at(i);
+        Graph::State q = g.initial_state();
+        for (bool b : input)
+            q = g.next_state(q, b);
+        assert(got.at(i) == g.is_final_state(q));
+    }
 }
 
 int main()
 {
     test_graph_dump();
     test_graph_reversed();
+    test_graph_reversed_minimized();
     test_graph_minimized();
     test_monitor();
+    test_monitor_direct();
+    test_split_ltl_conjunction();
     test_negated();
+    test_product();
+    test_states_at_phase();
+    test_letter_graph();
+    test_optimize_ap_order();
+    test_batch_plain_dfa_runner();
     test_serializer_deserializer();
     test_input_stream();
+    test_async_io();
+    test_result_log();
+    test_cmux_batch();
+    test_cmux_ntt();
+    test_bootstrap_batch();
+    test_blind_rotate_tile();
+    test_packed_at_limit();
 }
@@ -34,7 +34,7 @@ public:
         return spec_.end() - head_;
     }
 
-    TRGSWLvl1FFT next() override
+    const TRGSWLvl1FFT& next() override
     {
         assert(size() != 0);
         bool b = *(head_++);
@@ -60,7 +60,7 @@ public:
         return spec_.rend() - head_;
     }
 
-    TRGSWLvl1FFT next() override
+    const TRGSWLvl1FFT& next() override
     {
         assert(size() != 0);
         bool b = *(head_++);
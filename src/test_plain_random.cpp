@@ -136,7 +136,8 @@ void test_from_ltl_formula(std::istream& is, size_t num_ap, size_t num_test,
 
         Graph gr = Graph::from_ltl_formula(fml, num_ap, false),
               rgr = gr.reversed(),
-              rgr2 = Graph::from_ltl_formula_reversed(fml, num_ap, false);
+              rgr2 = Graph::from_ltl_formula_reversed(fml, num_ap, false),
+              dgr = Graph::from_ltl_formula_direct(fml, num_ap, false);
         std::optional<Graph> mgr, mrgr, mrgr2;
         if (gr.size() < 10000)
             mgr.emplace(gr.minimized());
@@ -194,6 +195,12 @@ void test_from_ltl_formula(std::istream& is, size_t num_ap, size_t num_test,
                     error_die("[{}] [{}] [{}] {} != {}", fml, i + 1,
                               bvec2str(in), expected, got);
             }
+            {
+                bool got = check_if_accept(dgr, in);
+                if (expected != got)
+                    error_die("[{}] [{}] [{}] {} != {}", fml, i + 1,
+                              bvec2str(in), expected, got);
+            }
             {
                 bool got = check_if_accept(rgr, rin);
                 if (expected != got)
@@ -1,5 +1,22 @@
 #include "tfhepp_util.hpp"
 #include "archive.hpp"
+#include "error.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <execution>
+#include <filesystem>
+#include <numeric>
+#include <random>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 ////////// TRGSWLvl1FFTSerializer
 
@@ -24,18 +41,13 @@ void TRGSWLvl1FFTSerializer::save_binary(const void* data, size_t size)
     assert(written_size == size);
 }
 
-void TRGSWLvl1FFTSerializer::save_double(double src)
-{
-    static_assert(std::numeric_limits<double>::is_iec559);
-    save_binary(&src, sizeof(src));
-}
-
 void TRGSWLvl1FFTSerializer::save(const TRGSWLvl1FFT& src)
 {
-    for (size_t i = 0; i < 2 * Lvl1::l; i++)
-        for (size_t j = 0; j < 2; j++)
-            for (size_t k = 0; k < Lvl1::n; k++)
-                save_double(src[i][j][k]);
+    // The doubles of src are contiguous, so write them all at once instead
+    // of one by one
+    static_assert(std::numeric_limits<double>::is_iec559);
+    static_assert(sizeof(src) == TRGSWLvl1FFTDeserializer::BLOCK_SIZE);
+    save_binary(src.data(), sizeof(src));
 }
 
 ////////// TRGSWLvl1FFTDeserializer
@@ -60,12 +72,6 @@ void TRGSWLvl1FFTDeserializer::load_binary(void* const data, size_t size)
     assert(read_size == size);
 }
 
-void TRGSWLvl1FFTDeserializer::load_double(double& out)
-{
-    static_assert(std::numeric_limits<double>::is_iec559);
-    load_binary(&out, sizeof(out));
-}
-
 size_t TRGSWLvl1FFTDeserializer::tell() const
 {
     size_t org = is_.tellg();
@@ -90,93 +96,1135 @@ void TRGSWLvl1FFTDeserializer::seek(int off, std::ios_base::seekdir dir)
 
 void TRGSWLvl1FFTDeserializer::load(TRGSWLvl1FFT& out)
 {
-    for (size_t i = 0; i < 2 * Lvl1::l; i++)
-        for (size_t j = 0; j < 2; j++)
-            for (size_t k = 0; k < Lvl1::n; k++)
-                load_double(out[i][j][k]);
+    static_assert(std::numeric_limits<double>::is_iec559);
+    static_assert(sizeof(out) == BLOCK_SIZE);
+    load_binary(out.data(), sizeof(out));
 }
 
-////////// TRGSWLvl1InputStreamFromCtxtFile
+////////// TRGSWLvl1Seeded
 
-TRGSWLvl1InputStreamFromCtxtFile::TRGSWLvl1InputStreamFromCtxtFile(
-    const std::string& filename)
-    : ifs_(filename),
-      deser_(ifs_),
-      pool_(1),
-      running_(),
-      loaded_(),
-      current_size_()
+namespace {
+uint32_t rotl32(uint32_t x, int n)
 {
-    deser_.seek(0, std::ios_base::end);
-    current_size_ = deser_.tell();
-    deser_.seek(0, std::ios_base::beg);
-    if (current_size_ > 0)
-        start_loading_next();
+    return (x << n) | (x >> (32 - n));
 }
 
-size_t TRGSWLvl1InputStreamFromCtxtFile::size() const
+// ChaCha20 block function with 64-bit block counter and 64-bit nonce, as
+// in the original design by Bernstein
+void chacha20_block(std::array<uint32_t, 16>& out, const TRGSWLvl1Seed& key,
+                    uint64_t counter, uint64_t nonce)
 {
-    return current_size_;
+    const std::array<uint32_t, 16> in = {
+        0x61707865,
+        0x3320646e,
+        0x79622d32,
+        0x6b206574,
+        key[0],
+        key[1],
+        key[2],
+        key[3],
+        key[4],
+        key[5],
+        key[6],
+        key[7],
+        static_cast<uint32_t>(counter),
+        static_cast<uint32_t>(counter >> 32),
+        static_cast<uint32_t>(nonce),
+        static_cast<uint32_t>(nonce >> 32),
+    };
+    std::array<uint32_t, 16>& x = out;
+    x = in;
+    auto quarter_round = [&x](size_t a, size_t b, size_t c, size_t d) {
+        x[a] += x[b];
+        x[d] = rotl32(x[d] ^ x[a], 16);
+        x[c] += x[d];
+        x[b] = rotl32(x[b] ^ x[c], 12);
+        x[a] += x[b];
+        x[d] = rotl32(x[d] ^ x[a], 8);
+        x[c] += x[d];
+        x[b] = rotl32(x[b] ^ x[c], 7);
+    };
+    for (size_t i = 0; i < 10; i++) {
+        quarter_round(0, 4, 8, 12);
+        quarter_round(1, 5, 9, 13);
+        quarter_round(2, 6, 10, 14);
+        quarter_round(3, 7, 11, 15);
+        quarter_round(0, 5, 10, 15);
+        quarter_round(1, 6, 11, 12);
+        quarter_round(2, 7, 8, 13);
+        quarter_round(3, 4, 9, 14);
+    }
+    for (size_t i = 0; i < 16; i++)
+        x[i] += in[i];
 }
 
-void TRGSWLvl1InputStreamFromCtxtFile::start_loading_next()
+// The a polynomial of the row-th TRLWE of the index-th TRGSW, which is the
+// key stream of ChaCha20 with index as the nonce
+void seeded_a(PolyLvl1& a, const TRGSWLvl1Seed& seed, uint64_t index,
+              size_t row)
 {
-    assert(!running_.valid());
-    running_ = pool_.enqueue([this] {
-        deser_.load(loaded_);
-        return true;
-    });
+    constexpr size_t blocks_per_row = Lvl1::n / 16;
+    static_assert(Lvl1::n % 16 == 0);
+    std::array<uint32_t, 16> block;
+    for (size_t k = 0; k < blocks_per_row; k++) {
+        chacha20_block(block, seed, row * blocks_per_row + k, index);
+        std::copy(block.begin(), block.end(), a.begin() + k * 16);
+    }
 }
+}  // namespace
 
-TRGSWLvl1FFT TRGSWLvl1InputStreamFromCtxtFile::next()
+TRGSWLvl1Seed random_TRGSWLvl1Seed()
 {
-    assert(current_size_ > 0);
-    running_.get();
-    TRGSWLvl1FFT ret = loaded_;
-    current_size_--;
-    if (current_size_ > 0)
-        start_loading_next();
+    std::random_device rd;
+    TRGSWLvl1Seed ret;
+    for (uint32_t& w : ret)
+        w = rd();
     return ret;
 }
 
+TRGSWLvl1Seeded encrypt_bit_to_TRGSWLvl1Seeded(bool b,
+                                               const TRGSWLvl1Seed& seed,
+                                               uint64_t index,
+                                               const SecretKey& skey)
+{
+    // Same as TFHEpp::trgswSymEncrypt except for a. TFHEpp adds the message
+    // times h to a in the first l rows, which cannot be done here since a is
+    // fixed by the seed. Instead, subtract the message times h times the key
+    // from b. The result is the same as if a had been (a - mu h).
+    const TFHEpp::Key<Lvl1>& key = skey.key.lvl1;
+    thread_local std::random_device rd;
+    std::normal_distribution<double> noise{0., Lvl1::α};
+
+    TRGSWLvl1Seeded ret;
+    PolyLvl1 a, as;
+    for (size_t row = 0; row < 2 * Lvl1::l; row++) {
+        seeded_a(a, seed, index, row);
+        TFHEpp::PolyMul<Lvl1>(as, a, key);
+        for (size_t j = 0; j < Lvl1::n; j++) {
+            double e = noise(rd) * std::pow(2., 32);
+            ret[row][j] = as[j] + static_cast<uint32_t>(std::llround(e));
+        }
+
+        if (!b)
+            continue;
+        const size_t i = row % Lvl1::l;
+        const uint32_t h = 1u << (32 - (i + 1) * Lvl1::Bgbit);
+        if (row < Lvl1::l)
+            for (size_t j = 0; j < Lvl1::n; j++)
+                ret[row][j] -= h * key[j];
+        else
+            ret[row][0] += h;
+    }
+    return ret;
+}
+
+void expand_TRGSWLvl1Seeded(TRGSWLvl1FFT& out, const TRGSWLvl1Seeded& src,
+                            const TRGSWLvl1Seed& seed, uint64_t index)
+{
+    PolyLvl1 a;
+    for (size_t row = 0; row < 2 * Lvl1::l; row++) {
+        seeded_a(a, seed, index, row);
+        TFHEpp::TwistIFFT<Lvl1>(out[row][0], a);
+        TFHEpp::TwistIFFT<Lvl1>(out[row][1], src[row]);
+    }
+}
+
+////////// TRGSWLvl1CtxtFile
+
+namespace {
+using FORMAT = TRGSWLvl1CtxtFile::FORMAT;
+
+// Header of a container of TRGSWLvl1CtxtFile. The seed is used only by
+// FORMAT::SEEDED.
+struct CtxtFileHeader {
+    std::array<char, 8> magic;
+    uint32_t format, num_ap, n, l, Bgbit, records_per_chunk;
+    TRGSWLvl1Seed seed;
+    std::array<char, 64> reserved;
+};
+static_assert(sizeof(CtxtFileHeader) == 128);
+constexpr std::array<char, 8> CTXT_MAGIC = {'H', 'F', 'C', 'T',
+                                            'X', 'T', '0', '1'};
+
+// Header of each chunk, which is followed by records_per_chunk records.
+// Records after num_bits are filled with zeros.
+struct ChunkHeader {
+    uint64_t num_bits, checksum;
+    std::array<char, 48> reserved;
+};
+static_assert(sizeof(ChunkHeader) == 64);
+
+size_t record_size_of(FORMAT format)
+{
+    switch (format) {
+    case FORMAT::FFT:
+        return sizeof(TRGSWLvl1FFT);
+    case FORMAT::SEEDED:
+        return sizeof(TRGSWLvl1Seeded);
+    case FORMAT::PACKED:
+        return sizeof(TRLWELvl1);
+    }
+    assert(false);
+    return 0;
+}
+
+size_t bits_per_record_of(FORMAT format)
+{
+    return format == FORMAT::PACKED ? Lvl1::n : 1;
+}
+
+// About 1.5 MiB for FFT and SEEDED, and 128 KiB for PACKED
+size_t default_records_per_chunk(FORMAT format)
+{
+    switch (format) {
+    case FORMAT::FFT:
+        return 16;
+    case FORMAT::SEEDED:
+        return 64;
+    case FORMAT::PACKED:
+        return 16;
+    }
+    assert(false);
+    return 0;
+}
+
+// FNV-1a over 64-bit words
+uint64_t checksum(const char* data, size_t size)
+{
+    assert(size % sizeof(uint64_t) == 0);
+    uint64_t ret = 0xcbf29ce484222325;
+    for (size_t i = 0; i < size; i += sizeof(uint64_t)) {
+        uint64_t w;
+        std::memcpy(&w, data + i, sizeof(w));
+        ret = (ret ^ w) * 0x100000001b3;
+    }
+    return ret;
+}
+
+void check_header(const CtxtFileHeader& header, const std::string& filename)
+{
+    if (header.n != Lvl1::n || header.l != Lvl1::l ||
+        header.Bgbit != Lvl1::Bgbit)
+        error_die("Ciphertext file {} has different parameters: n={} l={} "
+                  "Bgbit={}",
+                  filename, header.n, header.l, header.Bgbit);
+    if (header.format > static_cast<uint32_t>(FORMAT::PACKED) ||
+        header.records_per_chunk == 0)
+        error_die("Invalid header of ciphertext file {}", filename);
+}
+
+// Map the whole file read-only. Return nullptr if the file is empty.
+const char* map_file(const std::string& filename, size_t& length)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        error_die("Could not open {}: {}", filename, std::strerror(errno));
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+        error_die("Could not stat {}: {}", filename, std::strerror(errno));
+    length = st.st_size;
+    void* addr = nullptr;
+    if (length > 0) {
+        addr = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr == MAP_FAILED)
+            error_die("Could not map {}: {}", filename, std::strerror(errno));
+    }
+    // The mapping stays valid after closing the file
+    close(fd);
+    return static_cast<const char*>(addr);
+}
+
+// Round [begin, end) in bytes outward to pages, as madvise requires
+void madvise_bytes(const void* base, size_t begin, size_t end, int advice)
+{
+    static const size_t page_size = sysconf(_SC_PAGESIZE);
+    begin = begin / page_size * page_size;
+    end = (end + page_size - 1) / page_size * page_size;
+    if (begin >= end)
+        return;
+    // Advice is only a hint, so ignore failures
+    madvise(const_cast<char*>(static_cast<const char*>(base)) + begin,
+            end - begin, advice);
+}
+}  // namespace
+
+TRGSWLvl1CtxtFile::TRGSWLvl1CtxtFile(const std::string& filename)
+    : filename_(filename),
+      addr_(nullptr),
+      length_(0),
+      record_size_(sizeof(TRGSWLvl1FFT)),
+      bits_per_record_(1),
+      records_per_chunk_(0),
+      size_(0),
+      format_(FORMAT::FFT),
+      num_ap_(),
+      seed_(),
+      chunks_()
+{
+    static_assert(sizeof(TRGSWLvl1FFT) == TRGSWLvl1FFTDeserializer::BLOCK_SIZE);
+
+    addr_ = map_file(filename, length_);
+
+    if (length_ < sizeof(CtxtFileHeader) ||
+        !std::equal(CTXT_MAGIC.begin(), CTXT_MAGIC.end(), addr_)) {
+        // Written by TRGSWLvl1FFTSerializer. Regard the whole file as a chunk
+        // without checksum.
+        if (length_ % record_size_ != 0)
+            error_die("Invalid size of ciphertext file {}: {}", filename,
+                      length_);
+        size_ = records_per_chunk_ = length_ / record_size_;
+        if (size_ > 0)
+            chunks_.push_back(Chunk{0, 0, std::nullopt});
+        return;
+    }
+
+    CtxtFileHeader header;
+    std::memcpy(&header, addr_, sizeof(header));
+    check_header(header, filename);
+    format_ = static_cast<FORMAT>(header.format);
+    num_ap_ = header.num_ap;
+    seed_ = header.seed;
+    record_size_ = record_size_of(format_);
+    bits_per_record_ = bits_per_record_of(format_);
+    records_per_chunk_ = header.records_per_chunk;
+
+    // Index the chunks. Bytes after the last complete chunk are being
+    // written, so ignore them.
+    const size_t payload_size = records_per_chunk_ * record_size_,
+                 chunk_size = sizeof(ChunkHeader) + payload_size;
+    for (size_t offset = sizeof(CtxtFileHeader);
+         offset + chunk_size <= length_; offset += chunk_size) {
+        ChunkHeader ch;
+        std::memcpy(&ch, addr_ + offset, sizeof(ch));
+        const bool is_last = offset + 2 * chunk_size > length_;
+        if (ch.num_bits == 0 ||
+            ch.num_bits > records_per_chunk_ * bits_per_record_) {
+            if (!is_last)
+                error_die("Invalid chunk {} of ciphertext file {}",
+                          chunks_.size(), filename);
+            spdlog::warn("Ignore incomplete last chunk of {}", filename);
+            break;
+        }
+        chunks_.push_back(Chunk{offset + sizeof(ch), size_, ch.checksum});
+        size_ += ch.num_bits;
+    }
+
+    // The last chunk may have been only partially written when the file
+    // was mapped
+    if (!chunks_.empty() &&
+        checksum(addr_ + chunks_.back().offset, payload_size) !=
+            chunks_.back().checksum) {
+        spdlog::warn("Ignore incomplete last chunk of {}", filename);
+        size_ = chunks_.back().begin;
+        chunks_.pop_back();
+    }
+}
+
+TRGSWLvl1CtxtFile::~TRGSWLvl1CtxtFile()
+{
+    if (addr_)
+        munmap(const_cast<char*>(addr_), length_);
+}
+
+std::tuple<size_t, size_t, size_t> TRGSWLvl1CtxtFile::locate(size_t i) const
+{
+    const size_t k = chunk_of(i), j = i - chunks_.at(k).begin,
+                 rec = j / bits_per_record_;
+    return {chunks_.at(k).offset + rec * record_size_,
+            k * records_per_chunk_ + rec, j % bits_per_record_};
+}
+
+std::pair<size_t, size_t> TRGSWLvl1CtxtFile::byte_range(size_t begin,
+                                                        size_t end) const
+{
+    end = std::min(end, size_);
+    if (begin >= end)
+        return {0, 0};
+    return {std::get<0>(locate(begin)),
+            std::get<0>(locate(end - 1)) + record_size_};
+}
+
+size_t TRGSWLvl1CtxtFile::chunk_of(size_t i) const
+{
+    assert(i < size_);
+    auto it = std::upper_bound(
+        chunks_.begin(), chunks_.end(), i,
+        [](size_t i, const Chunk& chunk) { return i < chunk.begin; });
+    return std::distance(chunks_.begin(), it) - 1;
+}
+
+void TRGSWLvl1CtxtFile::verify_chunk(size_t k) const
+{
+    const Chunk& chunk = chunks_.at(k);
+    if (chunk.checksum &&
+        checksum(addr_ + chunk.offset, records_per_chunk_ * record_size_) !=
+            *chunk.checksum)
+        error_die("Checksum mismatch in chunk {} of ciphertext file {}", k,
+                  filename_);
+}
+
+const TRGSWLvl1FFT& TRGSWLvl1CtxtFile::at(size_t i) const
+{
+    assert(format_ == FORMAT::FFT && i < size_);
+    return *reinterpret_cast<const TRGSWLvl1FFT*>(addr_ +
+                                                  std::get<0>(locate(i)));
+}
+
+void TRGSWLvl1CtxtFile::expand_seeded(TRGSWLvl1FFT& out, size_t i) const
+{
+    assert(format_ == FORMAT::SEEDED && i < size_);
+    auto [offset, index, pos] = locate(i);
+    const TRGSWLvl1Seeded& src =
+        *reinterpret_cast<const TRGSWLvl1Seeded*>(addr_ + offset);
+    expand_TRGSWLvl1Seeded(out, src, seed_, index);
+}
+
+void TRGSWLvl1CtxtFile::expand_packed(TRGSWLvl1FFT& out, size_t i,
+                                      const EvalKey& ek) const
+{
+    assert(format_ == FORMAT::PACKED && i < size_);
+    auto [offset, index, pos] = locate(i);
+    const TRLWELvl1& src = *reinterpret_cast<const TRLWELvl1*>(addr_ + offset);
+    TLWELvl1 tlwe;
+    TFHEpp::SampleExtractIndex<Lvl1>(tlwe, src, pos);
+    CircuitBootstrappingFFTLvl11(out, tlwe, ek);
+}
+
+void TRGSWLvl1CtxtFile::advise_random() const
+{
+    madvise_bytes(addr_, 0, length_, MADV_RANDOM);
+}
+
+void TRGSWLvl1CtxtFile::advise_sequential() const
+{
+    madvise_bytes(addr_, 0, length_, MADV_SEQUENTIAL);
+}
+
+void TRGSWLvl1CtxtFile::advise_will_need(size_t begin, size_t end) const
+{
+    auto [byte_begin, byte_end] = byte_range(begin, end);
+    madvise_bytes(addr_, byte_begin, byte_end, MADV_WILLNEED);
+}
+
+void TRGSWLvl1CtxtFile::advise_dont_need(size_t begin, size_t end) const
+{
+    end = std::min(end, size_);
+    if (begin >= end)
+        return;
+    // Keep the records partially in [begin, end) since they have other bits
+    if (bits_per_record_ != 1) {
+        if (size_t pos = std::get<2>(locate(begin)); pos != 0)
+            begin += bits_per_record_ - pos;
+        if (end < size_)
+            end -= std::get<2>(locate(end));
+        if (begin >= end)
+            return;
+    }
+    auto [byte_begin, byte_end] = byte_range(begin, end);
+    madvise_bytes(addr_, byte_begin, byte_end, MADV_DONTNEED);
+}
+
+////////// TRGSWLvl1CtxtFileWriter
+
+TRGSWLvl1CtxtFileWriter::TRGSWLvl1CtxtFileWriter(
+    const std::string& filename, TRGSWLvl1CtxtFile::FORMAT format,
+    size_t num_ap, const SecretKey& skey, bool append,
+    std::optional<size_t> records_per_chunk)
+    : ofs_(),
+      format_(format),
+      skey_(skey),
+      seed_(),
+      record_size_(record_size_of(format)),
+      bits_per_record_(bits_per_record_of(format)),
+      records_per_chunk_(
+          records_per_chunk.value_or(default_records_per_chunk(format))),
+      num_chunks_(0),
+      num_pending_(0),
+      chunk_(records_per_chunk_ * record_size_, 0),
+      packed_()
+{
+    // Assume little endian as TRGSWLvl1FFTSerializer does
+    static std::int32_t test = 1;
+    assert(*reinterpret_cast<std::int8_t*>(&test) == 1);
+    assert(records_per_chunk_ > 0);
+
+    std::error_code ec;
+    if (append && std::filesystem::file_size(filename, ec) > 0 && !ec) {
+        size_t valid_size = 0;
+        {
+            TRGSWLvl1CtxtFile file{filename};
+            if (!file.num_ap_)
+                error_die("Cannot append to {} since it is not a container",
+                          filename);
+            if (file.format_ != format_ || *file.num_ap_ != num_ap)
+                error_die("Cannot append to {} of different format or # of "
+                          "APs",
+                          filename);
+            if (records_per_chunk &&
+                *records_per_chunk != file.records_per_chunk_)
+                error_die("Cannot append to {} of {} records per chunk",
+                          filename, file.records_per_chunk_);
+            seed_ = file.seed_;
+            records_per_chunk_ = file.records_per_chunk_;
+            num_chunks_ = file.chunks_.size();
+            chunk_.resize(records_per_chunk_ * record_size_);
+            valid_size = sizeof(CtxtFileHeader) +
+                         num_chunks_ * (sizeof(ChunkHeader) + chunk_.size());
+        }
+        // Drop the incomplete last chunk left by a writer that was killed
+        if (std::filesystem::file_size(filename) > valid_size) {
+            spdlog::warn("Truncate {} to {} bytes", filename, valid_size);
+            std::filesystem::resize_file(filename, valid_size);
+        }
+        ofs_.open(filename, std::ios_base::binary | std::ios_base::app);
+        if (!ofs_)
+            error_die("Could not open {}", filename);
+        return;
+    }
+
+    ofs_.open(filename, std::ios_base::binary | std::ios_base::trunc);
+    if (!ofs_)
+        error_die("Could not open {}", filename);
+    if (format_ == TRGSWLvl1CtxtFile::FORMAT::SEEDED)
+        seed_ = random_TRGSWLvl1Seed();
+    CtxtFileHeader header = {};
+    header.magic = CTXT_MAGIC;
+    header.format = static_cast<uint32_t>(format_);
+    header.num_ap = num_ap;
+    header.n = Lvl1::n;
+    header.l = Lvl1::l;
+    header.Bgbit = Lvl1::Bgbit;
+    header.records_per_chunk = records_per_chunk_;
+    header.seed = seed_;
+    ofs_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    ofs_.flush();
+    assert(ofs_);
+}
+
+void TRGSWLvl1CtxtFileWriter::write_record(size_t r, const void* src)
+{
+    assert(r < records_per_chunk_);
+    std::memcpy(chunk_.data() + r * record_size_, src, record_size_);
+}
+
+void TRGSWLvl1CtxtFileWriter::write_chunk()
+{
+    if (num_pending_ == 0)
+        return;
+
+    if (format_ == TRGSWLvl1CtxtFile::FORMAT::PACKED &&
+        num_pending_ % bits_per_record_ != 0) {
+        // The rest of the last TRLWE is never read. Fill it with bit 0.
+        std::fill(packed_.begin() + num_pending_ % bits_per_record_,
+                  packed_.end(), -Lvl1::μ);
+        const TRLWELvl1 c =
+            TFHEpp::trlweSymEncrypt<Lvl1>(packed_, Lvl1::α, skey_.key.lvl1);
+        write_record(num_pending_ / bits_per_record_, &c);
+    }
+
+    ChunkHeader header = {};
+    header.num_bits = num_pending_;
+    header.checksum = checksum(chunk_.data(), chunk_.size());
+    ofs_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    ofs_.write(chunk_.data(), chunk_.size());
+    // Make the chunk visible to readers tailing the file
+    ofs_.flush();
+    assert(ofs_);
+
+    std::fill(chunk_.begin(), chunk_.end(), 0);
+    num_chunks_++;
+    num_pending_ = 0;
+}
+
+void TRGSWLvl1CtxtFileWriter::save_bit(bool b)
+{
+    const size_t r = num_pending_ / bits_per_record_;
+    switch (format_) {
+    case TRGSWLvl1CtxtFile::FORMAT::FFT: {
+        const TRGSWLvl1FFT c = encrypt_bit_to_TRGSWLvl1FFT(b, skey_);
+        write_record(r, &c);
+        break;
+    }
+    case TRGSWLvl1CtxtFile::FORMAT::SEEDED: {
+        const TRGSWLvl1Seeded c = encrypt_bit_to_TRGSWLvl1Seeded(
+            b, seed_, num_chunks_ * records_per_chunk_ + r, skey_);
+        write_record(r, &c);
+        break;
+    }
+    case TRGSWLvl1CtxtFile::FORMAT::PACKED: {
+        const size_t pos = num_pending_ % bits_per_record_;
+        packed_[pos] = b ? Lvl1::μ : -Lvl1::μ;  // 1/8 : -1/8
+        if (pos + 1 == bits_per_record_) {
+            const TRLWELvl1 c = TFHEpp::trlweSymEncrypt<Lvl1>(
+                packed_, Lvl1::α, skey_.key.lvl1);
+            write_record(r, &c);
+        }
+        break;
+    }
+    }
+
+    num_pending_++;
+    if (num_pending_ == records_per_chunk_ * bits_per_record_)
+        write_chunk();
+}
+
+void TRGSWLvl1CtxtFileWriter::flush()
+{
+    write_chunk();
+}
+
+////////// TRGSWLvl1Expander
+
+TRGSWLvl1Expander::TRGSWLvl1Expander(const TRGSWLvl1CtxtFile& file,
+                                     std::shared_ptr<const EvalKey> ekey,
+                                     bool reversed, size_t read_ahead)
+    : file_(file),
+      ekey_(std::move(ekey)),
+      reversed_(reversed),
+      read_ahead_(read_ahead),
+      // The previous, the current, and the next window
+      ring_(std::min(3 * read_ahead, file.size())),
+      next_window_()
+{
+    assert(file_.format() != TRGSWLvl1CtxtFile::FORMAT::FFT);
+    assert(read_ahead_ > 0);
+    if (file_.format() == TRGSWLvl1CtxtFile::FORMAT::PACKED && !ekey_)
+        error_die("Packed ciphertexts need the bootstrapping key");
+}
+
+void TRGSWLvl1Expander::expand_window(size_t window)
+{
+    const size_t begin = window * read_ahead_,
+                 end = std::min(begin + read_ahead_, file_.size());
+    tbb::parallel_for(begin, end, [&](size_t count) {
+        size_t i = reversed_ ? file_.size() - 1 - count : count;
+        TRGSWLvl1FFT& out = ring_.at(count % ring_.size());
+        if (file_.format() == TRGSWLvl1CtxtFile::FORMAT::PACKED)
+            file_.expand_packed(out, i, *ekey_);
+        else
+            file_.expand_seeded(out, i);
+    });
+}
+
+const TRGSWLvl1FFT& TRGSWLvl1Expander::get(size_t count)
+{
+    assert(count < file_.size());
+    if (count % read_ahead_ == 0) {
+        const size_t window = count / read_ahead_;
+        if (next_window_.valid())
+            next_window_.get();
+        else
+            expand_window(window);
+        if ((window + 1) * read_ahead_ < file_.size())
+            next_window_ = std::async(std::launch::async, [this, window] {
+                expand_window(window + 1);
+            });
+    }
+    return ring_.at(count % ring_.size());
+}
+
+////////// TRGSWLvl1InputStreamFromCtxtFile
+
+TRGSWLvl1InputStreamFromCtxtFile::TRGSWLvl1InputStreamFromCtxtFile(
+    const std::string& filename, std::shared_ptr<const EvalKey> ekey,
+    size_t read_ahead)
+    : file_(filename),
+      head_(0),
+      read_ahead_(read_ahead),
+      expander_(),
+      verified_chunk_()
+{
+    assert(read_ahead_ > 0);
+    if (file_.format() != TRGSWLvl1CtxtFile::FORMAT::FFT)
+        expander_.emplace(file_, std::move(ekey), false, read_ahead_);
+    file_.advise_sequential();
+    file_.advise_will_need(0, read_ahead_);
+}
+
+size_t TRGSWLvl1InputStreamFromCtxtFile::size() const
+{
+    return file_.size() - head_;
+}
+
+const TRGSWLvl1FFT& TRGSWLvl1InputStreamFromCtxtFile::next()
+{
+    assert(size() > 0);
+    // Once per read_ahead_ inputs, request the next window and drop the one
+    // before the previous, so that at least the last read_ahead_ inputs stay
+    // in memory
+    if (head_ % read_ahead_ == 0) {
+        file_.advise_will_need(head_ + read_ahead_, head_ + 2 * read_ahead_);
+        if (head_ >= 2 * read_ahead_)
+            file_.advise_dont_need(head_ - 2 * read_ahead_,
+                                   head_ - read_ahead_);
+    }
+    // Verify each chunk when the first input in it is read
+    if (size_t k = file_.chunk_of(head_); k != verified_chunk_) {
+        file_.verify_chunk(k);
+        verified_chunk_ = k;
+    }
+    if (expander_)
+        return expander_->get(head_++);
+    return file_.at(head_++);
+}
+
 ////////// ReversedTRGSWLvl1InputStreamFromCtxtFile
 
 ReversedTRGSWLvl1InputStreamFromCtxtFile::
-    ReversedTRGSWLvl1InputStreamFromCtxtFile(const std::string& filename)
-    : ifs_(filename), deser_(ifs_), pool_(1), current_size_(0)
+    ReversedTRGSWLvl1InputStreamFromCtxtFile(
+        const std::string& filename, std::shared_ptr<const EvalKey> ekey,
+        size_t read_ahead)
+    : file_(filename),
+      head_(file_.size()),
+      read_ahead_(read_ahead),
+      expander_(),
+      verified_chunk_()
 {
-    deser_.seek(0, std::ios_base::end);
-    current_size_ = deser_.tell();
-    if (!deser_.is_beg())
-        start_loading_next();
+    assert(read_ahead_ > 0);
+    if (file_.format() != TRGSWLvl1CtxtFile::FORMAT::FFT)
+        expander_.emplace(file_, std::move(ekey), true, read_ahead_);
+    // The kernel reads ahead only forward, so disable it and request the
+    // pages behind the head instead
+    file_.advise_random();
+    file_.advise_will_need(head_ - std::min(head_, read_ahead_), head_);
 }
 
 size_t ReversedTRGSWLvl1InputStreamFromCtxtFile::size() const
 {
-    return current_size_;
+    return head_;
+}
+
+const TRGSWLvl1FFT& ReversedTRGSWLvl1InputStreamFromCtxtFile::next()
+{
+    assert(head_ > 0);
+    const size_t read = file_.size() - head_;
+    if (read % read_ahead_ == 0) {
+        size_t end = head_ - std::min(head_, read_ahead_),
+               begin = end - std::min(end, read_ahead_);
+        file_.advise_will_need(begin, end);
+        if (read >= 2 * read_ahead_)
+            file_.advise_dont_need(head_ + read_ahead_,
+                                   head_ + 2 * read_ahead_);
+    }
+    head_--;
+    if (size_t k = file_.chunk_of(head_); k != verified_chunk_) {
+        file_.verify_chunk(k);
+        verified_chunk_ = k;
+    }
+    if (expander_)
+        return expander_->get(read);
+    return file_.at(head_);
+}
+
+////////// TRGSWLvl1InputStreamFromPipe
+
+TRGSWLvl1InputStreamFromPipe::TRGSWLvl1InputStreamFromPipe(
+    const std::string& filename, std::shared_ptr<const EvalKey> ekey,
+    size_t read_ahead, std::optional<double> follow)
+    : filename_(filename),
+      fd_(-1),
+      follow_(follow),
+      ekey_(std::move(ekey)),
+      read_ahead_(read_ahead),
+      is_raw_(false),
+      format_(TRGSWLvl1CtxtFile::FORMAT::FFT),
+      num_ap_(),
+      seed_(),
+      record_size_(sizeof(TRGSWLvl1FFT)),
+      bits_per_record_(1),
+      records_per_chunk_(1),
+      prefix_(),
+      io_(std::make_unique<AsyncIO>()),
+      buf_(sizeof(TRGSWLvl1FFT)),
+      buf_begin_(0),
+      buf_end_(0),
+      buf_capacity_(buf_.size()),
+      pending_(),
+      chunk_(),
+      chunk_bits_(0),
+      chunk_expanded_(0),
+      chunk_index_(0),
+      is_end_(false),
+      ring_(2 * read_ahead),
+      head_(0),
+      num_expanded_(0)
+{
+    assert(read_ahead_ > 0);
+
+    // Opening a named pipe waits for the writer
+    fd_ = filename == "-" ? STDIN_FILENO : open(filename.c_str(), O_RDONLY);
+    if (fd_ < 0)
+        error_die("Could not open {}: {}", filename, std::strerror(errno));
+
+    CtxtFileHeader header;
+    char* const buf = reinterpret_cast<char*>(&header);
+    if (!read_exactly(buf, sizeof(header.magic))) {
+        // Empty input
+        is_raw_ = true;
+        is_end_ = true;
+    }
+    else if (header.magic == CTXT_MAGIC) {
+        if (!read_exactly(buf + sizeof(header.magic),
+                          sizeof(header) - sizeof(header.magic)))
+            error_die("Unexpected end of {}", filename_);
+        check_header(header, filename_);
+        format_ = static_cast<TRGSWLvl1CtxtFile::FORMAT>(header.format);
+        num_ap_ = header.num_ap;
+        seed_ = header.seed;
+        record_size_ = record_size_of(format_);
+        bits_per_record_ = bits_per_record_of(format_);
+        records_per_chunk_ = header.records_per_chunk;
+        if (format_ == TRGSWLvl1CtxtFile::FORMAT::PACKED && !ekey_)
+            error_die("Packed ciphertexts need the bootstrapping key");
+    }
+    else {
+        // The bytes are the beginning of the first TRGSW
+        is_raw_ = true;
+        prefix_.assign(buf, buf + sizeof(header.magic));
+    }
+    chunk_.resize(records_per_chunk_ * record_size_);
+    // Room for the next chunk with its header
+    buf_capacity_ = sizeof(ChunkHeader) + chunk_.size();
+}
+
+TRGSWLvl1InputStreamFromPipe::~TRGSWLvl1InputStreamFromPipe()
+{
+    // Cancel the pending read before closing the file it reads
+    io_.reset();
+    if (fd_ != STDIN_FILENO)
+        close(fd_);
+}
+
+void TRGSWLvl1InputStreamFromPipe::refill()
+{
+    if (pending_.valid())
+        return;
+    if (buf_begin_ == buf_end_)
+        buf_begin_ = buf_end_ = 0;
+    if (buf_.size() < buf_capacity_ || buf_end_ == buf_.size()) {
+        std::memmove(buf_.data(), buf_.data() + buf_begin_,
+                     buf_end_ - buf_begin_);
+        buf_end_ -= buf_begin_;
+        buf_begin_ = 0;
+        buf_.resize(std::max(buf_.size(), buf_capacity_));
+    }
+    if (buf_end_ < buf_.size())
+        pending_ = io_->read(fd_, buf_.data() + buf_end_,
+                             buf_.size() - buf_end_);
+}
+
+bool TRGSWLvl1InputStreamFromPipe::read_exactly(char* buf, size_t size)
+{
+    size_t done = std::min(size, prefix_.size());
+    std::copy(prefix_.begin(), prefix_.begin() + done, buf);
+    prefix_.erase(prefix_.begin(), prefix_.begin() + done);
+
+    auto last_progress = std::chrono::steady_clock::now();
+    while (true) {
+        const size_t n = std::min(size - done, buf_end_ - buf_begin_);
+        std::memcpy(buf + done, buf_.data() + buf_begin_, n);
+        buf_begin_ += n;
+        done += n;
+        if (done == size)
+            break;
+
+        // buf_ is empty. Wait for the pending read.
+        refill();
+        const ssize_t res = pending_.get();
+        if (res < 0) {
+            if (res == -EINTR)
+                continue;
+            error_die("Could not read {}: {}", filename_,
+                      std::strerror(-res));
+        }
+        if (res > 0) {
+            buf_end_ += res;
+            last_progress = std::chrono::steady_clock::now();
+            continue;
+        }
+
+        // EOF. Wait for the writer to append more if follow_ is given.
+        const std::chrono::duration<double> idle =
+            std::chrono::steady_clock::now() - last_progress;
+        if (follow_ && idle.count() < *follow_) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            continue;
+        }
+        if (done == 0)
+            return false;
+        error_die("Unexpected end of {}", filename_);
+    }
+    // Read the following bytes while the caller computes
+    refill();
+    return true;
+}
+
+bool TRGSWLvl1InputStreamFromPipe::read_chunk()
+{
+    if (is_raw_) {
+        if (!read_exactly(chunk_.data(), chunk_.size()))
+            return false;
+        chunk_bits_ = 1;
+    }
+    else {
+        ChunkHeader header;
+        if (!read_exactly(reinterpret_cast<char*>(&header), sizeof(header)))
+            return false;
+        if (header.num_bits == 0 ||
+            header.num_bits > records_per_chunk_ * bits_per_record_)
+            error_die("Invalid chunk {} of {}", chunk_index_, filename_);
+        if (!read_exactly(chunk_.data(), chunk_.size()))
+            error_die("Unexpected end of {}", filename_);
+        if (checksum(chunk_.data(), chunk_.size()) != header.checksum)
+            error_die("Checksum mismatch in chunk {} of {}", chunk_index_,
+                      filename_);
+        chunk_bits_ = header.num_bits;
+    }
+    chunk_expanded_ = 0;
+    chunk_index_++;
+    return true;
 }
 
-void ReversedTRGSWLvl1InputStreamFromCtxtFile::start_loading_next()
+void TRGSWLvl1InputStreamFromPipe::expand_window()
 {
-    assert(!running_.valid());
-    running_ = pool_.enqueue([this] {
-        assert(!deser_.is_beg());
-        deser_.seek(-1, std::ios_base::cur);
-        deser_.load(loaded_);
-        deser_.seek(-1, std::ios_base::cur);
+    // Expand only the TRGSWs that have arrived, so that the caller does not
+    // wait for more inputs than it reads
+    const size_t begin = num_expanded_,
+                 size = std::min(read_ahead_, chunk_bits_ - chunk_expanded_);
+    const size_t chunk = chunk_index_ - 1;
+    tbb::parallel_for(size_t(0), size, [&](size_t t) {
+        const size_t j = chunk_expanded_ + t, rec = j / bits_per_record_;
+        const char* src = chunk_.data() + rec * record_size_;
+        TRGSWLvl1FFT& out = ring_.at((begin + t) % ring_.size());
+        switch (format_) {
+        case TRGSWLvl1CtxtFile::FORMAT::FFT:
+            std::memcpy(&out, src, sizeof(out));
+            break;
+        case TRGSWLvl1CtxtFile::FORMAT::SEEDED:
+            expand_TRGSWLvl1Seeded(
+                out, *reinterpret_cast<const TRGSWLvl1Seeded*>(src), seed_,
+                chunk * records_per_chunk_ + rec);
+            break;
+        case TRGSWLvl1CtxtFile::FORMAT::PACKED: {
+            TLWELvl1 tlwe;
+            TFHEpp::SampleExtractIndex<Lvl1>(
+                tlwe, *reinterpret_cast<const TRLWELvl1*>(src),
+                j % bits_per_record_);
+            CircuitBootstrappingFFTLvl11(out, tlwe, *ekey_);
+            break;
+        }
+        }
+    });
+    chunk_expanded_ += size;
+    num_expanded_ += size;
+}
+
+size_t TRGSWLvl1InputStreamFromPipe::size() const
+{
+    return num_expanded_ - head_ + chunk_bits_ - chunk_expanded_;
+}
+
+bool TRGSWLvl1InputStreamFromPipe::has_next()
+{
+    if (size() != 0)
         return true;
+    if (is_end_)
+        return false;
+    if (!read_chunk())
+        is_end_ = true;
+    return !is_end_;
+}
+
+const TRGSWLvl1FFT& TRGSWLvl1InputStreamFromPipe::next()
+{
+    if (!has_next())
+        error_die("No more input in {}", filename_);
+    // The window is expanded only after the previous one has been read, so
+    // it does not overwrite the last read_ahead_ TRGSWs returned
+    if (head_ == num_expanded_)
+        expand_window();
+    return ring_.at(head_++ % ring_.size());
+}
+
+////////// ResultLogFile
+
+namespace {
+struct ResultLogHeader {
+    std::array<char, 8> magic;
+    uint32_t format, num_results, n;
+    std::array<char, 44> reserved;
+};
+static_assert(sizeof(ResultLogHeader) == 64);
+constexpr std::array<char, 8> RESULT_LOG_MAGIC = {'H', 'F', 'R', 'L',
+                                                  'O', 'G', '0', '1'};
+
+// Header of each record, which is followed by the result padded with zeros
+// to 8 bytes. The checksum is of the rest of the record.
+struct ResultRecordHeader {
+    uint64_t checksum, pos;
+};
+static_assert(sizeof(ResultRecordHeader) == 16);
+
+size_t result_record_size_of(ResultLogFile::FORMAT format)
+{
+    const size_t size = format == ResultLogFile::FORMAT::TLWE
+                            ? sizeof(TLWELvl1)
+                            : sizeof(TRLWELvl1);
+    return sizeof(ResultRecordHeader) +
+           (size + sizeof(uint64_t) - 1) / sizeof(uint64_t) * sizeof(uint64_t);
+}
+}  // namespace
+
+ResultLogFile::ResultLogFile(const std::string& filename)
+    : addr_(nullptr),
+      length_(0),
+      record_size_(0),
+      size_(0),
+      num_results_(0),
+      format_(FORMAT::TLWE)
+{
+    addr_ = map_file(filename, length_);
+    if (length_ < sizeof(ResultLogHeader) ||
+        !std::equal(RESULT_LOG_MAGIC.begin(), RESULT_LOG_MAGIC.end(), addr_))
+        error_die("{} is not a result log", filename);
+
+    ResultLogHeader header;
+    std::memcpy(&header, addr_, sizeof(header));
+    if (header.n != Lvl1::n)
+        error_die("Result log {} has different parameters: n={}", filename,
+                  header.n);
+    if (header.format > static_cast<uint32_t>(FORMAT::TRLWE) ||
+        header.num_results == 0)
+        error_die("Invalid header of result log {}", filename);
+    format_ = static_cast<FORMAT>(header.format);
+    num_results_ = header.num_results;
+    record_size_ = result_record_size_of(format_);
+
+    // Verify all the records at once since they are all read anyway
+    const size_t num_records = (length_ - sizeof(header)) / record_size_;
+    std::vector<uint8_t> valid(num_records);
+    tbb::parallel_for(size_t(0), num_records, [&](size_t i) {
+        const char* rec = record(i);
+        ResultRecordHeader rh;
+        std::memcpy(&rh, rec, sizeof(rh));
+        valid.at(i) = checksum(rec + sizeof(rh.checksum),
+                               record_size_ - sizeof(rh.checksum)) ==
+                      rh.checksum;
     });
+    size_ = std::distance(valid.begin(),
+                          std::find(valid.begin(), valid.end(), 0));
+    if (size_ != num_records ||
+        (length_ - sizeof(header)) % record_size_ != 0)
+        spdlog::warn("Ignore incomplete records of {} from record {}",
+                     filename, size_);
 }
 
-TRGSWLvl1FFT ReversedTRGSWLvl1InputStreamFromCtxtFile::next()
+ResultLogFile::~ResultLogFile()
 {
-    assert(current_size_ > 0);
-    running_.get();
-    TRGSWLvl1FFT ret = loaded_;
-    if (!deser_.is_beg())
-        start_loading_next();
-    current_size_--;
-    return ret;
+    if (addr_)
+        munmap(const_cast<char*>(addr_), length_);
+}
+
+bool ResultLogFile::is_result_log(const std::string& filename)
+{
+    std::ifstream ifs{filename, std::ios_base::binary};
+    std::array<char, 8> magic;
+    return ifs.read(magic.data(), magic.size()) && magic == RESULT_LOG_MAGIC;
+}
+
+const char* ResultLogFile::record(size_t i) const
+{
+    return addr_ + sizeof(ResultLogHeader) + i * record_size_;
+}
+
+uint64_t ResultLogFile::pos(size_t i) const
+{
+    assert(i < size_);
+    ResultRecordHeader rh;
+    std::memcpy(&rh, record(i), sizeof(rh));
+    return rh.pos;
+}
+
+const TLWELvl1& ResultLogFile::tlwe(size_t i) const
+{
+    assert(format_ == FORMAT::TLWE && i < size_);
+    return *reinterpret_cast<const TLWELvl1*>(record(i) +
+                                              sizeof(ResultRecordHeader));
+}
+
+const TRLWELvl1& ResultLogFile::trlwe(size_t i) const
+{
+    assert(format_ == FORMAT::TRLWE && i < size_);
+    return *reinterpret_cast<const TRLWELvl1*>(record(i) +
+                                               sizeof(ResultRecordHeader));
+}
+
+////////// ResultLogWriter
+
+ResultLogWriter::ResultLogWriter(AsyncIO& io, const std::string& filename,
+                                 ResultLogFile::FORMAT format,
+                                 size_t num_results, SYNC sync)
+    : io_(io),
+      fd_(-1),
+      format_(format),
+      sync_(sync),
+      record_size_(result_record_size_of(format)),
+      offset_(sizeof(ResultLogHeader))
+{
+    assert(num_results > 0);
+    assert(format == ResultLogFile::FORMAT::TRLWE || num_results == 1);
+
+    fd_ = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+               0644);
+    if (fd_ < 0)
+        error_die("Could not open {}: {}", filename, std::strerror(errno));
+
+    ResultLogHeader header = {};
+    header.magic = RESULT_LOG_MAGIC;
+    header.format = static_cast<uint32_t>(format_);
+    header.num_results = num_results;
+    header.n = Lvl1::n;
+    io_.write_at(fd_, 0,
+                 std::string(reinterpret_cast<const char*>(&header),
+                             sizeof(header)));
+}
+
+ResultLogWriter::~ResultLogWriter()
+{
+    if (sync_ != SYNC::NONE)
+        io_.sync(fd_);
+    io_.flush();
+    close(fd_);
+}
+
+void ResultLogWriter::append(uint64_t pos, const void* src, size_t size)
+{
+    ResultRecordHeader rh;
+    assert(sizeof(rh) + size <= record_size_);
+    std::string rec(record_size_, 0);
+    rh.pos = pos;
+    std::memcpy(rec.data() + sizeof(rh), src, size);
+    std::memcpy(rec.data() + sizeof(rh.checksum), &rh.pos, sizeof(rh.pos));
+    rh.checksum = checksum(rec.data() + sizeof(rh.checksum),
+                           record_size_ - sizeof(rh.checksum));
+    std::memcpy(rec.data(), &rh.checksum, sizeof(rh.checksum));
+
+    io_.write_at(fd_, offset_, std::move(rec));
+    offset_ += record_size_;
+    if (sync_ == SYNC::EACH)
+        io_.sync(fd_);
+}
+
+void ResultLogWriter::append(uint64_t pos, const TLWELvl1& res)
+{
+    assert(format_ == ResultLogFile::FORMAT::TLWE);
+    append(pos, &res, sizeof(res));
+}
+
+void ResultLogWriter::append(uint64_t pos, const TRLWELvl1& res)
+{
+    assert(format_ == ResultLogFile::FORMAT::TRLWE);
+    append(pos, &res, sizeof(res));
 }
 
 //////////
@@ -313,6 +1361,73 @@ PolyLvl1 phase_of_TRLWELvl1(const TRLWELvl1& src, const SecretKey& skey)
     return phase;
 }
 
+TRGSWLvl1FFTFloat TRGSWLvl1FFT_to_float(const TRGSWLvl1FFT& src)
+{
+    TRGSWLvl1FFTFloat ret;
+    for (size_t row = 0; row < 2 * Lvl1::l; row++)
+        for (size_t k = 0; k < 2; k++)
+            std::copy(src[row][k].begin(), src[row][k].end(),
+                      ret[row][k].begin());
+    return ret;
+}
+
+void NoiseStat::add(const TRLWELvl1& c, const SecretKey& skey,
+                    size_t num_coeffs)
+{
+    assert(num_coeffs <= Lvl1::n);
+    PolyLvl1 phase = phase_of_TRLWELvl1(c, skey);
+    for (size_t i = 0; i < num_coeffs; i++) {
+        // Distance to the nearer of 0 and 1/2
+        int32_t e = static_cast<int32_t>(phase[i] << 1) / 2;
+        double err = static_cast<double>(e) / (1ull << 32);
+        sum_sq += err * err;
+        max_abs = std::max(max_abs, std::abs(err));
+    }
+    num_samples += num_coeffs;
+}
+
+double NoiseStat::stddev() const
+{
+    return num_samples == 0 ? 0 : std::sqrt(sum_sq / num_samples);
+}
+
+void EvalKey::emplacebkfftunrolled(const SecretKey& skey)
+{
+    const auto& s = skey.key.lvl0;
+    bkfftunrolled =
+        std::make_shared<UnrolledBootstrappingKeyFFTLvl01>(Lvl0::n / 2);
+    for (size_t j = 0; j < bkfftunrolled->size(); j++) {
+        uint32_t s0 = s[2 * j], s1 = s[2 * j + 1];
+        const uint32_t ms[] = {s0 * s1, s0 * (1 - s1), (1 - s0) * s1};
+        for (size_t k = 0; k < 3; k++)
+            bkfftunrolled->at(j).at(k) = TFHEpp::trgswfftSymEncrypt<Lvl1>(
+                {ms[k]}, Lvl1::α, skey.key.lvl1);
+    }
+}
+
+size_t EvalKey::bklvl01_bytes() const
+{
+    size_t ret = 0;
+    if (bkfftlvl01)
+        ret += sizeof(*bkfftlvl01);
+    if (bkfftunrolled)
+        ret += bkfftunrolled->size() * sizeof(bkfftunrolled->front());
+    return ret;
+}
+
+void BlindRotateLvl01(TRLWELvl1& out, const TLWELvl0& src,
+                      const PolyLvl1& testvector, const EvalKey& ek)
+{
+    if (!ek.bkfftunrolled) {
+        TFHEpp::BlindRotate<TFHEpp::lvl01param>(
+            out, src, ek.getbkfft<TFHEpp::lvl01param>(), testvector);
+        return;
+    }
+    TRLWELvl1* const outs[] = {&out};
+    const TLWELvl0* const srcs[] = {&src};
+    BlindRotateLvl01_tile(ek, testvector, 1, outs, srcs);
+}
+
 // w = w |> SEI |> IKS(gk) |> GateBootstrappingTLWE2TRLWE(gk)
 void do_SEI_IKS_GBTLWE2TRLWE(TRLWELvl1& w, const EvalKey& ek)
 {
@@ -321,9 +1436,9 @@ void do_SEI_IKS_GBTLWE2TRLWE(TRLWELvl1& w, const EvalKey& ek)
     TLWELvl0 tlwel0;
     TFHEpp::IdentityKeySwitch<TFHEpp::lvl10param>(
         tlwel0, tlwel1, ek.getiksk<TFHEpp::lvl10param>());
-    TFHEpp::BlindRotate<TFHEpp::lvl01param>(
-        w, tlwel0, ek.getbkfft<TFHEpp::lvl01param>(),
-        TFHEpp::μpolygen<TFHEpp::lvl1param, TFHEpp::lvl1param::μ>());
+    BlindRotateLvl01(
+        w, tlwel0, TFHEpp::μpolygen<TFHEpp::lvl1param, TFHEpp::lvl1param::μ>(),
+        ek);
 }
 
 // BootstrappingTLWE-to-TRLWE
@@ -337,8 +1452,7 @@ void BS_TLWE_0_1o2_to_TRLWE_0_1o2(TRLWELvl1& out, TLWELvl0& src,
     // Convert {0, 1/2} to {-1/4, 1/4}
     src[Lvl0::n] -= (1 << 30);  // 1/4
     // Bootstrapping without changing plaintext space
-    BlindRotate<lvl01param>(out, src, ek.getbkfft<lvl01param>(),
-                            μpolygen<Lvl1, (1 << 30) /* 1/4 */>());
+    BlindRotateLvl01(out, src, μpolygen<Lvl1, (1 << 30) /* 1/4 */>(), ek);
     // Convert {-1/4, 1/4} to {0, 1/2}
     out[1][0] += (1 << 30);  // 1/4
 }
@@ -354,8 +1468,7 @@ void BS_TLWE_0_1o2_to_TRLWE_m1o8_1o8(TRLWELvl1& out, TLWELvl0& src,
     // Convert {0, 1/2} to {-1/4, 1/4}
     src[Lvl0::n] -= (1 << 30);  // 1/4
     // Bootstrapping and convert {-1/4, 1/4} to {-1/8, 1/8}
-    BlindRotate<lvl01param>(out, src, ek.getbkfft<lvl01param>(),
-                            μpolygen<Lvl1, (1 << 29) /* 1/8 */>());
+    BlindRotateLvl01(out, src, μpolygen<Lvl1, (1 << 29) /* 1/8 */>(), ek);
 }
 
 // w = w |> SEI |> IKS(gk) |> GateBootstrappingTLWE2TRLWE(gk)
@@ -401,6 +1514,20 @@ bool decrypt_TLWELvl1_to_bit(const TLWELvl1& c, const SecretKey& skey)
     return (phase + (1u << 30 /* 1/4 */)) > (1u << 31 /* 1/2 */);
 }
 
+std::vector<bool> decrypt_TRLWELvl1_to_bits(const TRLWELvl1& c,
+                                            size_t num_bits,
+                                            const SecretKey& skey)
+{
+    assert(num_bits <= Lvl1::n);
+
+    // Use {0, 1/2} as message space for each coefficient
+    PolyLvl1 phase = phase_of_TRLWELvl1(c, skey);
+    std::vector<bool> ret;
+    for (size_t i = 0; i < num_bits; i++)
+        ret.push_back((phase[i] + (1u << 30 /* 1/4 */)) > (1u << 31 /* 1/2 */));
+    return ret;
+}
+
 PolyLvl1 uint2weight(uint64_t n)
 {
     PolyLvl1 w;
@@ -455,7 +1582,367 @@ void HomXORwoSE(TRLWELvl1& out, const TLWELvl0& lhs, const TLWELvl0& rhs,
     for (int i = 0; i <= Lvl0::n; i++)
         temp[i] = 2 * lhs[i] + 2 * rhs[i];
     temp[Lvl0::n] += 2 * Lvl0::μ;
-    TFHEpp::BlindRotate<TFHEpp::lvl01param>(
-        out, temp, ek.getbkfft<TFHEpp::lvl01param>(),
-        TFHEpp::μpolygen<TFHEpp::lvl1param, TFHEpp::lvl1param::μ>());
+    BlindRotateLvl01(
+        out, temp,
+        TFHEpp::μpolygen<TFHEpp::lvl1param, TFHEpp::lvl1param::μ>(), ek);
+}
+
+namespace {
+// {0, 1/2} -> {-1/8, 1/8}
+TLWELvl1 TLWELvl1_0_1o2_to_m1o8_1o8(const TLWELvl1& src, const EvalKey& ek)
+{
+    using namespace TFHEpp;
+
+    TLWELvl0 tlwel0;
+    IdentityKeySwitch<lvl10param>(tlwel0, src, ek.getiksk<lvl10param>());
+    TRLWELvl1 trlwel1;
+    BS_TLWE_0_1o2_to_TRLWE_m1o8_1o8(trlwel1, tlwel0, ek);
+    TLWELvl1 ret;
+    SampleExtractIndex<Lvl1>(ret, trlwel1, 0);
+    return ret;
+}
+
+// lhs AND rhs
+// {-1/8, 1/8} x {-1/8, 1/8} -> {-mu, mu}
+template <uint32_t mu>
+TLWELvl1 HomAND_m1o8_1o8(const TLWELvl1& lhs, const TLWELvl1& rhs,
+                         const EvalKey& ek)
+{
+    using namespace TFHEpp;
+
+    // The phase is 1/8 only if both are true; otherwise -1/8 or -3/8.
+    TLWELvl1 tlwel1;
+    for (size_t i = 0; i <= Lvl1::n; i++)
+        tlwel1[i] = lhs[i] + rhs[i];
+    tlwel1[Lvl1::n] -= (1u << 29);  // 1/8
+
+    TLWELvl0 tlwel0;
+    IdentityKeySwitch<lvl10param>(tlwel0, tlwel1, ek.getiksk<lvl10param>());
+    TRLWELvl1 trlwel1;
+    BlindRotateLvl01(trlwel1, tlwel0, μpolygen<Lvl1, mu>(), ek);
+    TLWELvl1 ret;
+    SampleExtractIndex<Lvl1>(ret, trlwel1, 0);
+    return ret;
+}
+}  // namespace
+
+// Homomorphic AND of all the elements of src, reduced as a binary tree.
+// {0, 1/2}^n -> {0, 1/2}
+TLWELvl1 HomANDLvl1(const std::vector<TLWELvl1>& src, const EvalKey& ek)
+{
+    assert(!src.empty());
+    if (src.size() == 1)
+        return src.at(0);
+
+    std::vector<TLWELvl1> cur(src.size()), next;
+    std::transform(std::execution::par, src.begin(), src.end(), cur.begin(),
+                   [&](const TLWELvl1& c) {
+                       return TLWELvl1_0_1o2_to_m1o8_1o8(c, ek);
+                   });
+
+    while (cur.size() > 2) {
+        next.resize((cur.size() + 1) / 2);
+        std::vector<size_t> indices(cur.size() / 2);
+        std::iota(indices.begin(), indices.end(), 0);
+        std::for_each(std::execution::par, indices.begin(), indices.end(),
+                      [&](size_t i) {
+                          next.at(i) = HomAND_m1o8_1o8<(1u << 29) /* 1/8 */>(
+                              cur.at(2 * i), cur.at(2 * i + 1), ek);
+                      });
+        if (cur.size() % 2 == 1)
+            next.back() = cur.back();
+        using std::swap;
+        swap(cur, next);
+    }
+
+    // Make the last gate output {-1/4, 1/4} and convert it to {0, 1/2}
+    TLWELvl1 ret =
+        HomAND_m1o8_1o8<(1u << 30) /* 1/4 */>(cur.at(0), cur.at(1), ek);
+    ret[Lvl1::n] += (1u << 30);  // 1/4
+    return ret;
+}
+
+namespace {
+// load_row(row) returns the row-th row of the selector as TRLWEInFD<Lvl1>
+template <class LoadRow>
+void CMUXFFTLvl1_tile_impl(LoadRow&& load_row, size_t size,
+                           TRLWELvl1* const out[],
+                           const TRLWELvl1* const in1[],
+                           const TRLWELvl1* const in0[])
+{
+    assert(size <= CMUX_MAX_TILE_SIZE);
+    constexpr size_t l = Lvl1::l, n = Lvl1::n;
+
+    // decpoly.at(t)[k] is the decomposition of (*in1[t])[k] - (*in0[t])[k]
+    std::vector<std::array<TFHEpp::DecomposedPolynomial<Lvl1>, 2>> decpoly(
+        size);
+    for (size_t t = 0; t < size; t++) {
+        for (size_t k = 0; k < 2; k++) {
+            PolyLvl1 diff;
+            for (size_t i = 0; i < n; i++)
+                diff[i] = (*in1[t])[k][i] - (*in0[t])[k][i];
+            TFHEpp::Decomposition<Lvl1>(decpoly.at(t)[k], diff);
+        }
+    }
+
+    // External product with the rows of sel in the outer loop. The rows for
+    // (*in1[t])[0] come first, then those for (*in1[t])[1].
+    std::vector<TFHEpp::TRLWEInFD<Lvl1>> acc(size);
+    TFHEpp::PolynomialInFD<Lvl1> decpolyfft;
+    for (size_t row = 0; row < 2 * l; row++) {
+        const TFHEpp::TRLWEInFD<Lvl1>& selrow = load_row(row);
+        for (size_t t = 0; t < size; t++) {
+            TFHEpp::TwistIFFT<Lvl1>(decpolyfft,
+                                    decpoly.at(t)[row / l][row % l]);
+            if (row == 0) {
+                TFHEpp::MulInFD<n>(acc.at(t)[0], decpolyfft, selrow[0]);
+                TFHEpp::MulInFD<n>(acc.at(t)[1], decpolyfft, selrow[1]);
+            }
+            else {
+                TFHEpp::FMAInFD<n>(acc.at(t)[0], decpolyfft, selrow[0]);
+                TFHEpp::FMAInFD<n>(acc.at(t)[1], decpolyfft, selrow[1]);
+            }
+        }
+    }
+
+    for (size_t t = 0; t < size; t++) {
+        for (size_t k = 0; k < 2; k++) {
+            TFHEpp::TwistFFT<Lvl1>((*out[t])[k], acc.at(t)[k]);
+            for (size_t i = 0; i < n; i++)
+                (*out[t])[k][i] += (*in0[t])[k][i];
+        }
+    }
+}
+}  // namespace
+
+void CMUXFFTLvl1_tile(const TRGSWLvl1FFT& sel, size_t size,
+                      TRLWELvl1* const out[], const TRLWELvl1* const in1[],
+                      const TRLWELvl1* const in0[])
+{
+    CMUXFFTLvl1_tile_impl(
+        [&](size_t row) -> const TFHEpp::TRLWEInFD<Lvl1>& { return sel[row]; },
+        size, out, in1, in0);
+}
+
+void CMUXFFTLvl1_tile(const TRGSWLvl1FFTFloat& sel, size_t size,
+                      TRLWELvl1* const out[], const TRLWELvl1* const in1[],
+                      const TRLWELvl1* const in0[])
+{
+    // Widen each row once for the whole tile
+    TFHEpp::TRLWEInFD<Lvl1> selrow;
+    CMUXFFTLvl1_tile_impl(
+        [&](size_t row) -> const TFHEpp::TRLWEInFD<Lvl1>& {
+            for (size_t k = 0; k < 2; k++)
+                std::copy(sel[row][k].begin(), sel[row][k].end(),
+                          selrow[k].begin());
+            return selrow;
+        },
+        size, out, in1, in0);
+}
+
+namespace {
+// The IFFT of X^a for each a < Lvl1::n, computed on the first call. That of
+// X^{a + Lvl1::n} is its negation.
+const std::vector<TFHEpp::PolynomialInFD<Lvl1>>& monomials_in_fd()
+{
+    // Not in parallel, since other threads may wait for this in TBB tasks
+    static const std::vector<TFHEpp::PolynomialInFD<Lvl1>> table = [] {
+        std::vector<TFHEpp::PolynomialInFD<Lvl1>> ret(Lvl1::n);
+        for (size_t a = 0; a < Lvl1::n; a++) {
+            PolyLvl1 poly = {};
+            poly[a] = 1;
+            TFHEpp::TwistIFFT<Lvl1>(ret.at(a), poly);
+        }
+        return ret;
+    }();
+    return table;
+}
+
+// out = the IFFT of X^a - 1 for a < 2 Lvl1::n
+void monomial_minus_one_in_fd(TFHEpp::PolynomialInFD<Lvl1>& out, uint32_t a)
+{
+    const auto& table = monomials_in_fd();
+    const auto &xa = table.at(a % Lvl1::n), &one = table.at(0);
+    const double sign = a < Lvl1::n ? 1 : -1;
+    for (size_t i = 0; i < Lvl1::n; i++)
+        out[i] = sign * xa[i] - one[i];
+}
+
+// *acc[t] += C_t (x) *acc[t] for each t < size, where C_t is the sum of
+// (X^{exps[t][k]} - 1) bundle[k] over k. Since the external product is
+// linear in the TRGSW, C_t is not formed; the products with bundle[k] are
+// scaled in the frequency domain instead. Each row of the bundle is
+// multiplied with all the targets while it stays in cache, as in
+// CMUXFFTLvl1_tile.
+void ExternalProductUnrolledLvl1_tile(
+    const std::array<TRGSWLvl1FFT, 3>& bundle, size_t size,
+    const std::array<uint32_t, 3> exps[], TRLWELvl1* const acc[])
+{
+    assert(size <= CMUX_MAX_TILE_SIZE);
+    constexpr size_t l = Lvl1::l, n = Lvl1::n;
+
+    // decpolyfft.at(t)[k * l + i] is the IFFT of the i-th decomposed
+    // polynomial of (*acc[t])[k]
+    std::vector<std::array<TFHEpp::PolynomialInFD<Lvl1>, 2 * l>> decpolyfft(
+        size);
+    for (size_t t = 0; t < size; t++) {
+        for (size_t k = 0; k < 2; k++) {
+            TFHEpp::DecomposedPolynomial<Lvl1> decpoly;
+            TFHEpp::Decomposition<Lvl1>(decpoly, (*acc[t])[k]);
+            for (size_t i = 0; i < l; i++)
+                TFHEpp::TwistIFFT<Lvl1>(decpolyfft.at(t)[k * l + i],
+                                        decpoly[i]);
+        }
+    }
+
+    // prod.at(t) is bundle[b] (x) *acc[t], and sum.at(t) accumulates it
+    // multiplied by X^{exps[t][b]} - 1
+    std::vector<TFHEpp::TRLWEInFD<Lvl1>> prod(size), sum(size);
+    TFHEpp::PolynomialInFD<Lvl1> monomial;
+    for (size_t b = 0; b < 3; b++) {
+        for (size_t row = 0; row < 2 * l; row++) {
+            const TFHEpp::TRLWEInFD<Lvl1>& keyrow = bundle[b][row];
+            for (size_t t = 0; t < size; t++) {
+                for (size_t k = 0; k < 2; k++) {
+                    if (row == 0)
+                        TFHEpp::MulInFD<n>(prod.at(t)[k],
+                                           decpolyfft.at(t)[row], keyrow[k]);
+                    else
+                        TFHEpp::FMAInFD<n>(prod.at(t)[k],
+                                           decpolyfft.at(t)[row], keyrow[k]);
+                }
+            }
+        }
+        for (size_t t = 0; t < size; t++) {
+            monomial_minus_one_in_fd(monomial, exps[t][b]);
+            for (size_t k = 0; k < 2; k++) {
+                if (b == 0)
+                    TFHEpp::MulInFD<n>(sum.at(t)[k], monomial, prod.at(t)[k]);
+                else
+                    TFHEpp::FMAInFD<n>(sum.at(t)[k], monomial, prod.at(t)[k]);
+            }
+        }
+    }
+
+    for (size_t t = 0; t < size; t++) {
+        for (size_t k = 0; k < 2; k++) {
+            PolyLvl1 poly;
+            TFHEpp::TwistFFT<Lvl1>(poly, sum.at(t)[k]);
+            for (size_t i = 0; i < n; i++)
+                (*acc[t])[k][i] += poly[i];
+        }
+    }
+}
+}  // namespace
+
+void CMUXFFTLvl1_split(const TRGSWLvl1FFT& sel, TRLWELvl1& out,
+                       const TRLWELvl1& in1, const TRLWELvl1& in0)
+{
+    constexpr size_t l = Lvl1::l, n = Lvl1::n;
+
+    // prods.at(row)[k] is the product of sel[row][k] and the IFFT of the
+    // row-th decomposed polynomial, i.e., the (row % l)-th one of
+    // in1[row / l] - in0[row / l]
+    std::vector<std::array<TFHEpp::PolynomialInFD<Lvl1>, 2>> prods(2 * l);
+    tbb::parallel_for(size_t{0}, 2 * l, [&](size_t row) {
+        // Decomposing the whole component again in each task costs much less
+        // than a join
+        const size_t c = row / l;
+        PolyLvl1 diff;
+        for (size_t i = 0; i < n; i++)
+            diff[i] = in1[c][i] - in0[c][i];
+        TFHEpp::DecomposedPolynomial<Lvl1> decpoly;
+        TFHEpp::Decomposition<Lvl1>(decpoly, diff);
+        TFHEpp::PolynomialInFD<Lvl1> decpolyfft;
+        TFHEpp::TwistIFFT<Lvl1>(decpolyfft, decpoly[row % l]);
+        for (size_t k = 0; k < 2; k++)
+            TFHEpp::MulInFD<n>(prods.at(row)[k], decpolyfft, sel[row][k]);
+    });
+
+    tbb::parallel_for(size_t{0}, size_t{2}, [&](size_t k) {
+        TFHEpp::PolynomialInFD<Lvl1>& acc = prods.at(0)[k];
+        for (size_t row = 1; row < 2 * l; row++)
+            for (size_t i = 0; i < n; i++)
+                acc[i] += prods.at(row)[k][i];
+        TFHEpp::TwistFFT<Lvl1>(out[k], acc);
+        for (size_t i = 0; i < n; i++)
+            out[k][i] += in0[k][i];
+    });
+}
+
+void BlindRotateLvl01_tile(const EvalKey& ek, const PolyLvl1& testvector,
+                           size_t size, TRLWELvl1* const out[],
+                           const TLWELvl0* const src[])
+{
+    assert(size <= CMUX_MAX_TILE_SIZE);
+    constexpr uint32_t n2 = 2 * Lvl1::n;
+
+    // Switch the modulus from 2^32 to 2N with rounding
+    auto mod_switch = [](uint32_t a) -> uint32_t {
+        constexpr uint32_t shift = 32 - (Lvl1::nbit + 1);
+        return (a + (1u << (shift - 1))) >> shift;
+    };
+
+    std::vector<TRLWELvl1> acc(size), next(size), rotated(size);
+    for (size_t t = 0; t < size; t++) {
+        uint32_t b = (n2 - mod_switch((*src[t])[Lvl0::n])) % n2;
+        acc.at(t)[0] = {};
+        if (b == 0)
+            acc.at(t)[1] = testvector;
+        else
+            TFHEpp::PolynomialMulByXai<Lvl1>(acc.at(t)[1], testvector, b);
+    }
+
+    // With key unrolling, acc <- acc + C (x) acc for each pair (a0, a1) of
+    // the coefficients, where C = BK11 (X^{a0 + a1} - 1) + BK10 (X^{a0} - 1)
+    // + BK01 (X^{a1} - 1) is the TRGSW of X^{s0 a0 + s1 a1} - 1.
+    size_t num_unrolled = 0;
+    if (ek.bkfftunrolled) {
+        num_unrolled = 2 * ek.bkfftunrolled->size();
+        TRLWELvl1* targets[CMUX_MAX_TILE_SIZE];
+        std::array<uint32_t, 3> exps[CMUX_MAX_TILE_SIZE];
+        for (size_t j = 0; j < ek.bkfftunrolled->size(); j++) {
+            size_t num_targets = 0;
+            for (size_t t = 0; t < size; t++) {
+                const uint32_t a0 = mod_switch((*src[t])[2 * j]),
+                               a1 = mod_switch((*src[t])[2 * j + 1]);
+                if (a0 == 0 && a1 == 0)
+                    continue;
+                exps[num_targets] = {(a0 + a1) % n2, a0, a1};
+                targets[num_targets++] = &acc.at(t);
+            }
+            ExternalProductUnrolledLvl1_tile(ek.bkfftunrolled->at(j),
+                                             num_targets, exps, targets);
+        }
+    }
+
+    // acc <- CMUX(bkfft[i], X^{a_i} acc, acc) for each row i of the key
+    const auto& bkfft = ek.getbkfft<TFHEpp::lvl01param>();
+    TRLWELvl1* cmux_out[CMUX_MAX_TILE_SIZE];
+    const TRLWELvl1 *cmux_in1[CMUX_MAX_TILE_SIZE],
+        *cmux_in0[CMUX_MAX_TILE_SIZE];
+    size_t targets[CMUX_MAX_TILE_SIZE];
+    for (size_t i = num_unrolled; i < Lvl0::n; i++) {
+        size_t num_targets = 0;
+        for (size_t t = 0; t < size; t++) {
+            uint32_t a = mod_switch((*src[t])[i]);
+            if (a == 0)
+                continue;
+            for (size_t k = 0; k < 2; k++)
+                TFHEpp::PolynomialMulByXai<Lvl1>(rotated.at(t)[k],
+                                                 acc.at(t)[k], a);
+            cmux_out[num_targets] = &next.at(t);
+            cmux_in1[num_targets] = &rotated.at(t);
+            cmux_in0[num_targets] = &acc.at(t);
+            targets[num_targets++] = t;
+        }
+        CMUXFFTLvl1_tile(bkfft[i], num_targets, cmux_out, cmux_in1, cmux_in0);
+        for (size_t j = 0; j < num_targets; j++) {
+            using std::swap;
+            swap(acc.at(targets[j]), next.at(targets[j]));
+        }
+    }
+
+    for (size_t t = 0; t < size; t++)
+        *out[t] = acc.at(t);
 }
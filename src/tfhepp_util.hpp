@@ -1,9 +1,22 @@
 #ifndef HOMFA_TFHEPP_UTIL_HPP
 #define HOMFA_TFHEPP_UTIL_HPP
 
+#include "async_io.hpp"
+
+#include <algorithm>
+#include <cassert>
 #include <fstream>
+#include <future>
+#include <memory>
+#include <optional>
+#include <tuple>
 
-#include <ThreadPool.h>
+#include <cereal/types/array.hpp>
+#include <cereal/types/base_class.hpp>
+#include <cereal/types/memory.hpp>
+#include <cereal/types/vector.hpp>
+#include <tbb/parallel_for.h>
+#include <tbb/task_arena.h>
 #include <tfhe++.hpp>
 
 using Lvl0 = TFHEpp::lvl0param;
@@ -14,7 +27,43 @@ using TRGSWLvl1FFT = TFHEpp::TRGSWFFT<Lvl1>;
 using TRLWELvl1 = TFHEpp::TRLWE<Lvl1>;
 using PolyLvl1 = TFHEpp::Polynomial<Lvl1>;
 using SecretKey = TFHEpp::SecretKey;
-using EvalKey = TFHEpp::EvalKey;
+
+// TRGSWLvl1FFT with its coefficients rounded to float. This halves the
+// memory traffic of the external products with it at the cost of extra
+// noise, so check the noise with NoiseStat before relying on it.
+using TRGSWLvl1FFTFloat =
+    std::array<std::array<std::array<float, Lvl1::n>, 2>, 2 * Lvl1::l>;
+
+// Bootstrapping key of lvl01param for key unrolling, which processes two
+// coefficients of TLWELvl0 per external product. at(j) has the TRGSWs of
+// s_{2j} s_{2j+1}, s_{2j} (1 - s_{2j+1}), and (1 - s_{2j}) s_{2j+1}.
+using UnrolledBootstrappingKeyFFTLvl01 =
+    std::vector<std::array<TRGSWLvl1FFT, 3>>;
+
+// TFHEpp's EvalKey with an optional unrolled bootstrapping key. If it is
+// present, the blind rotations of lvl01param below use it instead of
+// bkfftlvl01, which halves the number of external products in sequence.
+struct EvalKey : public TFHEpp::EvalKey {
+    std::shared_ptr<UnrolledBootstrappingKeyFFTLvl01> bkfftunrolled;
+
+    using TFHEpp::EvalKey::EvalKey;
+
+    void emplacebkfftunrolled(const SecretKey& skey);
+
+    // Bytes of the bootstrapping keys of lvl01param held in memory
+    size_t bklvl01_bytes() const;
+
+    // bkfftunrolled is stored since version 1
+    template <class Archive>
+    void serialize(Archive& ar, const std::uint32_t version)
+    {
+        ar(cereal::base_class<TFHEpp::EvalKey>(this));
+        if (version >= 1)
+            ar(bkfftunrolled);
+    }
+};
+
+CEREAL_CLASS_VERSION(EvalKey, 1);
 
 class TRGSWLvl1FFTSerializer {
     static_assert(TRGSWLvl1FFT{}.size() == 2 * Lvl1::l);
@@ -26,7 +75,6 @@ private:
 
 private:
     void save_binary(const void* data, size_t size);
-    void save_double(double src);
 
 public:
     TRGSWLvl1FFTSerializer(std::ostream& os);
@@ -48,7 +96,6 @@ private:
 
 private:
     void load_binary(void* const data, size_t size);
-    void load_double(double& src);
 
 public:
     TRGSWLvl1FFTDeserializer(std::istream& is);
@@ -70,47 +117,431 @@ public:
     {
     }
 
+    // The number of inputs that can be read without waiting
     virtual size_t size() const = 0;
-    virtual T next() = 0;
+    // Whether next() can be called. Streams that read inputs as they arrive
+    // wait here for the next one or the end of the input.
+    virtual bool has_next()
+    {
+        return size() != 0;
+    }
+    // The returned reference is valid until the next call of next()
+    virtual const T& next() = 0;
+};
+
+// Seed of TRGSWLvl1Seeded. It is the key of ChaCha20.
+using TRGSWLvl1Seed = std::array<uint32_t, 8>;
+// TRGSWLvl1 whose a polynomials are generated from a seed. Only the b
+// polynomials in the torus domain are kept, so it is a quarter of the size
+// of TRGSWLvl1FFT. index distinguishes the TRGSWs of the same seed, and
+// must not be used twice with the same seed.
+using TRGSWLvl1Seeded = std::array<PolyLvl1, 2 * Lvl1::l>;
+
+TRGSWLvl1Seed random_TRGSWLvl1Seed();
+TRGSWLvl1Seeded encrypt_bit_to_TRGSWLvl1Seeded(bool b,
+                                               const TRGSWLvl1Seed& seed,
+                                               uint64_t index,
+                                               const SecretKey& skey);
+void expand_TRGSWLvl1Seeded(TRGSWLvl1FFT& out, const TRGSWLvl1Seeded& src,
+                            const TRGSWLvl1Seed& seed, uint64_t index);
+
+// Ciphertext file read by the run commands. It is either a sequence of
+// TRGSWLvl1FFTs written by TRGSWLvl1FFTSerializer, or a container written by
+// TRGSWLvl1CtxtFileWriter. The container starts with a header that records
+// the format of the records, the number of APs, the parameters, and the
+// size of chunks, which is followed by the chunks. Each chunk has a header
+// with the number of bits in it and the checksum of its records, so that a
+// chunk can be verified independently of the others, and chunks can be
+// appended while the file is read. The last chunk is ignored if it is not
+// complete yet. The records are:
+//   FFT:    TRGSWLvl1FFT
+//   SEEDED: TRGSWLvl1Seeded, whose index is the position of the record in
+//           the file including unused ones of chunks, with the seed in the
+//           header
+//   PACKED: TRLWELvl1 of Lvl1::n bits encrypted as -1/8 or 1/8, which are
+//           turned into TRGSWs by circuit bootstrapping
+// The file is mapped into memory. The TRGSWs of FFT are referred to in place
+// without copying, and the others are expanded on request.
+class TRGSWLvl1CtxtFile {
+    friend class TRGSWLvl1CtxtFileWriter;
+
+public:
+    enum class FORMAT { FFT, SEEDED, PACKED };
+
+private:
+    struct Chunk {
+        // Offset of the first record in the file, the index of the first
+        // TRGSW, and the checksum of the records if any
+        size_t offset, begin;
+        std::optional<uint64_t> checksum;
+    };
+
+private:
+    std::string filename_;
+    const char* addr_;
+    size_t length_, record_size_, bits_per_record_, records_per_chunk_, size_;
+    FORMAT format_;
+    std::optional<size_t> num_ap_;
+    TRGSWLvl1Seed seed_;
+    std::vector<Chunk> chunks_;
+
+private:
+    // Offset of the record that has the i-th TRGSW, the position of the
+    // record in the file, and the position of the TRGSW in the record
+    std::tuple<size_t, size_t, size_t> locate(size_t i) const;
+    // Byte range of the records that have the TRGSWs in [begin, end)
+    std::pair<size_t, size_t> byte_range(size_t begin, size_t end) const;
+
+public:
+    TRGSWLvl1CtxtFile(const std::string& filename);
+    ~TRGSWLvl1CtxtFile();
+    TRGSWLvl1CtxtFile(const TRGSWLvl1CtxtFile&) = delete;
+    TRGSWLvl1CtxtFile& operator=(const TRGSWLvl1CtxtFile&) = delete;
+
+    size_t size() const
+    {
+        return size_;
+    }
+
+    FORMAT format() const
+    {
+        return format_;
+    }
+
+    // Not recorded in files written by TRGSWLvl1FFTSerializer
+    std::optional<size_t> num_ap() const
+    {
+        return num_ap_;
+    }
+
+    size_t chunk_of(size_t i) const;
+    // Die if the checksum of the k-th chunk does not match
+    void verify_chunk(size_t k) const;
+
+    // Valid only for FORMAT::FFT
+    const TRGSWLvl1FFT& at(size_t i) const;
+    // Valid only for FORMAT::SEEDED
+    void expand_seeded(TRGSWLvl1FFT& out, size_t i) const;
+    // Valid only for FORMAT::PACKED. It runs circuit bootstrapping.
+    void expand_packed(TRGSWLvl1FFT& out, size_t i, const EvalKey& ek) const;
+
+    // Hint the kernel how the file will be read. The ranges are in TRGSWs
+    // and clamped to the file.
+    void advise_random() const;
+    void advise_sequential() const;
+    void advise_will_need(size_t begin, size_t end) const;
+    void advise_dont_need(size_t begin, size_t end) const;
+};
+
+// Encrypt bits and write them into a container of TRGSWLvl1CtxtFile. A chunk
+// is written when it is full, so readers see the bits chunk by chunk.
+class TRGSWLvl1CtxtFileWriter {
+private:
+    std::ofstream ofs_;
+    TRGSWLvl1CtxtFile::FORMAT format_;
+    const SecretKey& skey_;
+    TRGSWLvl1Seed seed_;
+    size_t record_size_, bits_per_record_, records_per_chunk_;
+    uint64_t num_chunks_, num_pending_;
+    std::vector<char> chunk_;
+    // Messages of the TRLWE being packed
+    PolyLvl1 packed_;
+
+private:
+    void write_record(size_t r, const void* src);
+    void write_chunk();
+
+public:
+    // Create the file, or append chunks to the existing one if append is
+    // true. In the latter case, format, num_ap, and records_per_chunk if
+    // given must match the file. A reader sees no TRGSW of a chunk until the
+    // chunk is full, so a small records_per_chunk reduces the latency of
+    // streamed inputs at the cost of a header per chunk.
+    TRGSWLvl1CtxtFileWriter(
+        const std::string& filename, TRGSWLvl1CtxtFile::FORMAT format,
+        size_t num_ap, const SecretKey& skey, bool append,
+        std::optional<size_t> records_per_chunk = std::nullopt);
+
+    void save_bit(bool b);
+    // Write the rest of the bits as a chunk. Must be called after the last
+    // bit.
+    void flush();
 };
 
-class TRGSWLvl1InputStreamFromCtxtFile : public InputStream<TRGSWLvl1FFT> {
+// Expand the TRGSWs of a seeded or packed file in the order of a stream.
+// While the stream reads a window of read_ahead TRGSWs, the next window is
+// expanded in parallel in a background thread. The previous window is also
+// kept so that the last read_ahead TRGSWs returned stay valid.
+class TRGSWLvl1Expander {
 private:
-    std::ifstream ifs_;
-    TRGSWLvl1FFTDeserializer deser_;
-    ThreadPool pool_;
-    std::future<bool> running_;
-    TRGSWLvl1FFT loaded_;
-    size_t current_size_;
+    const TRGSWLvl1CtxtFile& file_;
+    std::shared_ptr<const EvalKey> ekey_;
+    bool reversed_;
+    size_t read_ahead_;
+    std::vector<TRGSWLvl1FFT> ring_;
+    std::future<void> next_window_;
 
 private:
-    void start_loading_next();
+    void expand_window(size_t window);
 
 public:
-    TRGSWLvl1InputStreamFromCtxtFile(const std::string& filename);
+    // ekey is needed only for packed files
+    TRGSWLvl1Expander(const TRGSWLvl1CtxtFile& file,
+                      std::shared_ptr<const EvalKey> ekey, bool reversed,
+                      size_t read_ahead);
+
+    // The count-th TRGSW in the order of the stream. count must be 0, 1, 2,
+    // ... in turn.
+    const TRGSWLvl1FFT& get(size_t count);
+};
+
+// The streams read the file through TRGSWLvl1CtxtFile. They ask the kernel
+// to read the next read_ahead TRGSWs in the direction of travel, and drop
+// from the mapping only those more than read_ahead behind the head. The
+// last read_ahead references returned by next() stay valid and in memory,
+// so a caller, e.g., a runner that queues a block of inputs, can keep them
+// without copying. ekey is needed only to read packed files.
+constexpr size_t STREAM_READ_AHEAD = 16;
+
+// Unlike InputStream, the reference returned by next() stays valid until
+// read_ahead() more calls of next(), i.e., the last read_ahead() references
+// are valid at once. The runners that borrow a block of inputs rely on it.
+class TRGSWLvl1InputStream : public InputStream<TRGSWLvl1FFT> {
+public:
+    // The number of the last TRGSWs returned by next() that stay valid
+    virtual size_t read_ahead() const = 0;
+    // Not recorded in files written by TRGSWLvl1FFTSerializer
+    virtual std::optional<size_t> num_ap() const = 0;
+    // Whether the inputs are read as they arrive, in which case the total
+    // number of them is not known until has_next() returns false
+    virtual bool is_streaming() const
+    {
+        return false;
+    }
+};
+
+class TRGSWLvl1InputStreamFromCtxtFile : public TRGSWLvl1InputStream {
+private:
+    TRGSWLvl1CtxtFile file_;
+    size_t head_, read_ahead_;
+    std::optional<TRGSWLvl1Expander> expander_;
+    // The chunk whose checksum was verified last
+    std::optional<size_t> verified_chunk_;
+
+public:
+    TRGSWLvl1InputStreamFromCtxtFile(
+        const std::string& filename,
+        std::shared_ptr<const EvalKey> ekey = nullptr,
+        size_t read_ahead = STREAM_READ_AHEAD);
+
+    size_t read_ahead() const override
+    {
+        return read_ahead_;
+    }
+
+    std::optional<size_t> num_ap() const override
+    {
+        return file_.num_ap();
+    }
 
     size_t size() const override;
-    TRGSWLvl1FFT next() override;
+    const TRGSWLvl1FFT& next() override;
 };
 
-class ReversedTRGSWLvl1InputStreamFromCtxtFile
-    : public InputStream<TRGSWLvl1FFT> {
+class ReversedTRGSWLvl1InputStreamFromCtxtFile : public TRGSWLvl1InputStream {
 private:
-    std::ifstream ifs_;
-    TRGSWLvl1FFTDeserializer deser_;
-    ThreadPool pool_;
-    std::future<bool> running_;
-    TRGSWLvl1FFT loaded_;
-    size_t current_size_;
+    TRGSWLvl1CtxtFile file_;
+    // The number of TRGSWs not read yet, which are file_.at(0..head_-1)
+    size_t head_, read_ahead_;
+    std::optional<TRGSWLvl1Expander> expander_;
+    std::optional<size_t> verified_chunk_;
+
+public:
+    ReversedTRGSWLvl1InputStreamFromCtxtFile(
+        const std::string& filename,
+        std::shared_ptr<const EvalKey> ekey = nullptr,
+        size_t read_ahead = STREAM_READ_AHEAD);
+
+    size_t read_ahead() const override
+    {
+        return read_ahead_;
+    }
+
+    std::optional<size_t> num_ap() const override
+    {
+        return file_.num_ap();
+    }
+
+    size_t size() const override;
+    const TRGSWLvl1FFT& next() override;
+};
+
+// Read a ciphertext file of TRGSWLvl1CtxtFile sequentially as it arrives,
+// from stdin ("-"), a named pipe, or a regular file that is still being
+// written, which cannot be mapped as a whole in advance. The input ends at
+// EOF, or, if follow is given, when no more bytes arrive for follow
+// seconds. Chunks are verified as soon as they are read, and their TRGSWs
+// are expanded in windows of at most read_ahead. As with the streams above,
+// the last read_ahead references returned by next() stay valid.
+class TRGSWLvl1InputStreamFromPipe : public TRGSWLvl1InputStream {
+private:
+    std::string filename_;
+    int fd_;
+    std::optional<double> follow_;
+    std::shared_ptr<const EvalKey> ekey_;
+    size_t read_ahead_;
+
+    // Written by TRGSWLvl1FFTSerializer, which is read as chunks of one
+    // TRGSW without checksum
+    bool is_raw_;
+    TRGSWLvl1CtxtFile::FORMAT format_;
+    std::optional<size_t> num_ap_;
+    TRGSWLvl1Seed seed_;
+    size_t record_size_, bits_per_record_, records_per_chunk_;
+    // Bytes read ahead to detect the format
+    std::vector<char> prefix_;
+
+    // The bytes after the chunk being read are read into buf_ by io_ while
+    // the caller computes. buf_[buf_begin_, buf_end_) are read but not
+    // consumed yet, and pending_ is reading into buf_ from buf_end_.
+    // buf_ grows to buf_capacity_ when no read is pending.
+    std::unique_ptr<AsyncIO> io_;
+    std::vector<char> buf_;
+    size_t buf_begin_, buf_end_, buf_capacity_;
+    std::future<ssize_t> pending_;
+
+    // Records of the chunk being read, the number of bits in it, the number
+    // of them expanded, and the position of the chunk in the file
+    std::vector<char> chunk_;
+    size_t chunk_bits_, chunk_expanded_, chunk_index_;
+    bool is_end_;
+
+    // The count-th TRGSW is ring_.at(count % ring_.size())
+    std::vector<TRGSWLvl1FFT> ring_;
+    size_t head_, num_expanded_;
 
 private:
-    void start_loading_next();
+    // Start reading into buf_ if no read is pending and there is room
+    void refill();
+    // Return false if the input ends before the first byte
+    bool read_exactly(char* buf, size_t size);
+    bool read_chunk();
+    void expand_window();
 
 public:
-    ReversedTRGSWLvl1InputStreamFromCtxtFile(const std::string& filename);
+    TRGSWLvl1InputStreamFromPipe(const std::string& filename,
+                                 std::shared_ptr<const EvalKey> ekey = nullptr,
+                                 size_t read_ahead = STREAM_READ_AHEAD,
+                                 std::optional<double> follow = std::nullopt);
+    ~TRGSWLvl1InputStreamFromPipe();
+    TRGSWLvl1InputStreamFromPipe(const TRGSWLvl1InputStreamFromPipe&) = delete;
+    TRGSWLvl1InputStreamFromPipe& operator=(
+        const TRGSWLvl1InputStreamFromPipe&) = delete;
+
+    size_t read_ahead() const override
+    {
+        return read_ahead_;
+    }
+
+    std::optional<size_t> num_ap() const override
+    {
+        return num_ap_;
+    }
+
+    bool is_streaming() const override
+    {
+        return true;
+    }
 
     size_t size() const override;
-    TRGSWLvl1FFT next() override;
+    bool has_next() override;
+    const TRGSWLvl1FFT& next() override;
+};
+
+// Append-only log of the results of an online run, which is written instead
+// of an archive per result. The file is a header followed by records of the
+// same size. Each record has the checksum of the rest, the position of the
+// result in the input (i.e., the number of inputs read), and the result:
+//   TLWE:  TLWELvl1 of the result
+//   TRLWE: TRLWELvl1 that packs the results of num_results specs
+// A record whose checksum does not match has not been written completely.
+// Since records are written concurrently, a crash may leave such a hole
+// before records that are complete, so the log is regarded as ending at the
+// first invalid record. The file is mapped into memory.
+class ResultLogFile {
+public:
+    enum class FORMAT { TLWE, TRLWE };
+
+private:
+    const char* addr_;
+    size_t length_, record_size_, size_, num_results_;
+    FORMAT format_;
+
+private:
+    const char* record(size_t i) const;
+
+public:
+    ResultLogFile(const std::string& filename);
+    ~ResultLogFile();
+    ResultLogFile(const ResultLogFile&) = delete;
+    ResultLogFile& operator=(const ResultLogFile&) = delete;
+
+    static bool is_result_log(const std::string& filename);
+
+    // # of records
+    size_t size() const
+    {
+        return size_;
+    }
+
+    FORMAT format() const
+    {
+        return format_;
+    }
+
+    // # of results in each record
+    size_t num_results() const
+    {
+        return num_results_;
+    }
+
+    uint64_t pos(size_t i) const;
+    // Valid only for FORMAT::TLWE
+    const TLWELvl1& tlwe(size_t i) const;
+    // Valid only for FORMAT::TRLWE
+    const TRLWELvl1& trlwe(size_t i) const;
+};
+
+// Append results to a ResultLogFile. The records are written by io, so the
+// caller does not wait for storage.
+class ResultLogWriter {
+public:
+    // When to fsync(2) the log: never, after the last record, or after each
+    // record
+    enum class SYNC { NONE, END, EACH };
+
+private:
+    AsyncIO& io_;
+    int fd_;
+    ResultLogFile::FORMAT format_;
+    SYNC sync_;
+    size_t record_size_;
+    uint64_t offset_;
+
+private:
+    void append(uint64_t pos, const void* src, size_t size);
+
+public:
+    ResultLogWriter(AsyncIO& io, const std::string& filename,
+                    ResultLogFile::FORMAT format, size_t num_results,
+                    SYNC sync);
+    // Wait for the records to be written
+    ~ResultLogWriter();
+    ResultLogWriter(const ResultLogWriter&) = delete;
+    ResultLogWriter& operator=(const ResultLogWriter&) = delete;
+
+    void append(uint64_t pos, const TLWELvl1& res);
+    void append(uint64_t pos, const TRLWELvl1& res);
 };
 
 // Bootstrapping key in the broad sense
@@ -123,7 +554,7 @@ struct BKey {
     {
     }
 
-    BKey(const SecretKey& skey)
+    BKey(const SecretKey& skey, bool unrolled = false)
         : ekey(std::make_shared<EvalKey>(skey)),
           tlwel1_trlwel1_ikskey(
               std::make_shared<TFHEpp::TLWE2TRLWEIKSKey<TFHEpp::lvl11param>>())
@@ -134,6 +565,8 @@ struct BKey {
         ekey->emplaceprivksk4cb<TFHEpp::lvl21param>(skey);
         TFHEpp::tlwe2trlweikskgen<TFHEpp::lvl11param>(*tlwel1_trlwel1_ikskey,
                                                        skey);
+        if (unrolled)
+            ekey->emplacebkfftunrolled(skey);
     }
 
     template <class Archive>
@@ -158,6 +591,23 @@ void TRLWELvl1_add(TRLWELvl1& out, const TRLWELvl1& src);
 void TRLWELvl1_mult_X_k(TRLWELvl1& out, const TRLWELvl1& src, size_t k);
 uint32_t phase_of_TLWELvl1(const TLWELvl1& src, const SecretKey& skey);
 PolyLvl1 phase_of_TRLWELvl1(const TRLWELvl1& src, const SecretKey& skey);
+TRGSWLvl1FFTFloat TRGSWLvl1FFT_to_float(const TRGSWLvl1FFT& src);
+
+// Statistics of the noise of TRLWELvl1s whose coefficients are 0 or 1/2,
+// measured with the secret key. The values are in the torus, so the
+// coefficients are decrypted correctly if max_abs < 1/4.
+struct NoiseStat {
+    size_t num_samples = 0;
+    double sum_sq = 0, max_abs = 0;
+
+    // Add the noise of the first num_coeffs coefficients of c, i.e., those
+    // carrying messages. The others may be arbitrary.
+    void add(const TRLWELvl1& c, const SecretKey& skey, size_t num_coeffs = 1);
+    double stddev() const;
+};
+
+void BlindRotateLvl01(TRLWELvl1& out, const TLWELvl0& src,
+                      const PolyLvl1& testvector, const EvalKey& ek);
 void do_SEI_IKS_GBTLWE2TRLWE(TRLWELvl1& w, const EvalKey& ek);
 void do_SEI_IKS_GBTLWE2TRLWE_2(TRLWELvl1& w, const EvalKey& ek);
 void do_SEI_IKS_GBTLWE2TRLWE_3(TRLWELvl1& w, const EvalKey& ek);
@@ -167,6 +617,9 @@ void BS_TLWE_0_1o2_to_TRLWE_m1o8_1o8(TRLWELvl1& out, TLWELvl0& src,
                                      const EvalKey& ek);
 TRGSWLvl1FFT encrypt_bit_to_TRGSWLvl1FFT(bool b, const SecretKey& skey);
 bool decrypt_TLWELvl1_to_bit(const TLWELvl1& c, const SecretKey& skey);
+std::vector<bool> decrypt_TRLWELvl1_to_bits(const TRLWELvl1& c,
+                                            size_t num_bits,
+                                            const SecretKey& skey);
 PolyLvl1 uint2weight(uint64_t n);
 bool between_25_75(uint32_t n);
 void dump_weight(std::ostream& os, const PolyLvl1& w);
@@ -175,5 +628,157 @@ void CircuitBootstrappingFFTLvl11(TRGSWLvl1FFT& out, const TLWELvl1& src,
                                   const EvalKey& ek);
 void HomXORwoSE(TRLWELvl1& out, const TLWELvl0& lhs, const TLWELvl0& rhs,
                 const EvalKey& ek);
+TLWELvl1 HomANDLvl1(const std::vector<TLWELvl1>& src, const EvalKey& ek);
+
+// Maximum number of TRLWEs that CMUXFFTLvl1_tile processes at once
+constexpr size_t CMUX_MAX_TILE_SIZE = 8;
+// Compute *out[t] = sel ? *in1[t] : *in0[t] for each t < size, as
+// TFHEpp::CMUXFFT does. Each row of sel is multiplied with the decomposed
+// polynomials of all the TRLWEs in the tile while it stays in cache.
+void CMUXFFTLvl1_tile(const TRGSWLvl1FFT& sel, size_t size,
+                      TRLWELvl1* const out[], const TRLWELvl1* const in1[],
+                      const TRLWELvl1* const in0[]);
+void CMUXFFTLvl1_tile(const TRGSWLvl1FFTFloat& sel, size_t size,
+                      TRLWELvl1* const out[], const TRLWELvl1* const in1[],
+                      const TRLWELvl1* const in0[]);
+// Compute out = sel ? in1 : in0 with the work of one CMUX split across
+// threads: the IFFTs of the 2l decomposed polynomials and their products
+// with the rows of sel run in parallel, and then so do the FFTs of the two
+// components of out.
+void CMUXFFTLvl1_split(const TRGSWLvl1FFT& sel, TRLWELvl1& out,
+                       const TRLWELvl1& in1, const TRLWELvl1& in0);
+
+// Split size CMUXes into tiles and run tile(tile_size, out, in1, in0) on them
+// in parallel. get(i) returns the pointers (out, in1, in0) of the i-th CMUX.
+template <class Tile, class Func>
+void CMUXLvl1_tiled(size_t size, Tile&& tile, Func&& get)
+{
+    if (size == 0)
+        return;
+
+    // Make tiles smaller if there are too few CMUXes to keep all threads busy
+    const size_t concurrency = tbb::this_task_arena::max_concurrency(),
+                 tile_size = std::clamp<size_t>(size / concurrency, 1,
+                                                CMUX_MAX_TILE_SIZE),
+                 num_tiles = (size + tile_size - 1) / tile_size;
+    tbb::parallel_for(size_t{0}, num_tiles, [&](size_t t) {
+        TRLWELvl1* out[CMUX_MAX_TILE_SIZE];
+        const TRLWELvl1 *in1[CMUX_MAX_TILE_SIZE], *in0[CMUX_MAX_TILE_SIZE];
+        const size_t begin = t * tile_size,
+                     end = std::min(begin + tile_size, size);
+        for (size_t i = begin; i < end; i++)
+            std::tie(out[i - begin], in1[i - begin], in0[i - begin]) = get(i);
+        tile(end - begin, out, in1, in0);
+    });
+}
+
+// Run size CMUXes that share sel in parallel, splitting them into tiles.
+// If there are so few CMUXes that splitting each of them keeps more threads
+// busy, e.g., for DFAs with a handful of states, each CMUX is split instead.
+// get(i) returns the pointers (out, in1, in0) of the i-th CMUX. out must not
+// alias any of the inputs.
+template <class Func>
+void CMUXFFTLvl1_batch(const TRGSWLvl1FFT& sel, size_t size, Func&& get)
+{
+    if (size == 0)
+        return;
+
+    // A split CMUX has only 2l tasks of an IFFT and products to run in
+    // parallel, and then two FFTs, each of them followed by a join. Split
+    // only if the first tasks of all the CMUXes still fit in the threads;
+    // otherwise whole CMUXes in tiles keep the threads as busy without the
+    // joins.
+    const size_t concurrency = tbb::this_task_arena::max_concurrency();
+    if (2 * Lvl1::l * size <= concurrency) {
+        tbb::parallel_for(size_t{0}, size, [&](size_t i) {
+            auto [out, in1, in0] = get(i);
+            CMUXFFTLvl1_split(sel, *out, *in1, *in0);
+        });
+        return;
+    }
+    CMUXLvl1_tiled(
+        size, [&](auto... args) { CMUXFFTLvl1_tile(sel, args...); }, get);
+}
+
+// Same as above, but with sel in reduced precision. This always runs in the
+// FFT domain.
+template <class Func>
+void CMUXFFTLvl1_batch(const TRGSWLvl1FFTFloat& sel, size_t size, Func&& get)
+{
+    CMUXLvl1_tiled(
+        size, [&](auto... args) { CMUXFFTLvl1_tile(sel, args...); }, get);
+}
+
+// Compute *out[t] = BlindRotate<lvl01param>(*src[t]) for each t < size, as
+// TFHEpp::BlindRotate does. The rows of the bootstrapping key (unrolled one
+// if ek has it) are in the outer loop, so each row is loaded once for the
+// whole tile.
+void BlindRotateLvl01_tile(const EvalKey& ek, const PolyLvl1& testvector,
+                           size_t size, TRLWELvl1* const out[],
+                           const TLWELvl0* const src[]);
+
+// Run size blind rotations in parallel, splitting them into tiles.
+// get(i) returns the pointers (out, src) of the i-th blind rotation.
+template <class Func>
+void BlindRotateLvl01_batch(const EvalKey& ek, const PolyLvl1& testvector,
+                            size_t size, Func&& get)
+{
+    if (size == 0)
+        return;
+
+    const size_t concurrency = tbb::this_task_arena::max_concurrency(),
+                 tile_size = std::clamp<size_t>(size / concurrency, 1,
+                                                CMUX_MAX_TILE_SIZE),
+                 num_tiles = (size + tile_size - 1) / tile_size;
+    tbb::parallel_for(size_t{0}, num_tiles, [&](size_t tile) {
+        TRLWELvl1* out[CMUX_MAX_TILE_SIZE];
+        const TLWELvl0* src[CMUX_MAX_TILE_SIZE];
+        const size_t begin = tile * tile_size,
+                     end = std::min(begin + tile_size, size);
+        for (size_t i = begin; i < end; i++)
+            std::tie(out[i - begin], src[i - begin]) = get(i);
+        BlindRotateLvl01_tile(ek, testvector, end - begin, out, src);
+    });
+}
+
+// Same as BS_TLWE_0_1o2_to_TRLWE_0_1o2 for each (out, src) = get(i), but
+// blind-rotates them in batch.
+// NOTE: src is MODIFIED for efficiency!
+template <class Func>
+void BS_TLWE_0_1o2_to_TRLWE_0_1o2_batch(const EvalKey& ek, size_t size,
+                                        Func&& get)
+{
+    tbb::parallel_for(size_t{0}, size, [&](size_t i) {
+        TLWELvl0& src = *std::get<1>(get(i));
+        src[Lvl0::n] -= (1 << 30);  // 1/4
+    });
+    BlindRotateLvl01_batch(
+        ek, TFHEpp::μpolygen<Lvl1, (1 << 30) /* 1/4 */>(), size,
+        [&](size_t i) -> std::tuple<TRLWELvl1*, const TLWELvl0*> {
+            return get(i);
+        });
+    tbb::parallel_for(size_t{0}, size, [&](size_t i) {
+        TRLWELvl1& out = *std::get<0>(get(i));
+        out[1][0] += (1 << 30);  // 1/4
+    });
+}
+
+// Same as do_SEI_IKS_GBTLWE2TRLWE_2 for each *get(i), but blind-rotates them
+// in batch.
+template <class Func>
+void do_SEI_IKS_GBTLWE2TRLWE_2_batch(const EvalKey& ek, size_t size,
+                                     Func&& get)
+{
+    std::vector<TLWELvl0> tlwel0(size);
+    tbb::parallel_for(size_t{0}, size, [&](size_t i) {
+        TLWELvl1 tlwel1;
+        TFHEpp::SampleExtractIndex<Lvl1>(tlwel1, *get(i), 0);
+        TFHEpp::IdentityKeySwitch<TFHEpp::lvl10param>(
+            tlwel0.at(i), tlwel1, ek.getiksk<TFHEpp::lvl10param>());
+    });
+    BS_TLWE_0_1o2_to_TRLWE_0_1o2_batch(ek, size, [&](size_t i) {
+        return std::make_tuple(get(i), &tlwel0.at(i));
+    });
+}
 
 #endif
@@ -5,6 +5,7 @@
 
 #include <fstream>
 #include <string>
+#include <vector>
 
 template <class Func>
 void each_input_bit(const std::string& input_filename, size_t num_ap, Func func)
@@ -29,4 +30,21 @@ void each_input_bit(const std::string& input_filename, size_t num_ap, Func func)
     assert(rest == 0);
 }
 
+// Same as above, but the bits of each letter are passed in ap_order, that is,
+// p_{ap_order[0]} comes first.
+template <class Func>
+void each_input_bit(const std::string& input_filename,
+                    const std::vector<size_t>& ap_order, Func func)
+{
+    std::vector<bool> letter;
+    each_input_bit(input_filename, ap_order.size(), [&](bool b) {
+        letter.push_back(b);
+        if (letter.size() < ap_order.size())
+            return;
+        for (size_t i : ap_order)
+            func(letter.at(i));
+        letter.clear();
+    });
+}
+
 #endif
@@ -39,6 +39,31 @@ enc_run_dec(){
             nostderr $HOMFA run reversed --bkey _test_bk --spec "$3" --in _test_in --out _test_out --spec-reversed --out-freq $OUTPUT_FREQ --bootstrapping-freq $REVERSE_BOOTSTRAPPING_FREQ
             nostderr $HOMFA dec --key _test_sk --in _test_out
             ;;
+        "online-dfa-reversed-unrolled" )
+            nostderr $HOMFA enc --ap "$2" --key _test_sk --in "$4" --out _test_in
+            nostderr $HOMFA run reversed --bkey _test_bk_unrolled --spec "$3" --in _test_in --out _test_out --out-freq $OUTPUT_FREQ --bootstrapping-freq 1
+            nostderr $HOMFA dec --key _test_sk --in _test_out
+            ;;
+        "online-dfa-reversed-reduced-precision" )
+            nostderr $HOMFA enc --ap "$2" --key _test_sk --in "$4" --out _test_in
+            nostderr $HOMFA run reversed --bkey _test_bk --spec "$3" --in _test_in --out _test_out --out-freq $OUTPUT_FREQ --bootstrapping-freq $REVERSE_BOOTSTRAPPING_FREQ --reduced-precision --debug-secret-key _test_sk
+            nostderr $HOMFA dec --key _test_sk --in _test_out
+            ;;
+        "online-dfa-reversed-seeded" )
+            nostderr $HOMFA enc --ap "$2" --key _test_sk --in "$4" --out _test_in --seeded
+            nostderr $HOMFA run reversed --bkey _test_bk --spec "$3" --in _test_in --out _test_out --out-freq $OUTPUT_FREQ --bootstrapping-freq $REVERSE_BOOTSTRAPPING_FREQ
+            nostderr $HOMFA dec --key _test_sk --in _test_out
+            ;;
+        "online-dfa-reversed-packed-trlwe" )
+            nostderr $HOMFA enc --ap "$2" --key _test_sk --in "$4" --out _test_in --packed-trlwe
+            nostderr $HOMFA run reversed --bkey _test_bk --spec "$3" --in _test_in --out _test_out --out-freq $OUTPUT_FREQ --bootstrapping-freq $REVERSE_BOOTSTRAPPING_FREQ
+            nostderr $HOMFA dec --key _test_sk --in _test_out
+            ;;
+        "online-dfa-reversed-letter" )
+            nostderr $HOMFA enc --ap "$2" --key _test_sk --in "$4" --out _test_in
+            nostderr $HOMFA run reversed --bkey _test_bk --spec "$3" --in _test_in --out _test_out --ap "$2" --out-freq $OUTPUT_FREQ --bootstrapping-freq 1
+            nostderr $HOMFA dec --key _test_sk --in _test_out
+            ;;
         "online-dfa-qtrlwe2" )
             nostderr $HOMFA enc --ap "$2" --key _test_sk --in "$4" --out _test_in
             nostderr $HOMFA run flut --bkey _test_bk --spec "$3" --in _test_in --out _test_out --out-freq $OUTPUT_FREQ --max-second-lut-depth $FLUT_MAX_SECOND_LUT_DEPTH --queue-size $FLUT_QUEUE_SIZE --bootstrapping-freq 1
@@ -52,6 +77,60 @@ enc_run_dec(){
             nostderr $HOMFA run block --bkey _test_bk --spec "$3" --in _test_in --out _test_out --out-freq $OUTPUT_FREQ --queue-size $OUTPUT_FREQ
             nostderr $HOMFA dec --key _test_sk --in _test_out
             ;;
+        "online-dfa-blockbackstream-letter" )
+            nostderr $HOMFA enc --ap "$2" --key _test_sk --in "$4" --out _test_in
+            nostderr $HOMFA run block --bkey _test_bk --spec "$3" --in _test_in --out _test_out --ap "$2" --out-freq $OUTPUT_FREQ --queue-size $OUTPUT_FREQ
+            nostderr $HOMFA dec --key _test_sk --in _test_out
+            ;;
+        "online-dfa-blockbackstream-seeded" )
+            nostderr $HOMFA enc --ap "$2" --key _test_sk --in "$4" --out _test_in --seeded
+            nostderr $HOMFA run block --bkey _test_bk --spec "$3" --in _test_in --out _test_out --out-freq $OUTPUT_FREQ --queue-size $OUTPUT_FREQ
+            nostderr $HOMFA dec --key _test_sk --in _test_out
+            ;;
+        "online-dfa-blockbackstream-packed-trlwe" )
+            nostderr $HOMFA enc --ap "$2" --key _test_sk --in "$4" --out _test_in --packed-trlwe
+            nostderr $HOMFA run block --bkey _test_bk --spec "$3" --in _test_in --out _test_out --out-freq $OUTPUT_FREQ --queue-size $OUTPUT_FREQ
+            nostderr $HOMFA dec --key _test_sk --in _test_out
+            ;;
+        "online-dfa-reversed-append" )
+            nostderr $HOMFA enc --ap "$2" --key _test_sk --in test/01-07.in --out _test_in
+            nostderr $HOMFA enc --ap "$2" --key _test_sk --in "$4" --out _test_in --append
+            nostderr $HOMFA run reversed --bkey _test_bk --spec "$3" --in _test_in --out _test_out --out-freq $OUTPUT_FREQ --bootstrapping-freq $REVERSE_BOOTSTRAPPING_FREQ
+            nostderr $HOMFA dec --key _test_sk --in _test_out
+            ;;
+        "online-dfa-blockbackstream-letter-append" )
+            nostderr $HOMFA enc --ap "$2" --key _test_sk --in test/01-07.in --out _test_in --seeded
+            nostderr $HOMFA enc --ap "$2" --key _test_sk --in "$4" --out _test_in --seeded --append
+            nostderr $HOMFA run block --bkey _test_bk --spec "$3" --in _test_in --out _test_out --ap "$2" --out-freq $OUTPUT_FREQ --queue-size $OUTPUT_FREQ
+            nostderr $HOMFA dec --key _test_sk --in _test_out
+            ;;
+        "online-dfa-reversed-stdin" )
+            nostderr $HOMFA enc --ap "$2" --key _test_sk --in "$4" --out _test_in
+            nostderr $HOMFA run reversed --bkey _test_bk --spec "$3" --in - --out _test_out --out-freq $OUTPUT_FREQ --bootstrapping-freq $REVERSE_BOOTSTRAPPING_FREQ < _test_in
+            nostderr $HOMFA dec --key _test_sk --in _test_out
+            ;;
+        "online-dfa-blockbackstream-stdin" )
+            nostderr $HOMFA enc --ap "$2" --key _test_sk --in "$4" --out _test_in --packed-trlwe
+            cat _test_in | nostderr $HOMFA run block --bkey _test_bk --spec "$3" --in - --out _test_out --out-freq $OUTPUT_FREQ --queue-size $OUTPUT_FREQ
+            nostderr $HOMFA dec --key _test_sk --in _test_out
+            ;;
+        "online-dfa-reversed-fifo" )
+            rm -f _test_fifo
+            mkfifo _test_fifo
+            nostderr $HOMFA enc --ap "$2" --key _test_sk --in "$4" --out _test_fifo --seeded &
+            local pid=$!
+            nostderr $HOMFA run reversed --bkey _test_bk --spec "$3" --in _test_fifo --out _test_out --out-freq $OUTPUT_FREQ --bootstrapping-freq $REVERSE_BOOTSTRAPPING_FREQ
+            wait $pid || failwith "enc into a named pipe failed"
+            nostderr $HOMFA dec --key _test_sk --in _test_out
+            ;;
+        "online-dfa-qtrlwe2-follow" )
+            nostderr $HOMFA enc --ap "$2" --key _test_sk --in test/01-07.in --out _test_in --seeded
+            nostderr $HOMFA run flut --bkey _test_bk --spec "$3" --in _test_in --follow 5 --out _test_out --out-freq $OUTPUT_FREQ --max-second-lut-depth $FLUT_MAX_SECOND_LUT_DEPTH --queue-size $FLUT_QUEUE_SIZE --bootstrapping-freq 1 &
+            local pid=$!
+            nostderr $HOMFA enc --ap "$2" --key _test_sk --in "$4" --out _test_in --seeded --append --records-per-chunk 1
+            wait $pid || failwith "run --follow failed"
+            nostderr $HOMFA dec --key _test_sk --in _test_out
+            ;;
         * )
             failwith "Invalid run $1"
             ;;
@@ -82,6 +161,7 @@ fi
 ### Prepare secret key and bootstrapping key
 [ -f _test_sk ] || nostderr $HOMFA genkey --out _test_sk
 [ -f _test_bk ] || nostderr $HOMFA genbkey --key _test_sk --out _test_bk
+[ -f _test_bk_unrolled ] || nostderr $HOMFA genbkey --key _test_sk --out _test_bk_unrolled --unrolled
 
 #### Plain DFA
 check_true  dfa-plain 2 test/01.spec test/01-01.in # [1, 1] * 8 * 100
@@ -96,6 +176,10 @@ check_true  dfa-plain 9 test/10.spec test/10-01.in # "111111111" * 100
 check_false dfa-plain 9 test/10.spec test/10-02.in # "111111110" * 100
 check_true  dfa-plain 9 test/10.spec test/10-03.in # "111111110" * 90
 
+#### Plain DFA (batched)
+res=$($HOMFA run plain-batch --ap 2 --spec test/01.spec --in test/01-0{1,2,3,4,5,6,7,8}.in 2>> _test_stderr | cut -f2 | tr -d '\n')
+[ "$res" = "10101010" ] || failwith "plain-batch failed: $res"
+
 #### Offline DFA
 check_true  offline-dfa 2 test/01.spec test/01-01.in # [1, 1] * 8 * 100
 check_false offline-dfa 2 test/01.spec test/01-02.in # [1, 0] * 8 * 100
@@ -119,6 +203,28 @@ check_true  online-dfa-reversed 9 test/10.spec test/10-01.in # "111111111" * 100
 check_false online-dfa-reversed 9 test/10.spec test/10-02.in # "111111110" * 100
 check_true  online-dfa-reversed 9 test/10.spec test/10-03.in # "111111110" * 90
 
+#### Online DFA (reversed, unrolled bootstrapping key)
+check_true  online-dfa-reversed-unrolled 2 test/01.spec test/01-07.in # [1, 1] * 4
+check_false online-dfa-reversed-unrolled 2 test/01.spec test/01-08.in # [1, 0] * 4
+
+#### Online DFA (reversed, reduced precision)
+check_true  online-dfa-reversed-reduced-precision 2 test/01.spec test/01-07.in # [1, 1] * 4
+check_false online-dfa-reversed-reduced-precision 2 test/01.spec test/01-08.in # [1, 0] * 4
+check_true  online-dfa-reversed-reduced-precision 2 test/01.spec test/01-01.in # [0, 0] * 8 * 100
+check_false online-dfa-reversed-reduced-precision 2 test/01.spec test/01-02.in # [1, 0] * 8 * 100
+nostderr $HOMFA enc --ap 2 --key _test_sk --in test/01-02.in --out _test_in
+$HOMFA run reversed --bkey _test_bk --spec test/01.spec --spec test/03.spec --packed --in _test_in --out _test_out --out-freq $OUTPUT_FREQ --bootstrapping-freq $REVERSE_BOOTSTRAPPING_FREQ --reduced-precision --debug-secret-key _test_sk 2> _test_noise_log || failwith "Failed with --reduced-precision"
+! grep -q "is too large" _test_noise_log || failwith "Too large noise with --reduced-precision"
+
+#### Online DFA (reversed, seeded ciphertexts)
+check_true  online-dfa-reversed-seeded 2 test/01.spec test/01-07.in # [1, 1] * 4
+check_false online-dfa-reversed-seeded 2 test/01.spec test/01-08.in # [1, 0] * 4
+check_true  online-dfa-reversed-seeded 2 test/01.spec test/01-03.in # [0, 0, 1, 0, 0, 1, 0, 1, 1, 1] * 8 * 20
+
+#### Online DFA (reversed, packed TRLWE inputs)
+check_true  online-dfa-reversed-packed-trlwe 2 test/01.spec test/01-07.in # [1, 1] * 4
+check_false online-dfa-reversed-packed-trlwe 2 test/01.spec test/01-08.in # [1, 0] * 4
+
 #### Online DFA (qtrlwe2)
 check_true  online-dfa-qtrlwe2 2 test/01.spec test/01-07.in # [1, 1] * 4
 check_false online-dfa-qtrlwe2 2 test/01.spec test/01-08.in # [1, 0] * 4
@@ -139,6 +245,82 @@ check_true  online-dfa-blockbackstream 9 test/10.spec test/10-01.in # "111111111
 check_false online-dfa-blockbackstream 9 test/10.spec test/10-02.in # "111111110" * 100
 check_true  online-dfa-blockbackstream 9 test/10.spec test/10-03.in # "111111110" * 90
 
+#### Online DFA (block-backstream, seeded ciphertexts)
+check_true  online-dfa-blockbackstream-seeded 2 test/01.spec test/01-01.in # [0, 0] * 8 * 100
+check_false online-dfa-blockbackstream-seeded 2 test/01.spec test/01-02.in # [1, 0] * 8 * 100
+
+#### Online DFA (block-backstream, packed TRLWE inputs)
+check_true  online-dfa-blockbackstream-packed-trlwe 2 test/01.spec test/01-07.in # [1, 1] * 4
+check_false online-dfa-blockbackstream-packed-trlwe 2 test/01.spec test/01-08.in # [1, 0] * 4
+
+#### Letters of multiple APs
+check_true  online-dfa-reversed-letter 2 test/01.spec test/01-07.in # [1, 1] * 4
+check_false online-dfa-reversed-letter 2 test/01.spec test/01-08.in # [1, 0] * 4
+check_true  online-dfa-reversed-letter 9 test/10.spec test/10-01.in # "111111111" * 100
+check_false online-dfa-reversed-letter 9 test/10.spec test/10-02.in # "111111110" * 100
+check_false online-dfa-blockbackstream-letter 2 test/01.spec test/01-02.in # [1, 0] * 8 * 100
+check_true  online-dfa-blockbackstream-letter 9 test/10.spec test/10-03.in # "111111110" * 90
+
+#### Appended chunks (prefixed with test/01-07.in)
+check_true  online-dfa-reversed-append 2 test/01.spec test/01-07.in # [1, 1] * 8
+check_false online-dfa-reversed-append 2 test/01.spec test/01-08.in # [1, 1] * 4 + [1, 0] * 4
+check_true  online-dfa-blockbackstream-letter-append 2 test/01.spec test/01-07.in # [1, 1] * 8
+check_false online-dfa-blockbackstream-letter-append 2 test/01.spec test/01-08.in # [1, 1] * 4 + [1, 0] * 4
+
+#### Streaming inputs
+check_true  online-dfa-reversed-stdin 2 test/01.spec test/01-07.in # [1, 1] * 4
+check_false online-dfa-reversed-stdin 2 test/01.spec test/01-08.in # [1, 0] * 4
+check_true  online-dfa-blockbackstream-stdin 2 test/01.spec test/01-07.in # [1, 1] * 4
+check_false online-dfa-blockbackstream-stdin 2 test/01.spec test/01-08.in # [1, 0] * 4
+check_true  online-dfa-reversed-fifo 2 test/01.spec test/01-07.in # [1, 1] * 4
+check_false online-dfa-reversed-fifo 2 test/01.spec test/01-08.in # [1, 0] * 4
+check_true  online-dfa-qtrlwe2-follow 2 test/01.spec test/01-07.in # [1, 1] * 8
+check_false online-dfa-qtrlwe2-follow 2 test/01.spec test/01-08.in # [1, 1] * 4 + [1, 0] * 4
+
+#### Translation portfolio
+nostderr $HOMFA ltl2spec --portfolio nfa:any:high,direct:det:high,direct:small:low --time-budget 60 "G(p0 -> p1)" 2 > _test_portfolio.spec
+check_true  dfa-plain 2 _test_portfolio.spec test/01-07.in # [1, 1] * 4
+check_false dfa-plain 2 _test_portfolio.spec test/01-08.in # [1, 0] * 4
+
+#### AP order
+nostderr $HOMFA ltl2spec --optimize-ap-order _test_ap_order "G(p0 -> p1)" 2 > _test_opt.spec
+nostderr $HOMFA enc --ap 2 --ap-order _test_ap_order --key _test_sk --in test/01-07.in --out _test_in
+nostderr $HOMFA run reversed --bkey _test_bk --spec _test_opt.spec --in _test_in --out _test_out --out-freq $OUTPUT_FREQ --bootstrapping-freq $REVERSE_BOOTSTRAPPING_FREQ
+[ $($HOMFA dec --key _test_sk --in _test_out 2>> _test_stderr) = "1" ] || failwith "Expected true for optimized AP order"
+nostderr $HOMFA enc --ap 2 --ap-order _test_ap_order --key _test_sk --in test/01-08.in --out _test_in
+nostderr $HOMFA run reversed --bkey _test_bk --spec _test_opt.spec --in _test_in --out _test_out --out-freq $OUTPUT_FREQ --bootstrapping-freq $REVERSE_BOOTSTRAPPING_FREQ
+[ $($HOMFA dec --key _test_sk --in _test_out 2>> _test_stderr) = "0" ] || failwith "Expected false for optimized AP order"
+
+#### Conjunction of specs
+nostderr $HOMFA ltl2spec --split-conjunction --out-dir _test_split "G p0 & G(p1 -> X p0)" 2
+[ $(ls _test_split/*.spec | wc -l) -eq 2 ] || failwith "ltl2spec --split-conjunction failed"
+$HOMFA ltl2spec --split-conjunction --out-dir _test_split --portfolio direct:det:high "G p0" 1 2>/dev/null && failwith "ltl2spec --split-conjunction accepted --portfolio"
+nostderr $HOMFA spec2spec --negated test/01.spec > _test_neg.spec
+nostderr $HOMFA enc --ap 2 --key _test_sk --in test/01-07.in --out _test_in
+nostderr $HOMFA run reversed --bkey _test_bk --spec test/01.spec --spec test/03.spec --in _test_in --out _test_out --out-freq $OUTPUT_FREQ --bootstrapping-freq $REVERSE_BOOTSTRAPPING_FREQ
+[ $($HOMFA dec --key _test_sk --in _test_out 2>> _test_stderr) = "1" ] || failwith "Expected true for conjunction of specs"
+nostderr $HOMFA run reversed --bkey _test_bk --spec test/01.spec --spec test/03.spec --spec _test_neg.spec --in _test_in --out _test_out --out-freq $OUTPUT_FREQ --bootstrapping-freq $REVERSE_BOOTSTRAPPING_FREQ
+[ $($HOMFA dec --key _test_sk --in _test_out 2>> _test_stderr) = "0" ] || failwith "Expected false for conjunction of specs"
+
+#### Packed specs
+nostderr $HOMFA run offline --bkey _test_bk --spec test/01.spec --spec _test_neg.spec --spec test/03.spec --packed --in _test_in --out _test_out --bootstrapping-freq $OFFLINE_BOOTSTRAPPING_FREQ
+[ $($HOMFA dec --key _test_sk --in _test_out --packed 3 2>> _test_stderr) = "101" ] || failwith "Expected 101 for packed offline"
+nostderr $HOMFA run reversed --bkey _test_bk --spec test/01.spec --spec _test_neg.spec --spec test/03.spec --packed --in _test_in --out _test_out --out-freq $OUTPUT_FREQ --bootstrapping-freq 1
+[ $($HOMFA dec --key _test_sk --in _test_out --packed 3 2>> _test_stderr) = "101" ] || failwith "Expected 101 for packed reversed"
+
+#### Periodic results
+nostderr $HOMFA enc --ap 2 --key _test_sk --in test/01-03.in --out _test_in
+rm -rf _test_out_dir
+nostderr $HOMFA run reversed --bkey _test_bk --spec test/01.spec --in _test_in --out-dir _test_out_dir --out-freq 400 --bootstrapping-freq $REVERSE_BOOTSTRAPPING_FREQ
+[ $(ls _test_out_dir/*.out | wc -l) -eq 4 ] || failwith "Expected 4 results in --out-dir"
+[ $($HOMFA dec --key _test_sk --in _test_out_dir/1600.out 2>> _test_stderr) = "1" ] || failwith "Expected true for --out-dir"
+nostderr $HOMFA run reversed --bkey _test_bk --spec test/01.spec --in _test_in --out-log _test_log --out-freq 400 --bootstrapping-freq $REVERSE_BOOTSTRAPPING_FREQ
+[ "$($HOMFA dec --key _test_sk --in _test_log 2>> _test_stderr | tail -n 1)" = "1600 1" ] || failwith "Expected true at 1600 in result log"
+[ "$($HOMFA dec --key _test_sk --in _test_log --summary 2>> _test_stderr)" = "4/4 -" ] || failwith "Expected all true in result log"
+nostderr $HOMFA enc --ap 2 --key _test_sk --in test/01-02.in --out _test_in
+nostderr $HOMFA run flut --bkey _test_bk --spec test/01.spec --in _test_in --out-log _test_log --out-log-sync each --out-freq 390 --max-second-lut-depth $FLUT_MAX_SECOND_LUT_DEPTH --queue-size $FLUT_QUEUE_SIZE --bootstrapping-freq 1
+[ "$($HOMFA dec --key _test_sk --in _test_log --summary 2>> _test_stderr)" = "0/5 390" ] || failwith "Expected all false in result log"
+
 ### Clean up temporary files
 #rm _test_sk _test_bk _test_in _test_out #_test_random.log
 